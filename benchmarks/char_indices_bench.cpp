@@ -0,0 +1,293 @@
+/// \file
+/// Benchmarks of the conversions of character positions on generated
+/// documents.
+///
+/// Built with the `labelbuddy_bench` CMake target, which is not part of the
+/// default build (use a release build for meaningful timings):
+///
+///     cmake -DCMAKE_BUILD_TYPE=Release /path/to/labelbuddy
+///     cmake --build . --target labelbuddy_bench
+///     ./labelbuddy_bench [--max-size BYTES]
+///
+/// Documents from 1 KB to `--max-size` (100 MB by default) of UTF-8 are
+/// generated with several mixes of ASCII, 2- and 3-byte characters and
+/// surrogate pairs, with one converted position per 100 characters. For each
+/// operation the time per Unicode char of the document, the time per
+/// converted position and the number of heap allocations are reported.
+/// Allocations are counted by wrapping `malloc` with glibc, which also counts
+/// the allocations of Qt containers; elsewhere only `operator new` is counted.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+
+#include "char_indices.h"
+#include "utf8_offset_index.h"
+
+namespace {
+
+/// heap allocations so far; the benchmark only uses one thread
+std::size_t nAllocations{};
+
+} // namespace
+
+#ifdef __GLIBC__
+
+extern "C" {
+
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+
+void* malloc(std::size_t size) noexcept {
+  ++nAllocations;
+  return __libc_malloc(size);
+}
+
+void* calloc(std::size_t n, std::size_t size) noexcept {
+  ++nAllocations;
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, std::size_t size) noexcept {
+  ++nAllocations;
+  return __libc_realloc(ptr, size);
+}
+}
+
+#else
+
+void* operator new(std::size_t size) {
+  ++nAllocations;
+  auto ptr = std::malloc(size != 0 ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+#endif
+
+namespace labelbuddy {
+namespace {
+
+/// Proportions of non-ASCII characters in a generated text, per 1000 chars
+struct TextMix {
+  const char* name;
+  int nTwoBytes;
+  int nThreeBytes;
+  int nSurrogatePairs;
+};
+
+const TextMix textMixes[] = {{"ascii", 0, 0, 0},
+                             {"latin", 50, 0, 0},
+                             {"cjk", 0, 900, 0},
+                             {"emoji", 0, 0, 100},
+                             {"mixed", 200, 200, 100}};
+
+/// A text of about `utf8Size` bytes when encoded as UTF-8
+QString generateText(const TextMix& mix, qint64 utf8Size) {
+  // always the same text for a mix and size
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> permille(0, 999);
+  std::uniform_int_distribution<int> letter(0, 26);
+  QString text{};
+  text.reserve(static_cast<int>(utf8Size));
+  qint64 size{};
+  while (size < utf8Size) {
+    auto draw = permille(generator);
+    if (draw < mix.nSurrogatePairs) {
+      // emoticons
+      auto codePoint = static_cast<uint>(0x1f600 + draw % 0x50);
+      text.append(QChar(QChar::highSurrogate(codePoint)));
+      text.append(QChar(QChar::lowSurrogate(codePoint)));
+      size += 4;
+    } else if ((draw -= mix.nSurrogatePairs) < mix.nThreeBytes) {
+      // CJK ideographs
+      text.append(QChar(static_cast<ushort>(0x4e00 + draw)));
+      size += 3;
+    } else if ((draw -= mix.nThreeBytes) < mix.nTwoBytes) {
+      // accented Latin letters
+      text.append(QChar(static_cast<ushort>(0xc0 + draw % 0x40)));
+      size += 2;
+    } else {
+      auto ascii = letter(generator);
+      text.append(QChar(ascii == 26 ? ' ' : 'a' + ascii));
+      size += 1;
+    }
+  }
+  return text;
+}
+
+/// Sorted positions from 0 to `length`, one per 100 characters
+std::vector<int> generateIndices(int length) {
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int> position(0, length);
+  std::vector<int> indices(static_cast<std::size_t>(std::max(1, length / 100)));
+  for (auto& index : indices) {
+    index = position(generator);
+  }
+  std::sort(indices.begin(), indices.end());
+  return indices;
+}
+
+QString formatSize(qint64 size) {
+  if (size >= 1000000) {
+    return QString("%0MB").arg(size / 1000000);
+  }
+  return QString("%0KB").arg(size / 1000);
+}
+
+/// Results are added here so the compiler cannot remove the conversions
+qint64 checksum{};
+
+class Report {
+public:
+  Report(const TextMix& mix, qint64 utf8Size, int nChars)
+      : mix_(mix), size_(formatSize(utf8Size)), nChars_(nChars) {}
+
+  /// Run `operation` and print its time and allocations.
+
+  /// `nIndices` is the number of positions it converts or checks, 0 if it
+  /// processes the whole text.
+  template <typename Operation>
+  void measure(const char* name, int nIndices, Operation operation) {
+    auto allocationsBefore = nAllocations;
+    QElapsedTimer timer{};
+    timer.start();
+    operation();
+    auto elapsedNs = static_cast<double>(timer.nsecsElapsed());
+    auto allocations = nAllocations - allocationsBefore;
+    char nsPerIndex[16] = "-";
+    if (nIndices != 0) {
+      std::snprintf(nsPerIndex, sizeof(nsPerIndex), "%.1f",
+                    elapsedNs / nIndices);
+    }
+    std::printf("%-6s %6s %-34s %10.3f %9.3f %10s %10zu\n", mix_.name,
+                qPrintable(size_), name, elapsedNs / 1e6,
+                elapsedNs / nChars_, nsPerIndex, allocations);
+    std::fflush(stdout);
+  }
+
+private:
+  const TextMix& mix_;
+  QString size_;
+  int nChars_;
+};
+
+void benchmarkText(const TextMix& mix, qint64 utf8Size) {
+  auto text = generateText(mix, utf8Size);
+  auto utf8Text = text.toUtf8();
+  CharIndices charIndices{};
+  CharIndices withUtf8{text, utf8Text};
+  Report report(mix, utf8Size, withUtf8.unicodeLength());
+
+  report.measure("CharIndices::setText", 0,
+                 [&]() { charIndices.setText(text); });
+
+  auto unicodeIndices = generateIndices(charIndices.unicodeLength());
+  auto nIndices = static_cast<int>(unicodeIndices.size());
+  QList<int> unicodeIndicesList{};
+  for (auto index : unicodeIndices) {
+    unicodeIndicesList << index;
+  }
+  std::vector<int> qStringIndices{};
+  for (auto index : unicodeIndices) {
+    qStringIndices.push_back(charIndices.unicodeToQString(index));
+  }
+  auto utf8Indices = charIndices.unicodeToUtf8Sorted(unicodeIndices);
+  QList<int> utf8IndicesList{};
+  for (auto index : utf8Indices) {
+    utf8IndicesList << index;
+  }
+
+  report.measure("unicodeToQString (single)", nIndices, [&]() {
+    for (auto index : unicodeIndices) {
+      checksum += charIndices.unicodeToQString(index);
+    }
+  });
+  report.measure("qStringToUnicode (single)", nIndices, [&]() {
+    for (auto index : qStringIndices) {
+      checksum += charIndices.qStringToUnicode(index);
+    }
+  });
+  report.measure("unicodeToQString (map)", nIndices, [&]() {
+    checksum += charIndices
+                    .unicodeToQString(unicodeIndicesList.cbegin(),
+                                      unicodeIndicesList.cend())
+                    .size();
+  });
+  report.measure("unicodeToUtf8 (map)", nIndices, [&]() {
+    checksum += charIndices
+                    .unicodeToUtf8(unicodeIndicesList.cbegin(),
+                                   unicodeIndicesList.cend())
+                    .size();
+  });
+  report.measure("unicodeToUtf8Sorted", nIndices, [&]() {
+    checksum += charIndices.unicodeToUtf8Sorted(unicodeIndices).back();
+  });
+  report.measure("utf8ToUnicode (map)", nIndices, [&]() {
+    checksum += charIndices
+                    .utf8ToUnicode(utf8IndicesList.cbegin(),
+                                   utf8IndicesList.cend())
+                    .size();
+  });
+  report.measure("utf8ToUnicodeSorted", nIndices, [&]() {
+    checksum += charIndices.utf8ToUnicodeSorted(utf8Indices).back();
+  });
+  report.measure("isValidUtf8Index (UTF-8 given)", nIndices, [&]() {
+    for (auto index : utf8Indices) {
+      checksum += withUtf8.isValidUtf8Index(index);
+    }
+  });
+  // the text is encoded by each call, so only a few are timed
+  auto nEncodingCalls = std::min(nIndices, 3);
+  report.measure("isValidUtf8Index (text encoded)", nEncodingCalls, [&]() {
+    for (int i = 0; i != nEncodingCalls; ++i) {
+      checksum += charIndices.isValidUtf8Index(
+          utf8Indices[static_cast<std::size_t>(i)]);
+    }
+  });
+
+  Utf8OffsetIndex utf8Index{};
+  report.measure("Utf8OffsetIndex::setText", 0,
+                 [&]() { checksum += utf8Index.setText(utf8Text); });
+  report.measure("Utf8OffsetIndex::unicodeToUtf8Sorted", nIndices, [&]() {
+    checksum += utf8Index.unicodeToUtf8Sorted(unicodeIndices).back();
+  });
+}
+
+} // namespace
+} // namespace labelbuddy
+
+int main(int argc, char* argv[]) {
+  qint64 maxSize{100000000};
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+      maxSize = std::strtoll(argv[++i], nullptr, 10);
+    } else {
+      std::fprintf(stderr, "usage: %s [--max-size BYTES]\n", argv[0]);
+      return 1;
+    }
+  }
+  std::printf("%-6s %6s %-34s %10s %9s %10s %10s\n", "text", "size",
+              "operation", "ms", "ns/char", "ns/index", "allocs");
+  for (const auto& mix : labelbuddy::textMixes) {
+    for (qint64 size = 1000; size <= maxSize; size *= 10) {
+      labelbuddy::benchmarkText(mix, size);
+    }
+  }
+  // printed so the conversions are not optimized away
+  std::printf("checksum: %lld\n", labelbuddy::checksum);
+  return 0;
+}
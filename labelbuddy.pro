@@ -21,6 +21,18 @@ src/char_indices.h \
 src/char_indices.tpp \
 src/annotations_list_model.h \
 src/annotations_list.h \
+src/ordered_task_queue.h \
+src/ordered_task_queue.tpp \
+src/parallel_docs_reader.h \
+src/bulk_inserter.h \
+src/compressed_file.h \
+src/line_index.h \
+src/doc_record_parser.h \
+src/simd.h \
+src/utf8.h \
+src/progress_reporter.h \
+src/json_writer.h \
+src/utf8_offset_index.h \
 
 
 SOURCES += \
@@ -42,11 +54,34 @@ src/compat.cpp \
 src/char_indices.cpp \
 src/annotations_list_model.cpp \
 src/annotations_list.cpp \
+src/parallel_docs_reader.cpp \
+src/bulk_inserter.cpp \
+src/compressed_file.cpp \
+src/line_index.cpp \
+src/doc_record_parser.cpp \
+src/utf8.cpp \
+src/progress_reporter.cpp \
+src/json_writer.cpp \
+src/utf8_offset_index.cpp \
 
 
 QT += widgets sql
+CONFIG += thread
 RESOURCES = resources.qrc
 
+# compressed document files are supported if the libraries are found
+unix {
+CONFIG += link_pkgconfig
+packagesExist(zlib) {
+PKGCONFIG += zlib
+DEFINES += LABELBUDDY_WITH_ZLIB
+}
+packagesExist(libzstd) {
+PKGCONFIG += libzstd
+DEFINES += LABELBUDDY_WITH_ZSTD
+}
+}
+
 macx {
 ICON = data/icons/labelbuddy.icns
 }
@@ -87,6 +122,7 @@ test/test_import_export_menu.h \
 test/test_char_indices.h \
 test/test_annotations_list_model.h \
 test/test_annotations_list.h \
+test/test_json_writer.h \
 
 
 SOURCES += \
@@ -107,6 +143,7 @@ test/test_import_export_menu.cpp \
 test/test_char_indices.cpp \
 test/test_annotations_list_model.cpp \
 test/test_annotations_list.cpp \
+test/test_json_writer.cpp \
 
 SOURCES -= src/main.cpp
 }
@@ -9,3 +9,4 @@ codename=$(lsb_release -cs)
 
 apt-get install -y g++
 apt-get install -y qtbase5-dev
+apt-get install -y zlib1g-dev libzstd-dev
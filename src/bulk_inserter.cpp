@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <cstring>
+
+#include <QCryptographicHash>
+#include <QSqlDatabase>
+#include <QStringList>
+
+#include "bulk_inserter.h"
+#include "utils.h"
+
+namespace labelbuddy {
+
+constexpr int BulkInserter::annotationBatchSize_;
+
+BulkInserter::BulkInserter(const QString& databaseName, int& colorIndex,
+                           bool dryRun)
+    : databaseName_(databaseName),
+      insertDocQuery_(QSqlDatabase::database(databaseName)),
+      insertUtf8IndexQuery_(QSqlDatabase::database(databaseName)),
+      selectUtf8IndexQuery_(QSqlDatabase::database(databaseName)),
+      insertLabelQuery_(QSqlDatabase::database(databaseName)),
+      selectLabelIdQuery_(QSqlDatabase::database(databaseName)),
+      insertAnnotationsQuery_(QSqlDatabase::database(databaseName)),
+      selectMaxAnnotationRowidQuery_(QSqlDatabase::database(databaseName)),
+      insertChangesQuery_(QSqlDatabase::database(databaseName)),
+      selectAnnotationQuery_(QSqlDatabase::database(databaseName)),
+      colorIndex_(colorIndex), dryRun_{dryRun},
+      utf8Database_{isUtf8Database(databaseName)} {
+  insertDocQuery_.prepare(
+      QString("insert into document (content, content_md5, metadata, "
+              "display_title, list_title) values (%0, :md5, :extra, :st, "
+              ":lt);")
+          .arg(utf8Database_ ? "cast(:content as text)" : ":content"));
+  insertUtf8IndexQuery_.prepare("insert or replace into document_utf8_index "
+                                "(doc_id, runs) values (:docid, :runs);");
+  // the text is only read if the document has no index
+  selectUtf8IndexQuery_.prepare(
+      QString("select runs, case when runs is null then %0 end from document "
+              "left join document_utf8_index on doc_id = id where id = "
+              ":docid;")
+          .arg(utf8Database_ ? "cast(content as blob)" : "content"));
+  insertLabelQuery_.prepare(
+      "insert into label (name, color) values (:name, :color);");
+  selectLabelIdQuery_.prepare("select id from label where name = :lname;");
+  insertAnnotationsQuery_.prepare(
+      annotationInsertStatement(annotationBatchSize_));
+  if (!dryRun_) {
+    QSqlQuery query(QSqlDatabase::database(databaseName));
+    query.prepare("select count(*) from sqlite_master where type = 'trigger' "
+                  "and name = :name;");
+    query.bindValue(":name", annotationInsertTrigger().name);
+    query.exec();
+    recordsChanges_ = query.next() && query.value(0).toInt() == 0;
+    selectMaxAnnotationRowidQuery_.prepare(
+        "select coalesce(max(rowid), 0) from annotation;");
+    // the rows inserted by a batch have larger rowids than the existing ones
+    insertChangesQuery_.prepare(
+        "insert or replace into document_change (doc_id) select distinct "
+        "doc_id from annotation where rowid > :rowid;");
+  } else {
+    QSqlQuery query(QSqlDatabase::database(databaseName));
+    query.exec("select coalesce(max(id), 0) from label;");
+    query.next();
+    maxExistingLabelId_ = query.value(0).toInt();
+    // uses the index of the table's unique constraint
+    selectAnnotationQuery_.prepare(
+        "select 1 from annotation where doc_id = :docid and start_char = "
+        ":start and end_char = :end and label_id = :labelid;");
+  }
+  pendingAnnotations_.reserve(annotationBatchSize_);
+  timer_.start();
+  loadDocIds();
+}
+
+bool BulkInserter::toMd5Key(const QByteArray& md5, Md5Key& key) {
+  if (md5.size() != 16) {
+    return false;
+  }
+  std::memcpy(&key.high, md5.constData(), 8);
+  std::memcpy(&key.low, md5.constData() + 8, 8);
+  return true;
+}
+
+void BulkInserter::loadDocIds() {
+  QSqlQuery query(QSqlDatabase::database(databaseName_));
+  query.setForwardOnly(true);
+  query.exec("select content_md5, id from document;");
+  Md5Key key{};
+  while (query.next()) {
+    auto docId = query.value(1).toInt();
+    maxExistingDocId_ = std::max(maxExistingDocId_, docId);
+    if (toMd5Key(query.value(0).toByteArray(), key)) {
+      docIds_.insert(key, docId);
+    }
+  }
+}
+
+int BulkInserter::findDocId(const QByteArray& md5) const {
+  Md5Key key{};
+  if (!toMd5Key(md5, key)) {
+    return -1;
+  }
+  return docIds_.value(key, -1);
+}
+
+void BulkInserter::insertDocRecord(const DocRecord& record) {
+  QByteArray hash{};
+  QByteArray contentUtf8{};
+  if (record.validContent) {
+    // the text is encoded at most once, and only if the reader did not
+    // provide the UTF-8
+    contentUtf8 = record.contentUtf8.isEmpty() ? record.content.toUtf8()
+                                               : record.contentUtf8;
+    hash = record.contentMd5;
+    if (hash.isEmpty()) {
+      hash = QCryptographicHash::hash(contentUtf8, QCryptographicHash::Md5);
+    }
+  } else {
+    ++counts_.nRecordsWithoutText;
+    if (record.declaredMd5 == QString()) {
+      counts_.nAnnotationsWithoutDoc += record.annotations.size();
+      return;
+    }
+    // bad chars are skipped. this is not inserted in db but used for lookup.
+    hash = QByteArray::fromHex(record.declaredMd5.toUtf8());
+  }
+  auto docId = findDocId(hash);
+  // the index is stored with a new document and converts the UTF-8 positions
+  // of annotations. the reader's UTF-8 is always valid (it is only kept if it
+  // is, otherwise the text is encoded from the QString)
+  Utf8OffsetIndex utf8Index{};
+  if (record.validContent && (docId == -1 || !record.annotations.empty())) {
+    utf8Index.setText(contentUtf8);
+  }
+  if (docId == -1 && record.validContent) {
+    docId = insertDoc(record, contentUtf8, hash, utf8Index);
+  } else if (record.validContent && docId > maxExistingDocId_) {
+    ++counts_.nDuplicateDocs;
+  } else if (record.validContent) {
+    ++counts_.nDocsInDatabase;
+  }
+  if (docId == -1) {
+    counts_.nAnnotationsWithoutDoc += record.annotations.size();
+    return;
+  }
+  if (record.annotations.empty()) {
+    return;
+  }
+  // a document found by its checksum has the same content as the record, so
+  // its index only needs to be read from the database when the record has no
+  // text
+  queueAnnotations(docId,
+                   record.validContent ? utf8Index : getUtf8Index(docId),
+                   record.annotations);
+}
+
+int BulkInserter::insertDoc(const DocRecord& record,
+                            const QByteArray& contentUtf8,
+                            const QByteArray& md5,
+                            const Utf8OffsetIndex& utf8Index) {
+  if (record.content.isEmpty()) {
+    // would fail the table's check constraint
+    ++counts_.nEmptyDocs;
+    return -1;
+  }
+  int docId{};
+  if (dryRun_) {
+    ++nDryRunDocs_;
+    docId = maxExistingDocId_ + nDryRunDocs_;
+    // later records without text can annotate it
+    dryRunUtf8Indexes_.insert(docId, utf8Index.toBytes());
+  } else {
+    // bound as a blob and cast to text by SQLite, which stores UTF-8: unlike
+    // a QString it needs no conversion. other encodings need the QString
+    if (utf8Database_) {
+      insertDocQuery_.bindValue(":content", contentUtf8);
+    } else {
+      insertDocQuery_.bindValue(":content", record.content);
+    }
+    insertDocQuery_.bindValue(":md5", md5);
+    insertDocQuery_.bindValue(":extra", record.metadata);
+    insertDocQuery_.bindValue(":st", record.displayTitle != QString()
+                                         ? record.displayTitle
+                                         : QVariant());
+    insertDocQuery_.bindValue(":lt", record.listTitle != QString()
+                                         ? record.listTitle
+                                         : QVariant());
+    if (!insertDocQuery_.exec()) {
+      return -1;
+    }
+    docId = insertDocQuery_.lastInsertId().toInt();
+    insertUtf8IndexQuery_.bindValue(":docid", docId);
+    insertUtf8IndexQuery_.bindValue(":runs", utf8Index.toBytes());
+    insertUtf8IndexQuery_.exec();
+  }
+  ++counts_.nNewDocs;
+  Md5Key key{};
+  if (toMd5Key(md5, key)) {
+    docIds_.insert(key, docId);
+  }
+  return docId;
+}
+
+Utf8OffsetIndex BulkInserter::getUtf8Index(int docId) {
+  Utf8OffsetIndex utf8Index{};
+  auto dryRunIndex = dryRunUtf8Indexes_.constFind(docId);
+  if (dryRunIndex != dryRunUtf8Indexes_.constEnd()) {
+    utf8Index.fromBytes(dryRunIndex.value());
+    return utf8Index;
+  }
+  selectUtf8IndexQuery_.bindValue(":docid", docId);
+  selectUtf8IndexQuery_.exec();
+  if (!selectUtf8IndexQuery_.next()) {
+    selectUtf8IndexQuery_.finish();
+    return utf8Index;
+  }
+  auto storedIndex = selectUtf8IndexQuery_.value(0).toByteArray();
+  // in a database that does not store UTF-8 the content is a QString, which
+  // is encoded by toByteArray
+  auto contentUtf8 = selectUtf8IndexQuery_.value(1).toByteArray();
+  selectUtf8IndexQuery_.finish();
+  if (!storedIndex.isNull()) {
+    utf8Index.fromBytes(storedIndex);
+    return utf8Index;
+  }
+  utf8Index.setText(contentUtf8);
+  if (!dryRun_) {
+    insertUtf8IndexQuery_.bindValue(":docid", docId);
+    insertUtf8IndexQuery_.bindValue(":runs", utf8Index.toBytes());
+    insertUtf8IndexQuery_.exec();
+  }
+  return utf8Index;
+}
+
+int BulkInserter::getLabelId(const QString& labelName) {
+  auto cached = labelIds_.constFind(labelName);
+  if (cached != labelIds_.constEnd()) {
+    return cached.value();
+  }
+  if (!dryRun_) {
+    insertLabelQuery_.bindValue(":name", labelName);
+    insertLabelQuery_.bindValue(":color", suggestLabelColor(colorIndex_));
+    if (insertLabelQuery_.exec()) {
+      ++colorIndex_;
+      ++counts_.nNewLabels;
+    }
+  }
+  selectLabelIdQuery_.bindValue(":lname", labelName);
+  selectLabelIdQuery_.exec();
+  int labelId{};
+  if (selectLabelIdQuery_.next()) {
+    labelId = selectLabelIdQuery_.value(0).toInt();
+    selectLabelIdQuery_.finish();
+  } else if (dryRun_ && labelName != QString()) {
+    // would be created
+    ++counts_.nNewLabels;
+    ++nDryRunLabels_;
+    labelId = maxExistingLabelId_ + nDryRunLabels_;
+  } else {
+    return -1; // bad label
+  }
+  labelIds_.insert(labelName, labelId);
+  return labelId;
+}
+
+void BulkInserter::queueAnnotations(int docId,
+                                    const Utf8OffsetIndex& utf8Index,
+                                    const QList<Annotation>& annotations) {
+  auto utf8ToUnicode = getUtf8ToUnicode(utf8Index, annotations);
+  std::size_t utf8Idx{};
+  for (const auto& annotation : annotations) {
+
+    auto startChar = annotation.startChar;
+    if (startChar == Annotation::nullIndex) {
+      startChar = utf8ToUnicode[utf8Idx];
+    }
+    ++utf8Idx;
+
+    auto endChar = annotation.endChar;
+    if (endChar == Annotation::nullIndex) {
+      endChar = utf8ToUnicode[utf8Idx];
+    }
+    ++utf8Idx;
+
+    if (!(utf8Index.isValidUnicodeIndex(startChar) &&
+          utf8Index.isValidUnicodeIndex(endChar))) {
+      ++counts_.nInvalidPositions;
+      continue; // bad annotation
+    }
+    auto labelId = getLabelId(annotation.labelName);
+    if (labelId == -1) {
+      ++counts_.nInvalidLabels;
+      continue; // bad label
+    }
+    if (startChar >= endChar) {
+      // would fail the table's check constraint
+      ++counts_.nEmptySpans;
+      continue;
+    }
+    if (dryRun_) {
+      if (isNewDryRunAnnotation({docId, labelId, startChar, endChar})) {
+        ++counts_.nValidAnnotations;
+        ++nAnnotations_;
+      }
+      continue;
+    }
+    ++counts_.nValidAnnotations;
+    pendingAnnotations_.push_back(
+        {docId, labelId, startChar, endChar,
+         annotation.extraData != "" ? annotation.extraData : QVariant()});
+    if (pendingAnnotations_.size() ==
+        static_cast<std::size_t>(annotationBatchSize_)) {
+      insertAnnotationRows(insertAnnotationsQuery_);
+    }
+  }
+}
+
+bool BulkInserter::isNewDryRunAnnotation(const AnnotationKey& annotation) {
+  if (dryRunAnnotations_.contains(annotation)) {
+    ++counts_.nDuplicateAnnotations;
+    return false;
+  }
+  // new documents and labels have no annotations in the database
+  if (annotation.docId <= maxExistingDocId_ &&
+      annotation.labelId <= maxExistingLabelId_) {
+    selectAnnotationQuery_.bindValue(":docid", annotation.docId);
+    selectAnnotationQuery_.bindValue(":start", annotation.startChar);
+    selectAnnotationQuery_.bindValue(":end", annotation.endChar);
+    selectAnnotationQuery_.bindValue(":labelid", annotation.labelId);
+    selectAnnotationQuery_.exec();
+    auto inDatabase = selectAnnotationQuery_.next();
+    selectAnnotationQuery_.finish();
+    if (inDatabase) {
+      ++counts_.nAnnotationsInDatabase;
+      return false;
+    }
+  }
+  dryRunAnnotations_.insert(annotation);
+  return true;
+}
+
+void BulkInserter::flush() {
+  if (pendingAnnotations_.empty()) {
+    return;
+  }
+  // the last batch is smaller so it needs its own statement
+  QSqlQuery query(QSqlDatabase::database(databaseName_));
+  query.prepare(
+      annotationInsertStatement(static_cast<int>(pendingAnnotations_.size())));
+  insertAnnotationRows(query);
+}
+
+void BulkInserter::insertAnnotationRows(QSqlQuery& query) {
+  int position{};
+  for (const auto& row : pendingAnnotations_) {
+    query.bindValue(position++, row.docId);
+    query.bindValue(position++, row.labelId);
+    query.bindValue(position++, row.startChar);
+    query.bindValue(position++, row.endChar);
+    query.bindValue(position++, row.extraData);
+  }
+  qint64 lastRowid{};
+  if (recordsChanges_) {
+    selectMaxAnnotationRowidQuery_.exec();
+    selectMaxAnnotationRowidQuery_.next();
+    lastRowid = selectMaxAnnotationRowidQuery_.value(0).toLongLong();
+    selectMaxAnnotationRowidQuery_.finish();
+  }
+  // rows that violate a constraint (eg duplicates) are skipped
+  if (query.exec()) {
+    auto nInserted = query.numRowsAffected();
+    nAnnotations_ += nInserted;
+    if (recordsChanges_ && nInserted > 0) {
+      insertChangesQuery_.bindValue(":rowid", lastRowid);
+      insertChangesQuery_.exec();
+    }
+  }
+  pendingAnnotations_.clear();
+}
+
+QString BulkInserter::annotationInsertStatement(int nRows) {
+  QStringList rows{};
+  for (int i = 0; i < nRows; ++i) {
+    rows << "(?, ?, ?, ?, ?)";
+  }
+  return QString("insert or ignore into annotation (doc_id, label_id, "
+                 "start_char, end_char, extra_data) values %0;")
+      .arg(rows.join(", "));
+}
+
+int BulkInserter::nAnnotations() const { return nAnnotations_; }
+
+int BulkInserter::nRows() const { return counts_.nNewDocs + nAnnotations_; }
+
+double BulkInserter::rowsPerSecond() const {
+  auto elapsed = timer_.elapsed();
+  if (elapsed <= 0) {
+    return 0.;
+  }
+  return 1000. * nRows() / static_cast<double>(elapsed);
+}
+
+const InsertionCounts& BulkInserter::counts() const { return counts_; }
+
+void BulkInserter::resetCounts() {
+  counts_ = InsertionCounts{};
+  nAnnotations_ = 0;
+}
+
+constexpr int BulkLoadGuard::bulkCacheSizeKiB_;
+constexpr qint64 BulkLoadGuard::bulkMmapSize_;
+
+BulkLoadGuard::BulkLoadGuard(const QString& databaseName)
+    : databaseName_(databaseName) {
+  QSqlQuery query(QSqlDatabase::database(databaseName_));
+  synchronous_ = getPragma(query, "synchronous");
+  journalMode_ = getPragma(query, "journal_mode");
+  cacheSize_ = getPragma(query, "cache_size");
+  mmapSize_ = getPragma(query, "mmap_size");
+  query.exec("PRAGMA synchronous = OFF;");
+  query.exec("PRAGMA journal_mode = MEMORY;");
+  // a negative cache size is a number of KiB rather than of pages
+  query.exec(QString("PRAGMA cache_size = -%0;").arg(bulkCacheSizeKiB_));
+  query.exec(QString("PRAGMA mmap_size = %0;").arg(bulkMmapSize_));
+  for (const auto& index : secondaryIndexes()) {
+    query.exec(QString("DROP INDEX IF EXISTS %0;").arg(index.name));
+  }
+  // replaces a row of document_change for each inserted annotation; the
+  // inserter records the documents of each batch's inserted rows instead
+  query.exec(QString("DROP TRIGGER IF EXISTS %0;")
+                 .arg(annotationInsertTrigger().name));
+}
+
+BulkLoadGuard::~BulkLoadGuard() {
+  QSqlQuery query(QSqlDatabase::database(databaseName_));
+  // rebuilding the indexes is faster before durability is restored
+  for (const auto& index : secondaryIndexes()) {
+    query.exec(index.createStatement);
+  }
+  query.exec(annotationInsertTrigger().createStatement);
+  query.exec(
+      QString("PRAGMA journal_mode = %0;").arg(journalMode_.toString()));
+  query.exec(
+      QString("PRAGMA synchronous = %0;").arg(synchronous_.toString()));
+  query.exec(QString("PRAGMA cache_size = %0;").arg(cacheSize_.toString()));
+  query.exec(QString("PRAGMA mmap_size = %0;").arg(mmapSize_.toString()));
+}
+
+QVariant BulkLoadGuard::getPragma(QSqlQuery& query, const QString& pragma) {
+  query.exec(QString("PRAGMA %0;").arg(pragma));
+  auto value = query.next() ? query.value(0) : QVariant();
+  query.finish();
+  return value;
+}
+
+} // namespace labelbuddy
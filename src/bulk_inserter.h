@@ -0,0 +1,297 @@
+#ifndef LABELBUDDY_BULK_INSERTER_H
+#define LABELBUDDY_BULK_INSERTER_H
+
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QSqlQuery>
+#include <QString>
+#include <QVariant>
+
+#include "database_impl.h"
+#include "utf8_offset_index.h"
+
+/// \file
+/// Inserting imported documents and annotations in the database.
+
+namespace labelbuddy {
+
+/// What happened to the records given to a `BulkInserter`, by reason
+struct InsertionCounts {
+  /// Documents inserted, or that would be inserted in a dry run
+  int nNewDocs{};
+
+  /// Documents whose content was already in the database
+  int nDocsInDatabase{};
+
+  /// Documents with the same content as an earlier document of the import
+  int nDuplicateDocs{};
+
+  /// Documents with an empty text, which the database rejects
+  int nEmptyDocs{};
+
+  /// Records without text, which only add annotations to a document
+  int nRecordsWithoutText{};
+
+  /// Annotations inserted or queued, or that would be inserted in a dry run
+  int nValidAnnotations{};
+
+  /// Annotations with a position outside of the document's text
+  int nInvalidPositions{};
+
+  /// Annotations whose label cannot be created (eg empty label name)
+  int nInvalidLabels{};
+
+  /// Annotations that do not end after they start
+  int nEmptySpans{};
+
+  /// Annotations of records whose document is not found or was rejected
+  int nAnnotationsWithoutDoc{};
+
+  /// Annotations that are already in the database; only counted in a dry run,
+  /// as an import skips them when inserting
+  int nAnnotationsInDatabase{};
+
+  /// Annotations identical to one given by an earlier record; only counted in
+  /// a dry run, as an import skips them when inserting
+  int nDuplicateAnnotations{};
+
+  int nNewLabels{};
+};
+
+/// Inserts documents and their annotations during an import.
+
+/// All statements are prepared once when the inserter is created and reused
+/// for every document. Label ids are kept in memory so each label is looked up
+/// (and created if necessary) only the first time it is seen. Annotations are
+/// accumulated and inserted `annotationBatchSize_` rows at a time with a
+/// multi-row `INSERT OR IGNORE`, so invalid or duplicate annotations are
+/// skipped without discarding the rest of the batch.
+///
+/// The checksums and ids of the documents already in the database are loaded
+/// in memory when the inserter is created, so documents that are already
+/// present (re-imports, or annotation-only records that reference a document
+/// by its checksum) are resolved without querying SQLite, and duplicate
+/// content is never sent to the database.
+///
+/// The inserter does not manage transactions: the caller opens one before
+/// inserting and calls `flush` before committing it.
+///
+/// In a dry run, records go through the same checks but nothing is written:
+/// new documents, labels and annotations are only recorded in memory, so later
+/// records are checked as if they had been inserted. Annotations that the
+/// database would ignore because they are already present are counted
+/// separately.
+///
+/// If the trigger that records the documents of inserted annotations has been
+/// dropped by a `BulkLoadGuard`, the inserter records the documents of the
+/// rows each batch actually inserted in `document_change` itself, with one
+/// row per document instead of one per annotation.
+class BulkInserter {
+
+public:
+  /// `colorIndex` is the catalog's counter used to pick colors for new labels.
+  BulkInserter(const QString& databaseName, int& colorIndex,
+               bool dryRun = false);
+
+  BulkInserter(const BulkInserter&) = delete;
+  BulkInserter& operator=(const BulkInserter&) = delete;
+
+  /// Insert a document (if it has content) and queue its annotations.
+
+  /// If the document has no content, or if it is already in the database, the
+  /// annotations are attached to the existing document with the same MD5
+  /// checksum, if there is one.
+  void insertDocRecord(const DocRecord& record);
+
+  /// Insert the annotations that are still queued.
+  void flush();
+
+  /// Number of annotations inserted so far (queued ones are not counted)
+  int nAnnotations() const;
+
+  /// Number of documents and annotations inserted so far
+  int nRows() const;
+
+  /// Number of rows inserted per second since the inserter was created
+  double rowsPerSecond() const;
+
+  const InsertionCounts& counts() const;
+
+  /// Count from 0 again, eg for the next file of a dry run.
+
+  /// The documents, labels and annotations seen so far are kept, so the next
+  /// records are still checked as if the earlier ones had been inserted.
+  void resetCounts();
+
+private:
+  /// An MD5 checksum stored as two integers, much smaller in memory than a
+  /// QByteArray when millions of documents are loaded
+  struct Md5Key {
+    quint64 high;
+    quint64 low;
+
+    bool operator==(const Md5Key& other) const {
+      return high == other.high && low == other.low;
+    }
+
+    friend uint qHash(const Md5Key& key, uint seed = 0) {
+      // the checksum bits are already uniformly distributed
+      return static_cast<uint>(key.low) ^ seed;
+    }
+  };
+
+  /// The columns of an annotation's unique constraint
+  struct AnnotationKey {
+    int docId;
+    int labelId;
+    int startChar;
+    int endChar;
+
+    bool operator==(const AnnotationKey& other) const {
+      return docId == other.docId && labelId == other.labelId &&
+             startChar == other.startChar && endChar == other.endChar;
+    }
+
+    friend uint qHash(const AnnotationKey& key, uint seed = 0) {
+      auto hash = static_cast<uint>(key.docId);
+      hash = hash * 31u + static_cast<uint>(key.labelId);
+      hash = hash * 31u + static_cast<uint>(key.startChar);
+      hash = hash * 31u + static_cast<uint>(key.endChar);
+      return hash ^ seed;
+    }
+  };
+
+  struct AnnotationRow {
+    int docId;
+    int labelId;
+    int startChar;
+    int endChar;
+    QVariant extraData;
+  };
+
+  static constexpr int annotationBatchSize_ = 100;
+
+  /// Returns false if `md5` is not a 16-byte checksum
+  static bool toMd5Key(const QByteArray& md5, Md5Key& key);
+
+  void loadDocIds();
+
+  /// Returns -1 if the document is not in the database
+  int findDocId(const QByteArray& md5) const;
+
+  /// Returns the new document's id, or -1 if it could not be inserted.
+
+  /// The document's `utf8Index` is stored with it. In a dry run the id is made
+  /// up, after the ids of the existing documents.
+  int insertDoc(const DocRecord& record, const QByteArray& contentUtf8,
+                const QByteArray& md5, const Utf8OffsetIndex& utf8Index);
+
+  /// The stored UTF-8 index of a document in the database.
+
+  /// Documents imported before the indexes were stored are indexed from their
+  /// text, and the index is stored. In a dry run, the index of a document
+  /// added by an earlier record is the one kept in memory.
+  Utf8OffsetIndex getUtf8Index(int docId);
+
+  /// Returns -1 if the label does not exist and cannot be created.
+
+  /// In a dry run, the ids of labels that would be created are made up, after
+  /// the ids of the existing labels.
+  int getLabelId(const QString& labelName);
+
+  void queueAnnotations(int docId, const Utf8OffsetIndex& utf8Index,
+                        const QList<Annotation>& annotations);
+
+  /// In a dry run, whether an annotation would be inserted.
+
+  /// If it is already in the database or was given by an earlier record, the
+  /// reason is counted and false is returned. Otherwise it is remembered, as
+  /// if it had been inserted.
+  bool isNewDryRunAnnotation(const AnnotationKey& annotation);
+
+  /// Bind all queued rows to `query`, execute it and clear the queue.
+
+  /// If the trigger that records changed documents is missing, the documents
+  /// of the inserted rows are recorded; rows that were ignored (eg because
+  /// they were already in the database) do not change their document.
+  void insertAnnotationRows(QSqlQuery& query);
+
+  static QString annotationInsertStatement(int nRows);
+
+  QString databaseName_;
+  QSqlQuery insertDocQuery_;
+  QSqlQuery insertUtf8IndexQuery_;
+  QSqlQuery selectUtf8IndexQuery_;
+  QSqlQuery insertLabelQuery_;
+  QSqlQuery selectLabelIdQuery_;
+  QSqlQuery insertAnnotationsQuery_;
+  QSqlQuery selectMaxAnnotationRowidQuery_;
+  QSqlQuery insertChangesQuery_;
+  QSqlQuery selectAnnotationQuery_;
+  QHash<Md5Key, int> docIds_{};
+  QHash<QString, int> labelIds_{};
+  std::vector<AnnotationRow> pendingAnnotations_{};
+  /// in a dry run, `Utf8OffsetIndex::toBytes` of the new documents by their
+  /// made-up id, as they are not in the database
+  QHash<int, QByteArray> dryRunUtf8Indexes_{};
+  /// in a dry run, the annotations that would be inserted
+  QSet<AnnotationKey> dryRunAnnotations_{};
+  int& colorIndex_;
+  bool dryRun_;
+  /// whether document content is written and read as UTF-8 blobs
+  bool utf8Database_;
+  bool recordsChanges_{};
+
+  /// documents with a larger id have been inserted by this inserter
+  int maxExistingDocId_{};
+  /// in a dry run, labels with a larger id would be created
+  int maxExistingLabelId_{};
+  /// in a dry run, documents and labels that would be created, over all files
+  int nDryRunDocs_{};
+  int nDryRunLabels_{};
+  int nAnnotations_{};
+  InsertionCounts counts_{};
+  QElapsedTimer timer_{};
+};
+
+/// Tunes a database for a large import until it is destroyed.
+
+/// While the guard exists, the secondary indexes (`secondaryIndexes()`) and
+/// the `annotationInsertTrigger()` are dropped, the page cache and memory map
+/// are enlarged, and durability is relaxed: the journal is kept in memory and
+/// SQLite does not wait for data to reach the disk. The destructor rebuilds
+/// the indexes and the trigger and restores the previous settings, so they
+/// are restored whichever way the import ends.
+///
+/// Must be created and destroyed outside of a transaction, because the
+/// journal mode cannot be changed inside one. If the process crashes while the
+/// guard exists the database may be corrupted, so this is meant for first
+/// loads that can be redone from the input files.
+class BulkLoadGuard {
+
+public:
+  explicit BulkLoadGuard(const QString& databaseName);
+  ~BulkLoadGuard();
+
+  BulkLoadGuard(const BulkLoadGuard&) = delete;
+  BulkLoadGuard& operator=(const BulkLoadGuard&) = delete;
+
+private:
+  static constexpr int bulkCacheSizeKiB_ = 256 * 1024;
+  static constexpr qint64 bulkMmapSize_ = Q_INT64_C(1) << 30;
+
+  static QVariant getPragma(QSqlQuery& query, const QString& pragma);
+
+  QString databaseName_;
+  QVariant synchronous_{};
+  QVariant journalMode_{};
+  QVariant cacheSize_{};
+  QVariant mmapSize_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -1,68 +1,235 @@
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 
 #include <QMap>
 
 #include "char_indices.h"
+#include "simd.h"
 
 namespace labelbuddy {
 
+namespace {
+
+/// First non-ASCII QChar in [pos, end), or `end`
+const ushort* findNonAscii(const ushort* pos, const ushort* end) {
+#ifdef LABELBUDDY_SSE2
+  const auto nonAsciiBits = _mm_set1_epi16(static_cast<short>(0xff80));
+  while (end - pos >= 16) {
+    auto first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    auto second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos + 8));
+    auto nonAscii = _mm_and_si128(_mm_or_si128(first, second), nonAsciiBits);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, _mm_setzero_si128())) !=
+        0xffff) {
+      // the scalar loop below finds the position in this block
+      break;
+    }
+    pos += 16;
+  }
+#endif
+  while (pos != end && *pos < 0x80) {
+    ++pos;
+  }
+  return pos;
+}
+
+/// First surrogate (high or low) QChar in [pos, end), or `end`
+const ushort* findSurrogate(const ushort* pos, const ushort* end) {
+#ifdef LABELBUDDY_SSE2
+  // surrogates are 0xd800 to 0xdfff
+  const auto mask = _mm_set1_epi16(static_cast<short>(0xf800));
+  const auto surrogate = _mm_set1_epi16(static_cast<short>(0xd800));
+  while (end - pos >= 16) {
+    auto first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    auto second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos + 8));
+    auto isSurrogate =
+        _mm_or_si128(_mm_cmpeq_epi16(_mm_and_si128(first, mask), surrogate),
+                     _mm_cmpeq_epi16(_mm_and_si128(second, mask), surrogate));
+    if (_mm_movemask_epi8(isSurrogate) != 0) {
+      break;
+    }
+    pos += 16;
+  }
+#endif
+  while (pos != end && (*pos & 0xf800) != 0xd800) {
+    ++pos;
+  }
+  return pos;
+}
+
+/// Size of the UTF-8 encoding of the code point at `pos`, which is advanced
+/// past it
+int utf8CodePointSize(const ushort*& pos, const ushort* end) {
+  auto unit = *pos++;
+  if (unit < 0x80) {
+    return 1;
+  }
+  if (unit < 0x800) {
+    return 2;
+  }
+  if ((unit & 0xf800) != 0xd800) {
+    return 3;
+  }
+  if ((unit & 0xfc00) == 0xd800 && pos != end && (*pos & 0xfc00) == 0xdc00) {
+    ++pos;
+    return 4;
+  }
+  // unpaired surrogate: QString::toUtf8 replaces it with '?'
+  return 1;
+}
+
+/// Advance `pos` by at most `maxSize` ASCII QChars and return how many
+int skipAscii(const ushort*& pos, const ushort* end, int maxSize) {
+  auto runEnd =
+      findNonAscii(pos, pos + std::min<std::ptrdiff_t>(end - pos, maxSize));
+  auto size = static_cast<int>(runEnd - pos);
+  pos = runEnd;
+  return size;
+}
+
+} // namespace
+
 CharIndices::CharIndices(const QString& text) { setText(text); }
 
+CharIndices::CharIndices(const QString& text, const QByteArray& utf8Text) {
+  setText(text);
+  utf8Text_ = utf8Text;
+}
+
 int CharIndices::unicodeLength() const { return unicodeLength_; }
 
 int CharIndices::qStringLength() const { return qStringLength_; }
 
-int CharIndices::utf8Length() const { return text_.toUtf8().size(); }
+int CharIndices::utf8Length() const {
+  if (isAscii_) {
+    return qStringLength_;
+  }
+  return utf8Text().size();
+}
+
+QByteArray CharIndices::utf8Text() const {
+  if (utf8Text_.isEmpty()) {
+    return text_.toUtf8();
+  }
+  return utf8Text_;
+}
 
 void CharIndices::setText(const QString& newText) {
   text_ = newText;
+  utf8Text_.clear();
   surrogateIndicesInQString_.clear();
   surrogateIndicesInUnicode_.clear();
+  qStringLength_ = text_.size();
 
-  int qIdx{};
-  int uIdx{};
-  for (auto qchar : text_) {
-    if (!qchar.isSurrogate()) {
-      ++qIdx;
-      ++uIdx;
-    } else if (qchar.isHighSurrogate()) {
-      surrogateIndicesInQString_ << qIdx;
-      ++qIdx;
-      surrogateIndicesInUnicode_ << uIdx;
-      ++uIdx;
-    } else {
-      assert(qchar.isLowSurrogate());
-      ++qIdx;
+  // most documents are ASCII or have no surrogate pairs: the text is scanned
+  // in blocks and only the QChars around surrogates are looked at one by one
+  const auto* begin = text_.utf16();
+  const auto* end = begin + qStringLength_;
+  isAscii_ = findNonAscii(begin, end) == end;
+  // an unpaired surrogate counts as 1 char, as QString::toUtf8 encodes it as
+  // '?', so only low surrogates that follow a high one are skipped
+  int nPairs{};
+  const auto* pos = isAscii_ ? end : findSurrogate(begin, end);
+  while (pos != end) {
+    if (QChar::isHighSurrogate(*pos) && pos + 1 != end &&
+        QChar::isLowSurrogate(*(pos + 1))) {
+      auto qIdx = static_cast<int>(pos - begin);
+      surrogateIndicesInQString_.push_back(qIdx);
+      surrogateIndicesInUnicode_.push_back(qIdx - nPairs);
+      ++nPairs;
+      ++pos;
     }
+    pos = findSurrogate(pos + 1, end);
   }
-  unicodeLength_ = uIdx;
-  qStringLength_ = qIdx;
+  unicodeLength_ = qStringLength_ - nPairs;
 }
 
 int CharIndices::unicodeToQString(int unicodeIndex) const {
   assert(isValidUnicodeIndex(unicodeIndex));
 
-  int qStringIndex{unicodeIndex};
-  for (auto surrogatesIt = surrogateIndicesInUnicode_.cbegin();
-       surrogatesIt != surrogateIndicesInUnicode_.cend() &&
-       *surrogatesIt < unicodeIndex;
-       ++surrogatesIt) {
-    ++qStringIndex;
-  }
-  return qStringIndex;
+  // each surrogate pair before the index adds a QChar
+  auto nSurrogatesBefore =
+      std::lower_bound(surrogateIndicesInUnicode_.cbegin(),
+                       surrogateIndicesInUnicode_.cend(), unicodeIndex) -
+      surrogateIndicesInUnicode_.cbegin();
+  return unicodeIndex + static_cast<int>(nSurrogatesBefore);
 }
 
 int CharIndices::qStringToUnicode(int qStringIndex) const {
   assert(isValidQStringIndex(qStringIndex));
 
-  int unicodeIndex{qStringIndex};
-  for (auto surrogatesIt = surrogateIndicesInQString_.cbegin();
-       surrogatesIt != surrogateIndicesInQString_.cend() &&
-       *surrogatesIt < qStringIndex;
-       ++surrogatesIt) {
-    --unicodeIndex;
+  auto nSurrogatesBefore =
+      std::lower_bound(surrogateIndicesInQString_.cbegin(),
+                       surrogateIndicesInQString_.cend(), qStringIndex) -
+      surrogateIndicesInQString_.cbegin();
+  return qStringIndex - static_cast<int>(nSurrogatesBefore);
+}
+
+std::vector<int> CharIndices::unicodeToUtf8Sorted(
+    const std::vector<int>& unicodeIndices) const {
+  assert(std::is_sorted(unicodeIndices.cbegin(), unicodeIndices.cend()));
+  std::vector<int> utf8Indices{};
+  utf8Indices.reserve(unicodeIndices.size());
+  const auto* pos = text_.utf16();
+  const auto* end = pos + qStringLength_;
+  int unicodeIndex{0};
+  int utf8Index{0};
+  for (auto target : unicodeIndices) {
+    if (!isValidUnicodeIndex(target)) {
+      utf8Indices.push_back(-1);
+      continue;
+    }
+    if (isAscii_) {
+      utf8Indices.push_back(target);
+      continue;
+    }
+    while (unicodeIndex < target) {
+      // an ASCII QChar is one Unicode char and one byte
+      auto nAscii = skipAscii(pos, end, target - unicodeIndex);
+      unicodeIndex += nAscii;
+      utf8Index += nAscii;
+      if (unicodeIndex < target) {
+        utf8Index += utf8CodePointSize(pos, end);
+        ++unicodeIndex;
+      }
+    }
+    utf8Indices.push_back(utf8Index);
+  }
+  return utf8Indices;
+}
+
+std::vector<int>
+CharIndices::utf8ToUnicodeSorted(const std::vector<int>& utf8Indices) const {
+  assert(std::is_sorted(utf8Indices.cbegin(), utf8Indices.cend()));
+  std::vector<int> unicodeIndices{};
+  unicodeIndices.reserve(utf8Indices.size());
+  const auto* pos = text_.utf16();
+  const auto* end = pos + qStringLength_;
+  int unicodeIndex{0};
+  int utf8Index{0};
+  for (auto target : utf8Indices) {
+    if (target < 0) {
+      unicodeIndices.push_back(-1);
+      continue;
+    }
+    if (isAscii_) {
+      unicodeIndices.push_back(target <= qStringLength_ ? target : -1);
+      continue;
+    }
+    while (utf8Index < target && pos != end) {
+      auto nAscii = skipAscii(pos, end, target - utf8Index);
+      unicodeIndex += nAscii;
+      utf8Index += nAscii;
+      if (utf8Index < target && pos != end) {
+        utf8Index += utf8CodePointSize(pos, end);
+        ++unicodeIndex;
+      }
+    }
+    // past the target: it was in the middle of a code point's bytes (or
+    // after the end of the text if there are no more QChars)
+    unicodeIndices.push_back(utf8Index == target ? unicodeIndex : -1);
   }
-  return unicodeIndex;
+  return unicodeIndices;
 }
 
 bool CharIndices::isValidUnicodeIndex(int index) const {
@@ -97,7 +264,10 @@ bool CharIndices::isValidUtf8Index(int index, const QByteArray& text) {
 }
 
 bool CharIndices::isValidUtf8Index(int index) const {
-  return isValidUtf8Index(index, text_.toUtf8());
+  if (isAscii_) {
+    return isValidQStringIndex(index);
+  }
+  return isValidUtf8Index(index, utf8Text());
 }
 
 } // namespace labelbuddy
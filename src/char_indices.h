@@ -1,6 +1,8 @@
 #ifndef LABELBUDDY_CHAR_INDICES_H
 #define LABELBUDDY_CHAR_INDICES_H
 
+#include <vector>
+
 #include <QMap>
 #include <QString>
 
@@ -28,6 +30,12 @@ public:
 
   explicit CharIndices(const QString& text);
 
+  /// `utf8Text` is the UTF-8 encoding of `text`, when the caller has it.
+
+  /// Conversions to and from UTF-8 positions then use it instead of encoding
+  /// the text again.
+  CharIndices(const QString& text, const QByteArray& utf8Text);
+
   /// Length of text as string of Unicode chars.
   int unicodeLength() const;
 
@@ -36,15 +44,22 @@ public:
 
   /// Length (in bytes) of UTF-8 encoded text.
 
-  /// More expensive than other lengths because it requires encoding the text.
+  /// More expensive than other lengths because it requires encoding the text,
+  /// unless the UTF-8 was given to the constructor.
   int utf8Length() const;
 
   void setText(const QString& newText);
 
   /// Convert index in Unicode string to index in QString representation.
+
+  /// O(log(number of surrogate pairs)), so it can be called for each of many
+  /// annotations.
   int unicodeToQString(int unicodeIndex) const;
 
   /// Convert index in QString representation to index in Unicode string.
+
+  /// O(log(number of surrogate pairs)), so it can be called for each of many
+  /// annotations.
   int qStringToUnicode(int qStringIndex) const;
 
   /// Convert indices in Unicode string to indices in UTF-8 text.
@@ -107,6 +122,24 @@ public:
   QMap<int, int> qStringToUnicode(InputIterator qStringBegin,
                                   InputIterator qStringEnd) const;
 
+  /// Convert sorted indices in Unicode string to indices in UTF-8 text.
+
+  /// `unicodeIndices` must be in increasing order. The result has one UTF-8
+  /// index for each input index, or -1 for invalid indices. The UTF-8 lengths
+  /// are computed from the QChars in a single pass over the text, skipping
+  /// runs of ASCII in blocks, instead of encoding substrings.
+  std::vector<int>
+  unicodeToUtf8Sorted(const std::vector<int>& unicodeIndices) const;
+
+  /// Convert sorted indices in UTF-8 text to indices in Unicode string.
+
+  /// `utf8Indices` must be in increasing order. The result has one Unicode
+  /// index for each input index, or -1 for invalid indices (out of range or
+  /// in the middle of a multi-byte sequence). Computed in a single pass over
+  /// the text, like `unicodeToUtf8Sorted`.
+  std::vector<int>
+  utf8ToUnicodeSorted(const std::vector<int>& utf8Indices) const;
+
   /// Whether a Unicode char position is valid for this text.
   bool isValidUnicodeIndex(int index) const;
 
@@ -117,15 +150,24 @@ public:
 
   /// Checks if it is within range and not in the middle of a multi-byte
   /// sequence. This operation is somewhat expensive because it requires
-  /// encoding the text (the UTF8-encoded text is not stored).
+  /// encoding the text, unless the UTF-8 was given to the constructor.
   bool isValidUtf8Index(int index) const;
 
 private:
   QString text_{""};
-  QList<int> surrogateIndicesInUnicode_{};
-  QList<int> surrogateIndicesInQString_{};
+  /// empty unless given to the constructor
+  QByteArray utf8Text_{};
+  /// sorted positions of the surrogate pairs, for binary searches
+  std::vector<int> surrogateIndicesInUnicode_{};
+  std::vector<int> surrogateIndicesInQString_{};
   int unicodeLength_{};
   int qStringLength_{};
+  /// when the text is ASCII, positions are the same in QString, Unicode and
+  /// UTF-8 and conversions do not look at the text
+  bool isAscii_{true};
+
+  /// The stored UTF-8 text, or the encoded text if it was not given
+  QByteArray utf8Text() const;
 
   static bool isValidUtf8Index(int index, const QByteArray& text);
 };
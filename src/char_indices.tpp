@@ -39,6 +39,12 @@ QMap<int, int> CharIndices::qStringToUtf8(InputIterator qStringBegin,
     }
     ++qStringBegin;
   }
+  if (isAscii_) {
+    for (auto mapIt = indexMap.begin(); mapIt != indexMap.end(); ++mapIt) {
+      mapIt.value() = mapIt.key();
+    }
+    return indexMap;
+  }
   int subStringStart{0};
   int cumLen{0};
   for (auto mapIt = indexMap.begin(); mapIt != indexMap.end(); ++mapIt) {
@@ -68,7 +74,16 @@ template <typename InputIterator>
 QMap<int, int> CharIndices::utf8ToQString(InputIterator utf8Begin,
                                           InputIterator utf8End) const {
   QMap<int, int> indexMap{};
-  auto encodedText = text_.toUtf8();
+  if (isAscii_) {
+    while (utf8Begin != utf8End) {
+      if (isValidQStringIndex(*utf8Begin)) {
+        indexMap.insert(*utf8Begin, *utf8Begin);
+      }
+      ++utf8Begin;
+    }
+    return indexMap;
+  }
+  auto encodedText = utf8Text();
   while (utf8Begin != utf8End) {
     if (isValidUtf8Index(*utf8Begin, encodedText)) {
       indexMap.insert(*utf8Begin, -1);
@@ -0,0 +1,546 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#ifdef LABELBUDDY_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef LABELBUDDY_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <QFileInfo>
+
+#include "compressed_file.h"
+
+namespace labelbuddy {
+
+Compression compressionFromFileName(const QString& filePath) {
+  auto suffix = QFileInfo(filePath).suffix();
+  if (suffix == "gz") {
+    return Compression::Gzip;
+  }
+  if (suffix == "zst") {
+    return Compression::Zstd;
+  }
+  return Compression::None;
+}
+
+QString stripCompressionSuffix(const QString& filePath) {
+  auto suffix = compressionSuffix(compressionFromFileName(filePath));
+  return filePath.left(filePath.size() - suffix.size());
+}
+
+bool isCompressionSupported(Compression compression) {
+  switch (compression) {
+  case Compression::None:
+    return true;
+  case Compression::Gzip:
+#ifdef LABELBUDDY_WITH_ZLIB
+    return true;
+#else
+    return false;
+#endif
+  case Compression::Zstd:
+#ifdef LABELBUDDY_WITH_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  default:
+    return false;
+  }
+}
+
+QString compressionSuffix(Compression compression) {
+  switch (compression) {
+  case Compression::Gzip:
+    return ".gz";
+  case Compression::Zstd:
+    return ".zst";
+  default:
+    return "";
+  }
+}
+
+/// Streaming compression and decompression with one of the libraries.
+class CompressedFile::Codec {
+public:
+  virtual ~Codec() = default;
+
+  /// Decompress as much as possible of `input` into `output`.
+
+  /// Sets the number of bytes consumed and produced; false on invalid data.
+  virtual bool decompress(const char* input, std::size_t inputSize,
+                          std::size_t& consumed, char* output,
+                          std::size_t outputSize, std::size_t& produced) = 0;
+
+  /// Whether the input ends in the middle of a gzip member or zstd frame
+  virtual bool isInsideFrame() const = 0;
+
+  /// Compress `input` and append the result to `output`.
+
+  /// If `finish` is true, the compressed stream is terminated.
+  virtual bool compress(const char* input, std::size_t inputSize, bool finish,
+                        std::string& output) = 0;
+};
+
+namespace {
+
+constexpr std::size_t codecBufferSize{1 << 16};
+
+#ifdef LABELBUDDY_WITH_ZLIB
+
+class GzipCodec : public CompressedFile::Codec {
+public:
+  explicit GzipCodec(bool compressing) : compressing_{compressing} {
+    std::memset(&stream_, 0, sizeof(stream_));
+    if (compressing_) {
+      // 15 + 16: gzip header rather than zlib
+      valid_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    } else {
+      // 15 + 32: detect gzip or zlib header
+      valid_ = inflateInit2(&stream_, 15 + 32) == Z_OK;
+    }
+  }
+
+  ~GzipCodec() override {
+    if (!valid_) {
+      return;
+    }
+    if (compressing_) {
+      deflateEnd(&stream_);
+    } else {
+      inflateEnd(&stream_);
+    }
+  }
+
+  GzipCodec(const GzipCodec&) = delete;
+  GzipCodec& operator=(const GzipCodec&) = delete;
+
+  bool decompress(const char* input, std::size_t inputSize,
+                  std::size_t& consumed, char* output, std::size_t outputSize,
+                  std::size_t& produced) override {
+    consumed = 0;
+    produced = 0;
+    if (!valid_) {
+      return false;
+    }
+    while (produced < outputSize && (consumed < inputSize || insideFrame_)) {
+      if (!insideFrame_ && consumed < inputSize) {
+        // start of a new member in a multi-member file
+        insideFrame_ = true;
+      }
+      stream_.next_in = reinterpret_cast<Bytef*>(
+          const_cast<char*>(input + consumed));
+      stream_.avail_in = static_cast<uInt>(inputSize - consumed);
+      stream_.next_out = reinterpret_cast<Bytef*>(output + produced);
+      stream_.avail_out = static_cast<uInt>(outputSize - produced);
+      auto status = inflate(&stream_, Z_NO_FLUSH);
+      auto newConsumed = inputSize - stream_.avail_in;
+      auto newProduced = outputSize - stream_.avail_out;
+      auto progressed = newConsumed != consumed || newProduced != produced;
+      consumed = newConsumed;
+      produced = newProduced;
+      if (status == Z_STREAM_END) {
+        insideFrame_ = false;
+        if (inflateReset(&stream_) != Z_OK) {
+          return false;
+        }
+        continue;
+      }
+      if (status == Z_BUF_ERROR || (status == Z_OK && !progressed)) {
+        // needs more input
+        return true;
+      }
+      if (status != Z_OK) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool isInsideFrame() const override { return insideFrame_; }
+
+  bool compress(const char* input, std::size_t inputSize, bool finish,
+                std::string& output) override {
+    if (!valid_) {
+      return false;
+    }
+    stream_.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(input));
+    stream_.avail_in = static_cast<uInt>(inputSize);
+    char buffer[codecBufferSize];
+    while (true) {
+      stream_.next_out = reinterpret_cast<Bytef*>(buffer);
+      stream_.avail_out = static_cast<uInt>(codecBufferSize);
+      auto status = deflate(&stream_, finish ? Z_FINISH : Z_NO_FLUSH);
+      if (status == Z_STREAM_ERROR) {
+        return false;
+      }
+      output.append(buffer, codecBufferSize - stream_.avail_out);
+      if (finish ? status == Z_STREAM_END
+                 : (stream_.avail_in == 0 && stream_.avail_out != 0)) {
+        return true;
+      }
+    }
+  }
+
+private:
+  z_stream stream_;
+  bool compressing_;
+  bool valid_{};
+  bool insideFrame_{};
+};
+
+#endif
+
+#ifdef LABELBUDDY_WITH_ZSTD
+
+class ZstdCodec : public CompressedFile::Codec {
+public:
+  explicit ZstdCodec(bool compressing) {
+    if (compressing) {
+      cStream_ = ZSTD_createCStream();
+      valid_ = cStream_ != nullptr &&
+               !ZSTD_isError(ZSTD_initCStream(cStream_, 3));
+    } else {
+      dStream_ = ZSTD_createDStream();
+      valid_ = dStream_ != nullptr && !ZSTD_isError(ZSTD_initDStream(dStream_));
+    }
+  }
+
+  ~ZstdCodec() override {
+    ZSTD_freeCStream(cStream_);
+    ZSTD_freeDStream(dStream_);
+  }
+
+  ZstdCodec(const ZstdCodec&) = delete;
+  ZstdCodec& operator=(const ZstdCodec&) = delete;
+
+  bool decompress(const char* input, std::size_t inputSize,
+                  std::size_t& consumed, char* output, std::size_t outputSize,
+                  std::size_t& produced) override {
+    consumed = 0;
+    produced = 0;
+    if (!valid_) {
+      return false;
+    }
+    ZSTD_inBuffer in{input, inputSize, 0};
+    ZSTD_outBuffer out{output, outputSize, 0};
+    while (out.pos < out.size && (in.pos < in.size || insideFrame_)) {
+      auto previousIn = in.pos;
+      auto previousOut = out.pos;
+      auto status = ZSTD_decompressStream(dStream_, &in, &out);
+      if (ZSTD_isError(status)) {
+        return false;
+      }
+      // 0 means that a frame is complete and entirely flushed
+      insideFrame_ = status != 0;
+      if (in.pos == previousIn && out.pos == previousOut) {
+        break;
+      }
+    }
+    consumed = in.pos;
+    produced = out.pos;
+    return true;
+  }
+
+  bool isInsideFrame() const override { return insideFrame_; }
+
+  bool compress(const char* input, std::size_t inputSize, bool finish,
+                std::string& output) override {
+    if (!valid_) {
+      return false;
+    }
+    char buffer[codecBufferSize];
+    ZSTD_inBuffer in{input, inputSize, 0};
+    while (in.pos < in.size) {
+      ZSTD_outBuffer out{buffer, codecBufferSize, 0};
+      if (ZSTD_isError(ZSTD_compressStream(cStream_, &out, &in))) {
+        return false;
+      }
+      output.append(buffer, out.pos);
+    }
+    if (!finish) {
+      return true;
+    }
+    while (true) {
+      ZSTD_outBuffer out{buffer, codecBufferSize, 0};
+      auto remaining = ZSTD_endStream(cStream_, &out);
+      if (ZSTD_isError(remaining)) {
+        return false;
+      }
+      output.append(buffer, out.pos);
+      if (remaining == 0) {
+        return true;
+      }
+    }
+  }
+
+private:
+  ZSTD_CStream* cStream_{};
+  ZSTD_DStream* dStream_{};
+  bool valid_{};
+  bool insideFrame_{};
+};
+
+#endif
+
+std::unique_ptr<CompressedFile::Codec> makeCodec(Compression compression,
+                                                 bool compressing) {
+  std::unique_ptr<CompressedFile::Codec> codec{};
+  switch (compression) {
+#ifdef LABELBUDDY_WITH_ZLIB
+  case Compression::Gzip:
+    codec.reset(new GzipCodec(compressing));
+    break;
+#endif
+#ifdef LABELBUDDY_WITH_ZSTD
+  case Compression::Zstd:
+    codec.reset(new ZstdCodec(compressing));
+    break;
+#endif
+  default:
+    Q_UNUSED(compressing);
+    break;
+  }
+  return codec;
+}
+
+} // namespace
+
+constexpr int CompressedFile::chunkSize_;
+
+CompressedFile::CompressedFile(const QString& filePath,
+                               Compression compression)
+    : file_(filePath), compression_{compression} {}
+
+CompressedFile::~CompressedFile() { close(); }
+
+bool CompressedFile::open(OpenMode mode) {
+  auto writing = (mode & QIODevice::WriteOnly) != 0;
+  if ((mode & QIODevice::ReadOnly) && writing) {
+    setErrorString("Compressed files cannot be opened for reading and "
+                   "writing.");
+    return false;
+  }
+  if (!isCompressionSupported(compression_)) {
+    setErrorString(
+        QString("This version of labelbuddy was built without support for "
+                "'%0' files.")
+            .arg(compressionSuffix(compression_)));
+    return false;
+  }
+  if (!file_.open(writing ? QIODevice::WriteOnly : QIODevice::ReadOnly)) {
+    setErrorString(file_.errorString());
+    return false;
+  }
+  codec_ = makeCodec(compression_, writing);
+  failed_ = false;
+  // the decompressed data is buffered here rather than by QIODevice, so that
+  // positions in the uncompressed stream are easy to track
+  return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void CompressedFile::close() {
+  if (!isOpen()) {
+    return;
+  }
+  // close cannot return an error, so a stream that could not be finished or
+  // flushed to the file is reported by `hasError`
+  auto writing = isWritable();
+  auto finished = !writing || writeCompressed(nullptr, 0, true);
+  auto errorMessage = errorString();
+  QIODevice::close();
+  file_.close();
+  if (writing && finished && file_.error() != QFileDevice::NoError) {
+    finished = false;
+    errorMessage = file_.errorString();
+  }
+  codec_.reset();
+  input_.clear();
+  inputPos_ = 0;
+  output_.clear();
+  outputPos_ = 0;
+  outputStart_ = 0;
+  streamEnded_ = false;
+  failed_ = !finished;
+  if (failed_) {
+    setErrorString(errorMessage);
+  }
+}
+
+bool CompressedFile::isSequential() const { return !isReadable(); }
+
+bool CompressedFile::seek(qint64 pos) {
+  if (!isReadable() || pos < 0) {
+    return false;
+  }
+  if (pos < outputStart_ && !rewind()) {
+    return false;
+  }
+  while (pos > outputStart_ + output_.size()) {
+    outputPos_ = output_.size();
+    if (!fillOutput()) {
+      return false;
+    }
+  }
+  outputPos_ = static_cast<int>(pos - outputStart_);
+  return QIODevice::seek(pos);
+}
+
+bool CompressedFile::atEnd() const {
+  if (!isReadable()) {
+    return true;
+  }
+  if (outputPos_ != output_.size()) {
+    return false;
+  }
+  // decompressing the next chunk does not change the (logical) position
+  return !const_cast<CompressedFile*>(this)->fillOutput();
+}
+
+qint64 CompressedFile::bytesAvailable() const {
+  return (output_.size() - outputPos_) + QIODevice::bytesAvailable();
+}
+
+qint64 CompressedFile::compressedPos() const {
+  return file_.pos() - (input_.size() - inputPos_);
+}
+
+bool CompressedFile::hasError() const { return failed_; }
+
+bool CompressedFile::fillOutput() {
+  if (outputPos_ != output_.size()) {
+    return true;
+  }
+  if (streamEnded_ || failed_) {
+    return false;
+  }
+  outputStart_ += output_.size();
+  output_.resize(chunkSize_);
+  outputPos_ = 0;
+  std::size_t produced{};
+  while (produced == 0) {
+    if (inputPos_ == input_.size()) {
+      input_ = file_.read(chunkSize_);
+      inputPos_ = 0;
+      if (input_.isEmpty() && !file_.atEnd()) {
+        failed_ = true;
+        setErrorString(file_.errorString());
+        break;
+      }
+    }
+    std::size_t consumed{};
+    if (!codec_->decompress(input_.constData() + inputPos_,
+                            static_cast<std::size_t>(input_.size() - inputPos_),
+                            consumed, output_.data(),
+                            static_cast<std::size_t>(output_.size()),
+                            produced)) {
+      failed_ = true;
+      setErrorString("Invalid compressed data.");
+      break;
+    }
+    if (produced == 0 && consumed == 0 && inputPos_ != input_.size()) {
+      // the codec cannot make progress with this input
+      failed_ = true;
+      setErrorString("Invalid compressed data.");
+      break;
+    }
+    inputPos_ += static_cast<int>(consumed);
+    if (produced == 0 && inputPos_ == input_.size() && file_.atEnd()) {
+      if (codec_->isInsideFrame()) {
+        failed_ = true;
+        setErrorString("Unexpected end of compressed data.");
+      }
+      streamEnded_ = true;
+      break;
+    }
+  }
+  output_.resize(static_cast<int>(produced));
+  return produced != 0;
+}
+
+bool CompressedFile::rewind() {
+  if (!file_.seek(0)) {
+    return false;
+  }
+  codec_ = makeCodec(compression_, false);
+  input_.clear();
+  inputPos_ = 0;
+  output_.clear();
+  outputPos_ = 0;
+  outputStart_ = 0;
+  streamEnded_ = false;
+  failed_ = false;
+  return true;
+}
+
+qint64 CompressedFile::readData(char* data, qint64 maxSize) {
+  qint64 nRead{};
+  while (nRead < maxSize && fillOutput()) {
+    auto n = std::min(maxSize - nRead,
+                      static_cast<qint64>(output_.size() - outputPos_));
+    std::memcpy(data + nRead, output_.constData() + outputPos_,
+                static_cast<std::size_t>(n));
+    outputPos_ += static_cast<int>(n);
+    nRead += n;
+  }
+  if (nRead == 0 && failed_) {
+    return -1;
+  }
+  return nRead;
+}
+
+qint64 CompressedFile::readLineData(char* data, qint64 maxSize) {
+  qint64 nRead{};
+  while (nRead < maxSize && fillOutput()) {
+    auto available = std::min(
+        maxSize - nRead, static_cast<qint64>(output_.size() - outputPos_));
+    auto start = output_.constData() + outputPos_;
+    auto newline = static_cast<const char*>(
+        std::memchr(start, '\n', static_cast<std::size_t>(available)));
+    auto n = newline == nullptr ? available : newline - start + 1;
+    std::memcpy(data + nRead, start, static_cast<std::size_t>(n));
+    outputPos_ += static_cast<int>(n);
+    nRead += n;
+    if (newline != nullptr) {
+      break;
+    }
+  }
+  if (nRead == 0 && failed_) {
+    return -1;
+  }
+  return nRead;
+}
+
+qint64 CompressedFile::writeData(const char* data, qint64 maxSize) {
+  if (!writeCompressed(data, maxSize, false)) {
+    return -1;
+  }
+  return maxSize;
+}
+
+bool CompressedFile::writeCompressed(const char* data, qint64 size,
+                                     bool finish) {
+  if (codec_ == nullptr) {
+    return false;
+  }
+  std::string compressed{};
+  if (!codec_->compress(data, static_cast<std::size_t>(size), finish,
+                        compressed)) {
+    setErrorString("Compression failed.");
+    return false;
+  }
+  if (file_.write(compressed.data(), static_cast<qint64>(compressed.size())) !=
+      static_cast<qint64>(compressed.size())) {
+    setErrorString(file_.errorString());
+    return false;
+  }
+  return true;
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,103 @@
+#ifndef LABELBUDDY_COMPRESSED_FILE_H
+#define LABELBUDDY_COMPRESSED_FILE_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QString>
+
+/// \file
+/// Reading and writing gzip and zstd compressed files as streams.
+
+namespace labelbuddy {
+
+enum class Compression { None, Gzip, Zstd };
+
+/// Compression format indicated by the file name (".gz" or ".zst" suffix)
+Compression compressionFromFileName(const QString& filePath);
+
+/// Remove the ".gz" or ".zst" suffix, if any.
+
+/// Used to find the format of the content, eg "docs.jsonl.gz" -> "docs.jsonl"
+QString stripCompressionSuffix(const QString& filePath);
+
+/// Whether labelbuddy was built with the library needed for `compression`
+bool isCompressionSupported(Compression compression);
+
+/// Suffix of the compressed files, eg ".gz", or an empty string
+QString compressionSuffix(Compression compression);
+
+/// A gzip or zstd compressed file seen as the uncompressed data.
+
+/// Data is decompressed (or compressed) in small chunks as it is read (or
+/// written), so memory usage does not depend on the size of the file and no
+/// temporary file is needed.
+///
+/// Files can be opened for reading or for writing, not both. When reading,
+/// `pos` is the position in the uncompressed data and `seek` is supported:
+/// seeking forward decompresses and discards the data in between, seeking
+/// backward starts again from the beginning of the file. Concatenated gzip
+/// members and zstd frames are read as one stream.
+///
+/// When writing, the compressed stream is finished by `close` (also called by
+/// the destructor). If it cannot be finished or written to the file, `close`
+/// leaves `hasError` set.
+class CompressedFile : public QIODevice {
+
+public:
+  CompressedFile(const QString& filePath, Compression compression);
+  ~CompressedFile() override;
+
+  bool open(OpenMode mode) override;
+  void close() override;
+  bool isSequential() const override;
+  bool seek(qint64 pos) override;
+  bool atEnd() const override;
+  qint64 bytesAvailable() const override;
+
+  /// Position in the compressed file, eg to report progress
+  qint64 compressedPos() const;
+
+  /// Whether the data could not be read or decompressed, or after `close`
+  /// whether the written data could not be compressed and written.
+
+  /// When reading fails the file looks like it ends early. In both cases
+  /// `errorString` gives the reason.
+  bool hasError() const;
+
+  class Codec;
+
+protected:
+  qint64 readData(char* data, qint64 maxSize) override;
+  qint64 readLineData(char* data, qint64 maxSize) override;
+  qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+  static constexpr int chunkSize_{1 << 16};
+
+  /// Decompress the next chunk into `output_`; false at the end or on error
+  bool fillOutput();
+
+  /// Start decompressing again from the beginning of the file
+  bool rewind();
+
+  bool writeCompressed(const char* data, qint64 size, bool finish);
+
+  QFile file_;
+  Compression compression_;
+  std::unique_ptr<Codec> codec_;
+  QByteArray input_{};
+  int inputPos_{};
+  QByteArray output_{};
+  int outputPos_{};
+  /// position of `output_` in the uncompressed data
+  qint64 outputStart_{};
+  bool streamEnded_{};
+  bool failed_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -1,43 +1,97 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include <QByteArray>
 #include <QCryptographicHash>
+#include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QIODevice>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
 #include <QSettings>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QStandardPaths>
 #include <QString>
+#include <QTextCodec>
+#include <QTextStream>
 
+#include "bulk_inserter.h"
+#include "compressed_file.h"
 #include "database.h"
 #include "database_impl.h"
+#include "doc_record_parser.h"
+#include "json_writer.h"
+#include "ordered_task_queue.h"
+#include "parallel_docs_reader.h"
+#include "progress_reporter.h"
+#include "utf8.h"
 #include "utils.h"
 
 namespace labelbuddy {
 
-// about encoding: when reading .txt we assume utf-8 (but qt will detect and
+// about encoding: when reading .txt we assume utf-8 (but we detect and
 // switch to utf-16 or utf-32 if there is a BOM). when reading or writing json
 // (or jsonl) we use utf-8 (json is always utf-8 when exchanged between systems,
 // https://tools.ietf.org/html/rfc8259#page-9)
 
 constexpr int Annotation::nullIndex;
 
-DocsReader::DocsReader(const QString& filePath) : file_(filePath) {
-  if (file_.open(QIODevice::ReadOnly | QIODevice::Text)) {
-    fileSize_ = static_cast<double>(file_.size());
+std::unique_ptr<QIODevice> makeDocsFile(const QString& filePath) {
+  auto compression = compressionFromFileName(filePath);
+  if (compression == Compression::None) {
+    return std::unique_ptr<QIODevice>(new QFile(filePath));
+  }
+  return std::unique_ptr<QIODevice>(new CompressedFile(filePath, compression));
+}
+
+bool isStandardStream(const QString& filePath) { return filePath == "-"; }
+
+bool openDocsFile(QIODevice& file, const QString& filePath,
+                  QIODevice::OpenMode mode) {
+  if (!isStandardStream(filePath)) {
+    return file.open(mode);
+  }
+  // "-" has no compression suffix so `makeDocsFile` returned a QFile
+  return static_cast<QFile&>(file).open(
+      mode.testFlag(QIODevice::WriteOnly) ? stdout : stdin, mode);
+}
+
+DocsReader::DocsReader(const QString& filePath)
+    : file_(makeDocsFile(filePath)) {
+  // not opened in text mode, which would remove the "\r" of "\r\n" from the
+  // data read but not from the position in the file; readers handle "\r\n"
+  if (openDocsFile(*file_, filePath, QIODevice::ReadOnly)) {
+    // progress is measured in the file on disk, which may be compressed.
+    // sequential devices (eg the standard input from a pipe) have no size,
+    // and their progress is unknown
+    if (!file_->isSequential()) {
+      fileSize_ = static_cast<double>(isStandardStream(filePath)
+                                          ? file_->size()
+                                          : QFileInfo(filePath).size());
+    }
+  } else if (compressionFromFileName(filePath) != Compression::None) {
+    setError(ErrorCode::FileSystemError,
+             QString("Could not open file: %0").arg(file_->errorString()));
   } else {
     setError(ErrorCode::FileSystemError, "Could not open file.");
   }
 }
 
-bool DocsReader::isOpen() const { return file_.isOpen(); }
+bool DocsReader::isOpen() const { return file_->isOpen(); }
 
 bool DocsReader::hasError() const { return errorCode_ != ErrorCode::NoError; }
 
@@ -45,40 +99,271 @@ ErrorCode DocsReader::errorCode() const { return errorCode_; }
 
 QString DocsReader::errorMessage() const { return errorMessage_; }
 
-int DocsReader::progressMax() const { return progressRangeMax_; }
+int DocsReader::progressMax() const {
+  // the size of the standard input (or of a pipe) is unknown
+  return fileSize_ > 0. ? progressRangeMax_ : 0;
+}
 
 int DocsReader::currentProgress() const {
-  return castProgressToRange(static_cast<double>(file_.pos()), fileSize_,
-                             progressRangeMax_);
+  if (fileSize_ <= 0.) {
+    return 0;
+  }
+  auto compressedFile = dynamic_cast<const CompressedFile*>(file_.get());
+  auto filePos = compressedFile != nullptr ? compressedFile->compressedPos()
+                                           : file_->pos();
+  // the file may have grown since it was opened
+  return castProgressToRange(std::min(static_cast<double>(filePos), fileSize_),
+                             fileSize_, progressRangeMax_);
 }
 
 const DocRecord* DocsReader::getCurrentRecord() const {
   return currentRecord_.get();
 }
 
-QFile* DocsReader::getFile() { return &file_; }
+std::unique_ptr<DocRecord> DocsReader::takeCurrentRecord() {
+  return std::move(currentRecord_);
+}
+
+bool DocsReader::readNext() {
+  QByteArray rawDoc{};
+  while (!hasError() && readRaw(rawDoc)) {
+    auto record = parseRaw(rawDoc);
+    if (record != nullptr) {
+      setCurrentRecord(std::move(record));
+      return true;
+    }
+    if (!skipInvalid_) {
+      setError(ErrorCode::CriticalParsingError, parseErrorMessage());
+      return false;
+    }
+    addRejectedDoc(rawDoc);
+  }
+  return false;
+}
+
+bool DocsReader::canReadRaw() const { return false; }
+
+bool DocsReader::readRaw(QByteArray& rawDoc) {
+  Q_UNUSED(rawDoc);
+  assert(false);
+  return false;
+}
+
+std::unique_ptr<DocRecord>
+DocsReader::parseRaw(const QByteArray& rawDoc) const {
+  Q_UNUSED(rawDoc);
+  assert(false);
+  return nullptr;
+}
+
+QString DocsReader::parseErrorMessage() const {
+  return "Could not parse document.";
+}
+
+void DocsReader::setSkipInvalid(bool skipInvalid) {
+  skipInvalid_ = skipInvalid;
+}
+
+bool DocsReader::isSkippingInvalid() const { return skipInvalid_; }
+
+QList<QByteArray> DocsReader::takeRejectedDocs() {
+  QList<QByteArray> rejected{};
+  rejected.swap(rejectedDocs_);
+  return rejected;
+}
+
+void DocsReader::addRejectedDoc(const QByteArray& rawDoc) {
+  rejectedDocs_ << rawDoc;
+}
+
+qint64 DocsReader::position() const { return file_->pos(); }
+
+bool DocsReader::seek(qint64 position) { return file_->seek(position); }
+
+QIODevice* DocsReader::getFile() { return file_.get(); }
+
+const QIODevice* DocsReader::getFile() const { return file_.get(); }
 
 void DocsReader::setCurrentRecord(std::unique_ptr<DocRecord> newRecord) {
   currentRecord_ = std::move(newRecord);
 }
 
+DocRecord& DocsReader::reuseCurrentRecord() {
+  if (currentRecord_ == nullptr) {
+    currentRecord_.reset(new DocRecord);
+  } else {
+    auto content = std::move(currentRecord_->content);
+    auto contentUtf8 = std::move(currentRecord_->contentUtf8);
+    *currentRecord_ = DocRecord{};
+    currentRecord_->content = std::move(content);
+    currentRecord_->contentUtf8 = std::move(contentUtf8);
+  }
+  return *currentRecord_;
+}
+
 void DocsReader::setError(ErrorCode code, const QString& message) {
+  // the first error is the cause of the following ones
+  if (hasError()) {
+    return;
+  }
   errorCode_ = code;
   errorMessage_ = message;
 }
 
-TxtDocsReader::TxtDocsReader(const QString& filePath)
-    : DocsReader(filePath), stream_(getFile()) {
-  stream_.setCodec("UTF-8");
+bool DocsReader::checkReadError() {
+  auto compressedFile = dynamic_cast<const CompressedFile*>(file_.get());
+  if (compressedFile == nullptr || !compressedFile->hasError()) {
+    return false;
+  }
+  setError(ErrorCode::FileSystemError,
+           QString("Could not read file: %0").arg(file_->errorString()));
+  return true;
+}
+
+constexpr int TxtDocsReader::chunkSize_;
+
+namespace {
+
+/// A byte order mark and the encoding it identifies
+struct ByteOrderMark {
+  const char* bytes;
+  int size;
+  /// nullptr for UTF-8
+  const char* codecName;
+  int codeUnitSize;
+  bool isBigEndian;
+};
+
+// the UTF-32 LE BOM starts with the UTF-16 LE one so it is checked first
+const ByteOrderMark byteOrderMarks[] = {
+    {"\xff\xfe\x00\x00", 4, "UTF-32LE", 4, false},
+    {"\x00\x00\xfe\xff", 4, "UTF-32BE", 4, true},
+    {"\xff\xfe", 2, "UTF-16LE", 2, false},
+    {"\xfe\xff", 2, "UTF-16BE", 2, true},
+    {"\xef\xbb\xbf", 3, nullptr, 1, false}};
+
+/// An ASCII character as a UTF-16 or UTF-32 code unit
+QByteArray encodeAscii(char c, int codeUnitSize, bool isBigEndian) {
+  QByteArray unit(codeUnitSize, '\0');
+  unit[isBigEndian ? codeUnitSize - 1 : 0] = c;
+  return unit;
+}
+
+} // namespace
+
+TxtDocsReader::TxtDocsReader(const QString& filePath) : DocsReader(filePath) {
+  if (!isOpen()) {
+    return;
+  }
+  // the standard input can return fewer bytes than requested
+  while (buffer_.size() < 4 && fillBuffer()) {
+  }
+  for (const auto& bom : byteOrderMarks) {
+    if (!buffer_.startsWith(QByteArray::fromRawData(bom.bytes, bom.size))) {
+      continue;
+    }
+    bufferPos_ = bom.size;
+    if (bom.codecName != nullptr) {
+      codec_ = QTextCodec::codecForName(bom.codecName);
+      newline_ = encodeAscii('\n', bom.codeUnitSize, bom.isBigEndian);
+      carriageReturn_ = encodeAscii('\r', bom.codeUnitSize, bom.isBigEndian);
+    }
+    return;
+  }
+}
+
+bool TxtDocsReader::fillBuffer() {
+  auto chunk = getFile()->read(chunkSize_);
+  if (chunk.isEmpty()) {
+    checkReadError();
+    return false;
+  }
+  buffer_.remove(0, bufferPos_);
+  bufferPos_ = 0;
+  buffer_.append(chunk);
+  return true;
+}
+
+int TxtDocsReader::findNewline(int from) const {
+  if (newline_.size() == 1) {
+    auto start = buffer_.constData();
+    auto newline = static_cast<const char*>(std::memchr(
+        start + from, '\n', static_cast<std::size_t>(buffer_.size() - from)));
+    return newline == nullptr ? -1 : static_cast<int>(newline - start);
+  }
+  // the code units start at `bufferPos_`; other matches are parts of
+  // different characters
+  auto newline = buffer_.indexOf(newline_, from);
+  while (newline != -1 && (newline - bufferPos_) % newline_.size() != 0) {
+    newline = buffer_.indexOf(newline_, newline + 1);
+  }
+  return newline;
 }
 
 bool TxtDocsReader::readNext() {
-  if (!isOpen() || stream_.atEnd()) {
+  if (!isOpen()) {
+    return false;
+  }
+  auto codeUnitSize = newline_.size();
+  // size of the line, without its newline, from `bufferPos_`
+  int lineSize{};
+  bool foundNewline{};
+  int nScanned{};
+  while (true) {
+    auto newline = findNewline(bufferPos_ + nScanned);
+    if (newline != -1) {
+      lineSize = newline - bufferPos_;
+      foundNewline = true;
+      break;
+    }
+    auto nAvailable = buffer_.size() - bufferPos_;
+    // a newline can start in the last code unit, which may be incomplete
+    nScanned = nAvailable - nAvailable % codeUnitSize;
+    if (!fillBuffer()) {
+      lineSize = nAvailable;
+      break;
+    }
+  }
+  if (!foundNewline && lineSize == 0) {
     return false;
   }
-  std::unique_ptr<DocRecord> newRecord(new DocRecord);
-  newRecord->content = stream_.readLine();
-  setCurrentRecord(std::move(newRecord));
+  auto line = buffer_.constData() + bufferPos_;
+  bufferPos_ += foundNewline ? lineSize + codeUnitSize : lineSize;
+  if (lineSize >= codeUnitSize &&
+      std::memcmp(line + lineSize - codeUnitSize, carriageReturn_.constData(),
+                  static_cast<std::size_t>(codeUnitSize)) == 0) {
+    lineSize -= codeUnitSize;
+  }
+  auto& record = reuseCurrentRecord();
+  if (codec_ != nullptr) {
+    // the BOM has been skipped, a U+FEFF at the start of a line is content
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    record.content = codec_->toUnicode(line, lineSize, &state);
+    record.contentUtf8.clear();
+    return true;
+  }
+  if (decodeUtf8(line, lineSize, record.content)) {
+    // the line is valid UTF-8 so it is the encoded content
+    record.contentUtf8.resize(lineSize);
+    std::memcpy(record.contentUtf8.data(), line,
+                static_cast<std::size_t>(lineSize));
+  } else {
+    record.content = QString::fromUtf8(line, lineSize);
+    record.contentUtf8.clear();
+  }
+  return true;
+}
+
+qint64 TxtDocsReader::position() const {
+  return getFile()->pos() - (buffer_.size() - bufferPos_);
+}
+
+bool TxtDocsReader::seek(qint64 position) {
+  if (!isOpen() || !getFile()->seek(position)) {
+    return false;
+  }
+  buffer_.clear();
+  bufferPos_ = 0;
   return true;
 }
 
@@ -116,82 +401,381 @@ std::unique_ptr<DocRecord> jsonToDocRecord(const QJsonObject& json) {
   return record;
 }
 
+std::unique_ptr<DocRecord> parseJsonDocRecord(const QByteArray& json) {
+  std::unique_ptr<DocRecord> record(new DocRecord);
+  if (parseDocRecordFast(json.constData(), json.size(), *record)) {
+    return record;
+  }
+  auto jsonDoc = QJsonDocument::fromJson(json);
+  if (!jsonDoc.isObject()) {
+    return nullptr;
+  }
+  return jsonToDocRecord(jsonDoc);
+}
+
+constexpr int JsonDocsReader::chunkSize_;
+
 JsonDocsReader::JsonDocsReader(const QString& filePath) : DocsReader(filePath) {
   if (hasError()) {
     return;
   }
-  auto jsonDoc = QJsonDocument::fromJson(getFile()->readAll());
-  if (!jsonDoc.isArray()) {
-    totalNDocs_ = 0;
+  // the JSON parser accepts a UTF-8 BOM at the start of the file
+  if (fillBuffer() && buffer_.startsWith("\xef\xbb\xbf")) {
+    bufferPos_ = 3;
+  }
+  if (!skipWhitespace() || buffer_.at(bufferPos_) != '[') {
     setError(
         ErrorCode::CriticalParsingError,
         "File does not contain a JSON array.\n(Note: if file is in JSONLines "
         "format, please use the filename extension '.jsonl' rather than "
         "'.json')");
-  } else {
-    allDocs_ = jsonDoc.array();
-    totalNDocs_ = allDocs_.size();
-    currentDoc_ = allDocs_.constBegin();
+    return;
   }
+  ++bufferPos_;
 }
 
-bool JsonDocsReader::readNext() {
-  if (totalNDocs_ == 0 || currentDoc_ == allDocs_.constEnd()) {
+bool JsonDocsReader::fillBuffer() {
+  auto chunk = getFile()->read(chunkSize_);
+  if (chunk.isEmpty()) {
+    checkReadError();
     return false;
   }
-  setCurrentRecord(jsonToDocRecord(*currentDoc_));
-  ++currentDoc_;
-  ++nSeen_;
+  buffer_.append(chunk);
   return true;
 }
 
-int JsonDocsReader::progressMax() const { return totalNDocs_; }
+bool JsonDocsReader::skipWhitespace() {
+  while (true) {
+    while (bufferPos_ < buffer_.size()) {
+      auto c = buffer_.at(bufferPos_);
+      if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+        return true;
+      }
+      ++bufferPos_;
+    }
+    if (!fillBuffer()) {
+      return false;
+    }
+  }
+}
+
+bool JsonDocsReader::findElementEnd(int& elementEnd) {
+  auto first = buffer_.at(bufferPos_);
+  bool isCompound = (first == '{' || first == '[');
+  bool inString = (first == '"');
+  bool isString = inString;
+  bool escaped{};
+  int depth{};
+  int pos = isString ? bufferPos_ + 1 : bufferPos_;
+  while (true) {
+    for (; pos < buffer_.size(); ++pos) {
+      auto c = buffer_.at(pos);
+      if (inString) {
+        if (escaped) {
+          escaped = false;
+        } else if (c == '\\') {
+          escaped = true;
+        } else if (c == '"') {
+          inString = false;
+          if (isString) {
+            elementEnd = pos + 1;
+            return true;
+          }
+        }
+        continue;
+      }
+      switch (c) {
+      case '"':
+        inString = true;
+        break;
+      case '{':
+      case '[':
+        ++depth;
+        break;
+      case '}':
+      case ']':
+        if (!isCompound) {
+          elementEnd = pos;
+          return true;
+        }
+        --depth;
+        if (depth == 0) {
+          elementEnd = pos + 1;
+          return true;
+        }
+        break;
+      case ',':
+      case ' ':
+      case '\n':
+      case '\r':
+      case '\t':
+        if (!isCompound) {
+          elementEnd = pos;
+          return true;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    if (!fillBuffer()) {
+      // a number or literal can be cut by the end of the file, the missing
+      // ']' is then reported by the next call to readRaw
+      if (!isCompound && !isString) {
+        elementEnd = pos;
+        return true;
+      }
+      return false;
+    }
+  }
+}
 
-int JsonDocsReader::currentProgress() const { return nSeen_; }
+bool JsonDocsReader::canReadRaw() const { return true; }
+
+bool JsonDocsReader::readRaw(QByteArray& rawDoc) {
+  if (hasError() || atEnd_) {
+    return false;
+  }
+  if (bufferPos_ > chunkSize_) {
+    buffer_.remove(0, bufferPos_);
+    bufferPos_ = 0;
+  }
+  if (!skipWhitespace()) {
+    setError(ErrorCode::CriticalParsingError,
+             "JSON error: unexpected end of file.");
+    return false;
+  }
+  auto c = buffer_.at(bufferPos_);
+  if (nDocs_ != 0) {
+    if (c != ',' && c != ']') {
+      setError(ErrorCode::CriticalParsingError,
+               "JSON error: expected ',' or ']' after array element.");
+      return false;
+    }
+    ++bufferPos_;
+    if (c == ',' && !skipWhitespace()) {
+      setError(ErrorCode::CriticalParsingError,
+               "JSON error: unexpected end of file.");
+      return false;
+    }
+  } else if (c == ']') {
+    ++bufferPos_;
+  }
+  if (c == ']') {
+    atEnd_ = true;
+    // only whitespace is allowed after the array
+    if (skipWhitespace()) {
+      setError(ErrorCode::CriticalParsingError,
+               "JSON error: unexpected content after the end of the array.");
+    }
+    return false;
+  }
+  int elementEnd{};
+  if (!findElementEnd(elementEnd)) {
+    setError(ErrorCode::CriticalParsingError,
+             "JSON error: unexpected end of file.");
+    return false;
+  }
+  if (elementEnd == bufferPos_) {
+    setError(ErrorCode::CriticalParsingError,
+             "JSON error: missing array element.");
+    return false;
+  }
+  rawDoc = buffer_.mid(bufferPos_, elementEnd - bufferPos_);
+  bufferPos_ = elementEnd;
+  ++nDocs_;
+  return true;
+}
+
+std::unique_ptr<DocRecord>
+JsonDocsReader::parseRaw(const QByteArray& rawDoc) const {
+  if (rawDoc.startsWith('{')) {
+    return parseJsonDocRecord(rawDoc);
+  }
+  // elements that are not objects do not contain a document (as when the
+  // whole array was parsed at once) but must still be valid JSON
+  if (!QJsonDocument::fromJson("[" + rawDoc + "]").isArray()) {
+    return nullptr;
+  }
+  return jsonToDocRecord(QJsonObject{});
+}
+
+QString JsonDocsReader::parseErrorMessage() const {
+  return "JSON error: could not parse array element.";
+}
+
+qint64 JsonDocsReader::position() const {
+  return getFile()->pos() - (buffer_.size() - bufferPos_);
+}
+
+bool JsonDocsReader::seek(qint64 position) {
+  if (hasError() || !getFile()->seek(position)) {
+    return false;
+  }
+  buffer_.clear();
+  bufferPos_ = 0;
+  atEnd_ = false;
+  // the position is after an element so a ',' or ']' is expected next
+  nDocs_ = std::max(nDocs_, 1);
+  return true;
+}
 
 JsonLinesDocsReader::JsonLinesDocsReader(const QString& filePath)
-    : DocsReader(filePath) {}
+    : DocsReader(filePath) {
+  if (!hasError()) {
+    mapFile();
+  }
+}
 
-bool JsonLinesDocsReader::readNext() {
+bool JsonLinesDocsReader::mapFile() {
+  // compressed files are not QFiles
+  auto file = dynamic_cast<QFile*>(getFile());
+  if (file == nullptr || file->size() == 0) {
+    return false;
+  }
+  auto mapped = file->map(0, file->size());
+  if (mapped == nullptr) {
+    return false;
+  }
+  mapped_ = reinterpret_cast<const char*>(mapped);
+  lineIndex_ = LineIndex(mapped_, file->size());
+  return true;
+}
+
+bool JsonLinesDocsReader::isMapped() const { return mapped_ != nullptr; }
+
+const LineIndex* JsonLinesDocsReader::getLineIndex() const {
+  return isMapped() ? &lineIndex_ : nullptr;
+}
+
+bool JsonLinesDocsReader::canReadRaw() const { return true; }
+
+bool JsonLinesDocsReader::readRaw(QByteArray& rawDoc) {
   if (hasError()) {
     return false;
   }
+  if (isMapped()) {
+    if (currentLine_ == lineIndex_.nLines()) {
+      return false;
+    }
+    auto start = lineIndex_.lineStart(currentLine_);
+    rawDoc = QByteArray::fromRawData(
+        mapped_ + start,
+        static_cast<int>(lineIndex_.lineEnd(currentLine_) - start));
+    ++currentLine_;
+    return true;
+  }
   QByteArray line{};
   while (line == "" && !getFile()->atEnd()) {
     line = getFile()->readLine();
   }
   if (line == "") {
+    checkReadError();
     return false;
   }
-  auto jsonDoc = QJsonDocument::fromJson(line);
-  if (!jsonDoc.isObject()) {
-    setError(ErrorCode::CriticalParsingError,
-             "JSONLines error: could not parse line as a JSON object.");
+  rawDoc = line;
+  return true;
+}
+
+int JsonLinesDocsReader::currentProgress() const {
+  if (!isMapped()) {
+    return DocsReader::currentProgress();
+  }
+  return castProgressToRange(static_cast<double>(currentLine_),
+                             static_cast<double>(lineIndex_.nLines()),
+                             progressRangeMax_);
+}
+
+qint64 JsonLinesDocsReader::position() const {
+  if (!isMapped()) {
+    return DocsReader::position();
+  }
+  return lineIndex_.lineStart(currentLine_);
+}
+
+bool JsonLinesDocsReader::seek(qint64 position) {
+  if (!isMapped()) {
+    return DocsReader::seek(position);
+  }
+  auto line = lineIndex_.findLine(position);
+  if (line == -1) {
     return false;
   }
-  std::unique_ptr<DocRecord> newRecord(new DocRecord);
-  setCurrentRecord(jsonToDocRecord(jsonDoc));
+  currentLine_ = line;
   return true;
 }
 
+std::unique_ptr<DocRecord>
+JsonLinesDocsReader::parseRaw(const QByteArray& rawDoc) const {
+  return parseJsonDocRecord(rawDoc);
+}
+
+QString JsonLinesDocsReader::parseErrorMessage() const {
+  return "JSONLines error: could not parse line as a JSON object.";
+}
+
 DocsWriter::DocsWriter(const QString& filePath, bool includeText,
                        bool includeAnnotations)
-    : file_(filePath), includeText_{includeText}, includeAnnotations_{
-                                                      includeAnnotations} {
-  file_.open(QIODevice::WriteOnly);
+    : file_(makeDocsFile(filePath)), includeText_{includeText},
+      includeAnnotations_{includeAnnotations} {
+  openDocsFile(*file_, filePath, QIODevice::WriteOnly);
 }
 
 void DocsWriter::writePrefix() {}
 
 void DocsWriter::writeSuffix() {}
 
-bool DocsWriter::isOpen() const { return file_.isOpen(); }
+void DocsWriter::addDocument(const QString& md5, const QByteArray& contentUtf8,
+                             const QByteArray& metadata,
+                             const QList<Annotation>& annotations,
+                             const QString& displayTitle,
+                             const QString& listTitle) {
+  buffer_.resize(0);
+  serializeDocument(md5, contentUtf8, metadata, annotations, displayTitle,
+                    listTitle, buffer_);
+  addSerializedDocument(buffer_);
+}
+
+bool DocsWriter::startNewFile(const QString& filePath) {
+  auto closed = close();
+  file_ = makeDocsFile(filePath);
+  return openDocsFile(*file_, filePath, QIODevice::WriteOnly) && closed;
+}
+
+bool DocsWriter::close() {
+  if (!file_->isOpen()) {
+    return !writeFailed_;
+  }
+  // buffered data is written, and a compressed stream is finished, by close
+  file_->close();
+  auto compressedFile = dynamic_cast<const CompressedFile*>(file_.get());
+  auto plainFile = dynamic_cast<const QFileDevice*>(file_.get());
+  if ((compressedFile != nullptr && compressedFile->hasError()) ||
+      (plainFile != nullptr && plainFile->error() != QFileDevice::NoError)) {
+    writeFailed_ = true;
+  }
+  return !writeFailed_;
+}
+
+bool DocsWriter::isOpen() const { return file_->isOpen(); }
 
 bool DocsWriter::isIncludingText() const { return includeText_; }
 
 bool DocsWriter::isIncludingAnnotations() const { return includeAnnotations_; }
 
-QFile* DocsWriter::getFile() { return &file_; }
+QIODevice* DocsWriter::getFile() { return file_.get(); }
+
+qint64 DocsWriter::nBytesWritten() const { return nBytesWritten_; }
+
+void DocsWriter::write(const QByteArray& data) {
+  auto nWritten = file_->write(data);
+  if (nWritten > 0) {
+    nBytesWritten_ += nWritten;
+  }
+  if (nWritten != data.size()) {
+    writeFailed_ = true;
+  }
+}
 
 JsonLinesDocsWriter::JsonLinesDocsWriter(const QString& filePath,
                                          bool includeText,
@@ -200,79 +784,129 @@ JsonLinesDocsWriter::JsonLinesDocsWriter(const QString& filePath,
 
 int JsonLinesDocsWriter::getNDocs() const { return nDocs_; }
 
-void JsonLinesDocsWriter::addDocument(const QString& md5,
-                                      const QString& content,
-                                      const QJsonObject& metadata,
-                                      const QList<Annotation>& annotations,
-                                      const QString& displayTitle,
-                                      const QString& listTitle) {
-  if (nDocs_) {
-    getFile()->write("\n");
+namespace {
+
+/// Write stored metadata, unchanged if possible.
+
+/// Metadata is a JSON object serialized by labelbuddy. It is re-serialized
+/// only if it is empty, is not an object, or contains a line break, which
+/// would split a JSON lines document.
+void writeMetadata(JsonWriter& json, const QByteArray& metadata) {
+  if (metadata.startsWith('{') && !metadata.contains('\n') &&
+      !metadata.contains('\r')) {
+    json.rawValue(metadata);
+    return;
+  }
+  json.rawValue(QJsonDocument(QJsonDocument::fromJson(metadata).object())
+                    .toJson(QJsonDocument::Compact));
+}
+
+} // namespace
+
+void JsonLinesDocsWriter::serializeDocument(
+    const QString& md5, const QByteArray& contentUtf8,
+    const QByteArray& metadata, const QList<Annotation>& annotations,
+    const QString& displayTitle, const QString& listTitle,
+    QByteArray& output) const {
+  // keys are written in alphabetical order, as they were when the documents
+  // were serialized through a QJsonObject
+  JsonWriter json(output);
+  json.beginObject();
+  if (isIncludingAnnotations()) {
+    json.key("annotations");
+    json.beginArray();
+    for (const auto& annotation : annotations) {
+      json.beginObject();
+      json.key("end_byte");
+      json.intValue(annotation.endByte);
+      json.key("end_char");
+      json.intValue(annotation.endChar);
+      if (annotation.extraData != "") {
+        json.key("extra_data");
+        json.stringValue(annotation.extraData);
+      }
+      assert(annotation.labelName != "");
+      json.key("label_name");
+      json.stringValue(annotation.labelName);
+      json.key("start_byte");
+      json.intValue(annotation.startByte);
+      json.key("start_char");
+      json.intValue(annotation.startChar);
+      json.endObject();
+    }
+    json.endArray();
   }
-  QJsonObject docJson{};
-  assert(md5 != "");
-  docJson.insert("utf8_text_md5_checksum", md5);
-  docJson.insert("metadata", metadata);
   if (isIncludingText()) {
     if (displayTitle != QString()) {
-      docJson.insert("display_title", displayTitle);
+      json.key("display_title");
+      json.stringValue(displayTitle);
     }
     if (listTitle != QString()) {
-      docJson.insert("list_title", listTitle);
+      json.key("list_title");
+      json.stringValue(listTitle);
     }
-    assert(content != "");
-    docJson.insert("text", content);
   }
-  if (isIncludingAnnotations()) {
-    QJsonArray allAnnotationsJson{};
-    for (const auto& annotation : annotations) {
-      QJsonObject annotationJson{};
-      annotationJson.insert("start_char", annotation.startChar);
-      annotationJson.insert("end_char", annotation.endChar);
-      annotationJson.insert("start_byte", annotation.startByte);
-      annotationJson.insert("end_byte", annotation.endByte);
-      assert(annotation.labelName != "");
-      annotationJson.insert("label_name", annotation.labelName);
-      if (annotation.extraData != "") {
-        annotationJson.insert("extra_data", annotation.extraData);
-      }
-      allAnnotationsJson.append(annotationJson);
-    }
-    docJson.insert("annotations", allAnnotationsJson);
+  json.key("metadata");
+  writeMetadata(json, metadata);
+  if (isIncludingText()) {
+    assert(contentUtf8 != "");
+    json.key("text");
+    json.stringValue(contentUtf8);
   }
-  getFile()->write(QJsonDocument(docJson).toJson(QJsonDocument::Compact));
+  assert(md5 != "");
+  json.key("utf8_text_md5_checksum");
+  json.stringValue(md5);
+  json.endObject();
+}
+
+void JsonLinesDocsWriter::serializeDeletedDocument(const QString& md5,
+                                                   QByteArray& output) const {
+  JsonWriter json(output);
+  json.beginObject();
+  json.key("deleted");
+  json.rawValue("true");
+  json.key("utf8_text_md5_checksum");
+  json.stringValue(md5);
+  json.endObject();
+}
+
+void JsonLinesDocsWriter::addSerializedDocument(const QByteArray& serialized) {
+  if (nDocs_) {
+    write("\n");
+  }
+  write(serialized);
   ++nDocs_;
 }
 
 void JsonLinesDocsWriter::writeSuffix() {
   if (nDocs_) {
-    getFile()->write("\n");
+    write("\n");
   }
 }
 
+bool JsonLinesDocsWriter::startNewFile(const QString& filePath) {
+  nDocs_ = 0;
+  return DocsWriter::startNewFile(filePath);
+}
+
 JsonDocsWriter::JsonDocsWriter(const QString& filePath, bool includeText,
                                bool includeAnnotations)
     : JsonLinesDocsWriter(filePath, includeText, includeAnnotations) {}
 
-void JsonDocsWriter::addDocument(const QString& md5, const QString& content,
-                                 const QJsonObject& metadata,
-                                 const QList<Annotation>& annotations,
-                                 const QString& displayTitle,
-                                 const QString& listTitle) {
+void JsonDocsWriter::addSerializedDocument(const QByteArray& serialized) {
   if (getNDocs()) {
-    getFile()->write(",");
+    write(",");
   }
-  JsonLinesDocsWriter::addDocument(md5, content, metadata, annotations,
-                                   displayTitle, listTitle);
+  JsonLinesDocsWriter::addSerializedDocument(serialized);
 }
 
-void JsonDocsWriter::writePrefix() { getFile()->write("[\n"); }
+void JsonDocsWriter::writePrefix() { write("[\n"); }
 
 void JsonDocsWriter::writeSuffix() {
   if (getNDocs()) {
-    getFile()->write("\n");
+    write("\n");
   }
-  getFile()->write("]\n");
+  write("]\n");
 }
 
 LabelRecord jsonToLabelRecord(const QJsonValue& json) {
@@ -331,6 +965,7 @@ bool DatabaseCatalog::openDatabase(const QString& databasePath, bool remember) {
   }
   if (QSqlDatabase::contains(actualDatabasePath)) {
     currentDatabase_ = actualDatabasePath;
+    utf8Database_ = isUtf8Database(currentDatabase_);
     if (remember) {
       storeDbPath(actualDatabasePath);
     }
@@ -357,6 +992,7 @@ bool DatabaseCatalog::openDatabase(const QString& databasePath, bool remember) {
   }
   removeCon.cancel();
   currentDatabase_ = actualDatabasePath;
+  utf8Database_ = isUtf8Database(currentDatabase_);
   if (remember) {
     storeDbPath(actualDatabasePath);
   }
@@ -476,10 +1112,22 @@ QString DatabaseCatalog::fileExtensionErrorMessage(const QString& filePath,
   QFileInfo info(filePath);
   auto suffix = info.suffix();
   QString errorMsg{};
+  QTextStream errorS(&errorMsg);
+  // documents can be compressed, the format is given by the previous suffix
+  auto compression = kind == ItemKind::Document
+                         ? compressionFromFileName(filePath)
+                         : Compression::None;
+  if (!isCompressionSupported(compression)) {
+    errorS << "This version of labelbuddy was built without support for '"
+           << compressionSuffix(compression) << "' files.";
+    return errorMsg;
+  }
+  if (compression != Compression::None) {
+    suffix = QFileInfo(stripCompressionSuffix(filePath)).suffix();
+  }
   if (validAndDefault.first.contains(suffix)) {
     return errorMsg;
   }
-  QTextStream errorS(&errorMsg);
   errorS << (action == Action::Import ? "Import" : "Export") << " "
          << (kind == ItemKind::Document ? "documents" : "labels")
          << ": extension of '" << info.fileName()
@@ -493,114 +1141,63 @@ QString DatabaseCatalog::fileExtensionErrorMessage(const QString& filePath,
   return errorMsg;
 }
 
-int DatabaseCatalog::insertDocRecord(const DocRecord& record,
-                                     QSqlQuery& query) {
-  QByteArray hash{};
-  if (record.validContent) {
-    query.prepare("insert into document (content, content_md5, metadata, "
-                  "display_title, list_title) "
-                  "values (:content, :md5, :extra, :st, :lt);");
-    query.bindValue(":content", record.content);
-    query.bindValue(":extra", record.metadata);
-    hash = QCryptographicHash::hash(record.content.toUtf8(),
-                                    QCryptographicHash::Md5);
-    query.bindValue(":md5", hash);
-    query.bindValue(":st", record.displayTitle != QString()
-                               ? record.displayTitle
-                               : QVariant());
-    query.bindValue(":lt", record.listTitle != QString() ? record.listTitle
-                                                         : QVariant());
-    query.exec();
-  } else {
-    if (record.declaredMd5 == QString()) {
-      return 0;
-    }
-    // bad chars are skipped. this is not inserted in db but used for lookup.
-    hash = QByteArray::fromHex(record.declaredMd5.toUtf8());
+void computeContentUtf8(DocRecord& record) {
+  if (record.validContent && record.contentUtf8.isEmpty()) {
+    record.contentUtf8 = record.content.toUtf8();
   }
-  if (record.annotations.empty()) {
-    return 0;
-  }
-  query.prepare("select id from document where content_md5 = :md5;");
-  query.bindValue(":md5", hash);
-  query.exec();
-  if (!query.next()) {
-    return 0;
-  }
-  auto docId = query.value(0).toInt();
-  return insertDocAnnotations(docId, record.annotations, query);
-}
-
-CharIndices DatabaseCatalog::getCharIndices(int docId, QSqlQuery& query) const {
-  query.prepare("select content from document where id = :docid;");
-  query.bindValue(":docid", docId);
-  query.exec();
-  query.next();
-  return CharIndices(query.value(0).toString());
 }
 
-QMap<int, int> getUtf8ToUnicode(const CharIndices& charIndices,
-                                const QList<Annotation>& annotations) {
-  QList<int> byte_indices{};
-  for (const auto& anno : annotations) {
-    if (anno.startByte != Annotation::nullIndex) {
-      byte_indices << anno.startByte;
-    }
-    if (anno.endByte != Annotation::nullIndex) {
-      byte_indices << anno.endByte;
-    }
+void computeContentMd5(DocRecord& record) {
+  if (record.validContent && record.contentMd5.isEmpty()) {
+    computeContentUtf8(record);
+    record.contentMd5 = QCryptographicHash::hash(record.contentUtf8,
+                                                 QCryptographicHash::Md5);
   }
-  return charIndices.utf8ToUnicode(byte_indices.cbegin(), byte_indices.cend());
 }
 
-int DatabaseCatalog::insertDocAnnotations(int docId,
-                                          const QList<Annotation>& annotations,
-                                          QSqlQuery& query) {
-  if (annotations.isEmpty()) {
-    return 0;
-  }
-  auto charIndices = getCharIndices(docId, query);
-  auto utf8ToUnicode = getUtf8ToUnicode(charIndices, annotations);
-  int nAnnotations{};
-  for (const auto& annotation : annotations) {
-
-    auto startChar = annotation.startChar;
-    if (startChar == Annotation::nullIndex) {
-      startChar =
-          utf8ToUnicode.value(annotation.startByte, Annotation::nullIndex);
-    }
+namespace {
+
+/// Apply a conversion that needs sorted indices to `indices` in any order.
+
+/// The result has the converted index at the position of each input index.
+template <typename Convert>
+std::vector<int> convertUnsortedIndices(const std::vector<int>& indices,
+                                        Convert convert) {
+  std::vector<std::size_t> order(indices.size());
+  for (std::size_t i = 0; i != order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+            [&indices](std::size_t lhs, std::size_t rhs) {
+              return indices[lhs] < indices[rhs];
+            });
+  std::vector<int> sortedIndices{};
+  sortedIndices.reserve(indices.size());
+  for (auto i : order) {
+    sortedIndices.push_back(indices[i]);
+  }
+  auto converted = convert(sortedIndices);
+  std::vector<int> result(indices.size());
+  for (std::size_t i = 0; i != order.size(); ++i) {
+    result[order[i]] = converted[i];
+  }
+  return result;
+}
 
-    auto endChar = annotation.endChar;
-    if (endChar == Annotation::nullIndex) {
-      endChar = utf8ToUnicode.value(annotation.endByte, Annotation::nullIndex);
-    }
+} // namespace
 
-    if (!(charIndices.isValidUnicodeIndex(startChar) &&
-          charIndices.isValidUnicodeIndex(endChar))) {
-      continue; // bad annotation
-    }
-    insertLabel(query, annotation.labelName);
-    query.prepare("select id from label where name = :lname;");
-    query.bindValue(":lname", annotation.labelName);
-    query.exec();
-    if (!query.next()) {
-      continue; // bad label
-    }
-    auto labelId = query.value(0).toInt();
-    query.prepare(
-        "insert into annotation (doc_id, label_id, start_char, end_char, "
-        "extra_data) values (:docid, :labelid, :schar, :echar, :extra);");
-    query.bindValue(":docid", docId);
-    query.bindValue(":labelid", labelId);
-    query.bindValue(":schar", startChar);
-    query.bindValue(":echar", endChar);
-    query.bindValue(":extra", annotation.extraData != "" ? annotation.extraData
-                                                         : QVariant());
-    if (query.exec()) {
-      ++nAnnotations;
-    }
+std::vector<int> getUtf8ToUnicode(const Utf8OffsetIndex& utf8Index,
+                                  const QList<Annotation>& annotations) {
+  std::vector<int> byteIndices{};
+  byteIndices.reserve(2 * static_cast<std::size_t>(annotations.size()));
+  for (const auto& anno : annotations) {
+    byteIndices.push_back(anno.startByte);
+    byteIndices.push_back(anno.endByte);
   }
-  return nAnnotations;
+  return convertUnsortedIndices(
+      byteIndices, [&utf8Index](const std::vector<int>& sorted) {
+        return utf8Index.utf8ToUnicodeSorted(sorted);
+      });
 }
 
 void DatabaseCatalog::insertLabel(QSqlQuery& query, const QString& labelName,
@@ -633,9 +1230,12 @@ void DatabaseCatalog::insertLabel(QSqlQuery& query, const QString& labelName,
   }
 }
 
-std::unique_ptr<DocsReader> getDocsReader(const QString& filePath) {
+std::unique_ptr<DocsReader> getDocsReader(const QString& filePath,
+                                          const QString& format) {
   std::unique_ptr<DocsReader> reader;
-  auto suffix = QFileInfo(filePath).suffix();
+  auto suffix = format != QString()
+                    ? format
+                    : QFileInfo(stripCompressionSuffix(filePath)).suffix();
   if (suffix == "json") {
     reader.reset(new JsonDocsReader(filePath));
   } else if (suffix == "jsonl") {
@@ -646,53 +1246,397 @@ std::unique_ptr<DocsReader> getDocsReader(const QString& filePath) {
   return reader;
 }
 
-ImportDocsResult DatabaseCatalog::importDocuments(const QString& filePath,
-                                                  QProgressDialog* progress) {
+std::unique_ptr<DocsReader>
+DatabaseCatalog::openDocsReader(const QString& filePath,
+                                const ImportDocsOptions& options,
+                                const QJsonObject& checkpoint,
+                                int& nDocsRead) const {
+  auto reader = getDocsReader(
+      filePath, isStandardStream(filePath) ? options.stdinFormat : QString());
+  reader->setSkipInvalid(options.rejectsFile != QString() || options.dryRun);
+  nDocsRead = 0;
+  if (options.resume && !reader->hasError()) {
+    nDocsRead = resumeImport(*reader, filePath, checkpoint);
+  }
+  return reader;
+}
+
+ImportDocsResult
+DatabaseCatalog::importDocuments(const QString& filePath,
+                                 QProgressDialog* progress,
+                                 const ImportDocsOptions& options) {
+  int nDocsRead{};
+  auto reader = openDocsReader(filePath, options, getImportCheckpoint(),
+                               nDocsRead);
+  if (options.nThreads > 1 && !reader->hasError()) {
+    // the reader is used by the worker threads but all database operations
+    // stay in this thread, which owns the connection
+    std::unique_ptr<DocsReader> parallelReader(new ParallelDocsReader(
+        std::move(reader), options.nThreads, options.batchSize > 0));
+    reader = std::move(parallelReader);
+  }
+  return importFromReader(filePath, *reader, nDocsRead, progress, options);
+}
+
+QList<ImportDocsFileResult>
+DatabaseCatalog::importDocumentFiles(const QStringList& filePaths,
+                                     const ImportDocsOptions& options) {
+  QList<ImportDocsFileResult> results{};
+  // read before the first import, which may replace it
+  auto checkpoint = getImportCheckpoint();
+  auto fileOptions = options;
+  std::unique_ptr<BulkLoadGuard> bulkLoadGuard{};
+  if (options.bulkLoad && !options.dryRun) {
+    bulkLoadGuard.reset(new BulkLoadGuard(currentDatabase_));
+    fileOptions.bulkLoad = false;
+  }
+  // a dry run checks each file as if the earlier ones had been imported
   QSqlQuery query(QSqlDatabase::database(currentDatabase_));
+  std::unique_ptr<BulkInserter> dryRunInserter{};
+  if (options.dryRun) {
+    query.exec("begin transaction;");
+    dryRunInserter.reset(new BulkInserter(currentDatabase_, colorIndex_, true));
+  }
+  // with several threads and files, files are read ahead and each one gets
+  // part of the threads; otherwise they are imported one by one
+  auto nFilesAhead = 1;
+  if (options.nThreads > 1 && filePaths.size() > 1) {
+    nFilesAhead = std::min(options.nThreads, filePaths.size());
+    fileOptions.nThreads = options.nThreads / nFilesAhead;
+  }
+  auto openReader = [&](int fileIdx)
+      -> std::pair<std::unique_ptr<DocsReader>, int> {
+    int nDocsRead{};
+    auto reader = openDocsReader(filePaths[fileIdx], fileOptions, checkpoint,
+                                 nDocsRead);
+    if (nFilesAhead > 1 && !reader->hasError()) {
+      // starts reading and parsing in the background right away
+      std::unique_ptr<DocsReader> parallelReader(new ParallelDocsReader(
+          std::move(reader), fileOptions.nThreads, fileOptions.batchSize > 0,
+          lookaheadBatches_));
+      reader = std::move(parallelReader);
+    } else if (fileOptions.nThreads > 1 && !reader->hasError()) {
+      std::unique_ptr<DocsReader> parallelReader(new ParallelDocsReader(
+          std::move(reader), fileOptions.nThreads, fileOptions.batchSize > 0));
+      reader = std::move(parallelReader);
+    }
+    return std::make_pair(std::move(reader), nDocsRead);
+  };
+  // readers of the next files, with the number of documents skipped in each
+  // when resuming
+  std::deque<std::pair<std::unique_ptr<DocsReader>, int>> readers{};
+  auto nOpened = 0;
+  for (int i = 0; i < filePaths.size(); ++i) {
+    while (nOpened < filePaths.size() && nOpened < i + nFilesAhead) {
+      readers.push_back(openReader(nOpened));
+      ++nOpened;
+    }
+    auto reader = std::move(readers.front());
+    readers.pop_front();
+    QElapsedTimer timer{};
+    timer.start();
+    auto result = importFromReader(filePaths[i], *reader.first, reader.second,
+                                   nullptr, fileOptions, dryRunInserter.get());
+    results << ImportDocsFileResult{filePaths[i], result, timer.elapsed()};
+  }
+  if (options.dryRun) {
+    dryRunInserter.reset();
+    query.exec("rollback transaction;");
+  }
+  return results;
+}
+
+double fractionRead(const DocsReader& reader, int startProgress) {
+  auto remaining = reader.progressMax() - startProgress;
+  if (remaining <= 0) {
+    return -1.;
+  }
+  auto fraction =
+      static_cast<double>(reader.currentProgress() - startProgress) /
+      static_cast<double>(remaining);
+  return fraction >= 0. && fraction <= 1. ? fraction : -1.;
+}
+
+ImportDocsResult DatabaseCatalog::importFromReader(
+    const QString& filePath, DocsReader& reader, int nDocsRead,
+    QProgressDialog* progress, const ImportDocsOptions& options,
+    BulkInserter* dryRunInserter) {
+  if (reader.hasError()) {
+    return {0, 0, reader.errorCode(), reader.errorMessage(), 0};
+  }
+  QSqlQuery query(QSqlDatabase::database(currentDatabase_));
+  if (options.dryRun && dryRunInserter != nullptr) {
+    return dryRunImport(reader, progress, *dryRunInserter);
+  }
+  if (options.dryRun) {
+    // nothing is written; the transaction gives the inserter's lookups a
+    // consistent view of the database and makes sure nothing is kept
+    query.exec("begin transaction;");
+    ImportDocsResult result{};
+    {
+      BulkInserter inserter(currentDatabase_, colorIndex_, true);
+      result = dryRunImport(reader, progress, inserter);
+    }
+    query.exec("rollback transaction;");
+    return result;
+  }
   query.exec("select count(*) from document;");
   query.next();
   auto nBefore = query.value(0).toInt();
-  auto reader = getDocsReader(filePath);
-  if (reader->hasError()) {
-    return {0, 0, reader->errorCode(), reader->errorMessage()};
+  query.finish();
+  auto useBatches = options.batchSize > 0;
+  QFile rejectsFile(options.rejectsFile);
+  if (options.rejectsFile != QString() &&
+      !rejectsFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+    return {0, 0, ErrorCode::FileSystemError, "Could not open rejects file.",
+            0};
   }
   if (progress != nullptr) {
-    progress->setMaximum(reader->progressMax() + 1);
+    progress->setMaximum(reader.progressMax() + 1);
+  }
+  // declared before the inserter so the indexes are rebuilt after the
+  // inserter's statements are finalized
+  std::unique_ptr<BulkLoadGuard> bulkLoadGuard{};
+  if (options.bulkLoad) {
+    bulkLoadGuard.reset(new BulkLoadGuard(currentDatabase_));
   }
   bool cancelled{};
-  query.exec("begin transaction;");
-  int nAnnotations{};
-  int nDocsRead{};
-  std::cout << std::endl;
-  while (reader->readNext()) {
+  // a savepoint outside of any transaction behaves like "begin transaction"
+  // and releasing it commits
+  query.exec(useBatches ? "savepoint import_batch;" : "begin transaction;");
+  BulkInserter inserter(currentDatabase_, colorIndex_);
+  int nRejected{};
+  int nInBatch{};
+  // a resumed import reports what is read in this run
+  auto nDocsAtStart = nDocsRead;
+  auto startPosition = reader.position();
+  auto startProgress = reader.currentProgress();
+  ProgressReporter reporter("import");
+  while (true) {
+    auto hasNext = reader.readNext();
+    for (auto rawDoc : reader.takeRejectedDocs()) {
+      if (!rawDoc.endsWith('\n')) {
+        rawDoc.append('\n');
+      }
+      rejectsFile.write(rawDoc);
+      ++nRejected;
+      ++nDocsRead;
+    }
+    if (!hasNext) {
+      break;
+    }
     if (progress != nullptr && progress->wasCanceled()) {
       cancelled = true;
       break;
     }
-    if (reader->hasError()) {
+    if (reader.hasError()) {
       break;
     }
     ++nDocsRead;
-    std::cout << "Read " << nDocsRead << " documents\r" << std::flush;
-    nAnnotations += insertDocRecord(*(reader->getCurrentRecord()), query);
+    if (reporter.isDue()) {
+      reporter.report(nDocsRead - nDocsAtStart,
+                      reader.position() - startPosition,
+                      fractionRead(reader, startProgress));
+    }
+    inserter.insertDocRecord(*(reader.getCurrentRecord()));
     if (progress != nullptr) {
-      progress->setValue(reader->currentProgress());
+      progress->setValue(reader.currentProgress());
+    }
+    ++nInBatch;
+    if (useBatches && nInBatch == options.batchSize) {
+      nInBatch = 0;
+      inserter.flush();
+      saveImportCheckpoint(filePath, reader.position(), nDocsRead);
+      query.exec("release import_batch;");
+      query.exec("savepoint import_batch;");
     }
   }
-  std::cout << std::endl;
-  if (cancelled || reader->hasError()) {
-    query.exec("rollback transaction");
+  reporter.finish(nDocsRead - nDocsAtStart, reader.position() - startPosition);
+  if (cancelled || reader.hasError()) {
+    if (useBatches) {
+      query.exec("rollback to import_batch;");
+      query.exec("release import_batch;");
+      std::cout << "Import interrupted, completed batches have been saved"
+                << (isStandardStream(filePath) ? "." : " and it can be resumed.")
+                << std::endl;
+    } else {
+      query.exec("rollback transaction");
+    }
   } else {
-    query.exec("commit transaction");
+    inserter.flush();
+    if (useBatches || options.resume) {
+      setAppStateExtra(importCheckpointKey_, QVariant());
+    }
+    query.exec(useBatches ? "release import_batch;" : "commit transaction");
+    std::cout << "Inserted " << inserter.nRows() << " rows ("
+              << static_cast<int>(inserter.rowsPerSecond()) << " rows/s)"
+              << std::endl;
+  }
+  if (nRejected != 0) {
+    std::cout << "Skipped " << nRejected << " invalid documents, written to "
+              << options.rejectsFile.toStdString() << std::endl;
   }
   query.exec("select count(*) from document;");
   query.next();
   auto nAfter = query.value(0).toInt();
+  query.finish();
   if (progress != nullptr) {
     progress->setValue(progress->maximum());
   }
-  return {nAfter - nBefore, nAnnotations, reader->errorCode(),
-          reader->errorMessage()};
+  return {nAfter - nBefore, inserter.nAnnotations(), reader.errorCode(),
+          reader.errorMessage(), nDocsRead - nDocsAtStart};
+}
+
+namespace {
+
+/// Print what a dry run found; times are in nanoseconds
+void printDryRunReport(const InsertionCounts& counts, int nRead,
+                       int nRejected, qint64 nBytes, qint64 readTime,
+                       qint64 checkTime) {
+  auto perSecond = [](double quantity, qint64 time) {
+    return time > 0 ? quantity * 1e9 / static_cast<double>(time) : 0.;
+  };
+  std::cout << "Dry run, nothing was written to the database.\n"
+            << "Documents read: " << nRead << "\n"
+            << "  new: " << counts.nNewDocs << "\n"
+            << "  already in the database: " << counts.nDocsInDatabase << "\n"
+            << "  duplicates of an earlier document: "
+            << counts.nDuplicateDocs << "\n"
+            << "  empty text (dropped): " << counts.nEmptyDocs << "\n"
+            << "  invalid (dropped): " << nRejected << "\n"
+            << "  annotations only (no text): " << counts.nRecordsWithoutText
+            << "\n"
+            << "Annotations to import: " << counts.nValidAnnotations << "\n"
+            << "Annotations dropped:\n"
+            << "  already in the database: " << counts.nAnnotationsInDatabase
+            << "\n"
+            << "  duplicates of an earlier annotation: "
+            << counts.nDuplicateAnnotations << "\n"
+            << "  invalid character positions: " << counts.nInvalidPositions
+            << "\n"
+            << "  invalid labels: " << counts.nInvalidLabels << "\n"
+            << "  end not after start: " << counts.nEmptySpans << "\n"
+            << "  no matching document: " << counts.nAnnotationsWithoutDoc
+            << "\n"
+            << "New labels: " << counts.nNewLabels << "\n"
+            << "Reading and parsing: "
+            << static_cast<double>(readTime) / 1e9 << " s, "
+            << static_cast<int>(perSecond(nRead, readTime)) << " docs/s, "
+            << perSecond(static_cast<double>(nBytes) / 1e6, readTime)
+            << " MB/s\n"
+            << "Validation: " << static_cast<double>(checkTime) / 1e9
+            << " s, " << static_cast<int>(perSecond(nRead, checkTime))
+            << " docs/s" << std::endl;
+}
+
+} // namespace
+
+ImportDocsResult DatabaseCatalog::dryRunImport(DocsReader& reader,
+                                               QProgressDialog* progress,
+                                               BulkInserter& inserter) {
+  if (progress != nullptr) {
+    progress->setMaximum(reader.progressMax() + 1);
+  }
+  // the report is for this file only
+  inserter.resetCounts();
+  auto startPosition = reader.position();
+  int nRead{};
+  int nRejected{};
+  qint64 readTime{};
+  qint64 checkTime{};
+  QElapsedTimer timer{};
+  timer.start();
+  auto startProgress = reader.currentProgress();
+  ProgressReporter reporter("dry-run");
+  while (true) {
+    auto readStart = timer.nsecsElapsed();
+    auto hasNext = reader.readNext();
+    auto readEnd = timer.nsecsElapsed();
+    readTime += readEnd - readStart;
+    auto nNewRejected = reader.takeRejectedDocs().size();
+    nRejected += nNewRejected;
+    nRead += nNewRejected;
+    if (!hasNext || reader.hasError() ||
+        (progress != nullptr && progress->wasCanceled())) {
+      break;
+    }
+    ++nRead;
+    inserter.insertDocRecord(*(reader.getCurrentRecord()));
+    checkTime += timer.nsecsElapsed() - readEnd;
+    if (reporter.isDue()) {
+      reporter.report(nRead, reader.position() - startPosition,
+                      fractionRead(reader, startProgress));
+    }
+    if (progress != nullptr) {
+      progress->setValue(reader.currentProgress());
+    }
+  }
+  reporter.finish(nRead, reader.position() - startPosition);
+  printDryRunReport(inserter.counts(), nRead, nRejected,
+                    reader.position() - startPosition, readTime, checkTime);
+  if (progress != nullptr) {
+    progress->setValue(progress->maximum());
+  }
+  return {inserter.counts().nNewDocs, inserter.nAnnotations(),
+          reader.errorCode(), reader.errorMessage(), nRead};
+}
+
+QJsonObject DatabaseCatalog::getImportCheckpoint() const {
+  return QJsonDocument::fromJson(
+             getAppStateExtra(importCheckpointKey_, QVariant()).toByteArray())
+      .object();
+}
+
+int DatabaseCatalog::resumeImport(DocsReader& reader, const QString& filePath,
+                                  const QJsonObject& checkpoint) const {
+  // the standard input has no path, size or modification time that could
+  // show it is the same stream as the interrupted import
+  if (isStandardStream(filePath)) {
+    std::cout << "Not resuming import of the standard input: it is imported "
+                 "from the beginning"
+              << std::endl;
+    return 0;
+  }
+  QFileInfo fileInfo(filePath);
+  if (checkpoint["file"].toString() != fileInfo.absoluteFilePath()) {
+    return 0;
+  }
+  auto nDocs = checkpoint["n_docs"].toInt();
+  if (nDocs == 0) {
+    return 0;
+  }
+  // the position is only meaningful in the file that was being read
+  if (static_cast<qint64>(checkpoint["size"].toDouble()) != fileInfo.size() ||
+      static_cast<qint64>(checkpoint["modified"].toDouble()) !=
+          fileInfo.lastModified().toMSecsSinceEpoch()) {
+    std::cout << "Not resuming import of " << filePath.toStdString()
+              << ": the file has changed since the import was interrupted"
+              << std::endl;
+    return 0;
+  }
+  if (!reader.seek(static_cast<qint64>(checkpoint["position"].toDouble()))) {
+    return 0;
+  }
+  std::cout << "Resuming import of " << filePath.toStdString() << " after "
+            << nDocs << " documents" << std::endl;
+  return nDocs;
+}
+
+void DatabaseCatalog::saveImportCheckpoint(const QString& filePath,
+                                           qint64 position, int nDocs) const {
+  if (isStandardStream(filePath)) {
+    return;
+  }
+  QFileInfo fileInfo(filePath);
+  QJsonObject checkpoint{
+      {"file", fileInfo.absoluteFilePath()},
+      {"size", static_cast<double>(fileInfo.size())},
+      {"modified",
+       static_cast<double>(fileInfo.lastModified().toMSecsSinceEpoch())},
+      {"position", static_cast<double>(position)},
+      {"n_docs", nDocs}};
+  setAppStateExtra(importCheckpointKey_,
+                   QJsonDocument(checkpoint).toJson(QJsonDocument::Compact));
 }
 
 ReadLabelsResult readLabels(const QString& filePath) {
@@ -753,6 +1697,7 @@ ImportLabelsResult DatabaseCatalog::importLabels(const QString& filePath) {
   query.exec("select count(*) from label;");
   query.next();
   auto nBefore = query.value(0).toInt();
+  query.finish();
   auto readResult = readLabels(filePath);
   if (readResult.errorCode != ErrorCode::NoError) {
     return {0, readResult.errorCode, readResult.errorMessage};
@@ -770,13 +1715,19 @@ ImportLabelsResult DatabaseCatalog::importLabels(const QString& filePath) {
   return {nAfter - nBefore, ErrorCode::NoError, ""};
 }
 
+QString exportedDocsFormat(const QString& filePath, const QString& format) {
+  auto suffix = format != QString()
+                    ? format
+                    : QFileInfo(stripCompressionSuffix(filePath)).suffix();
+  return suffix == "jsonl" ? "jsonl" : "json";
+}
+
 std::unique_ptr<DocsWriter> getDocsWriter(const QString& filePath,
                                           bool includeText,
-                                          bool includeAnnotations) {
-
-  auto suffix = QFileInfo(filePath).suffix();
+                                          bool includeAnnotations,
+                                          const QString& format) {
   std::unique_ptr<DocsWriter> writer{nullptr};
-  if (suffix == "jsonl") {
+  if (exportedDocsFormat(filePath, format) == "jsonl") {
     writer.reset(
         new JsonLinesDocsWriter(filePath, includeText, includeAnnotations));
   } else {
@@ -785,115 +1736,517 @@ std::unique_ptr<DocsWriter> getDocsWriter(const QString& filePath,
   return writer;
 }
 
+namespace {
+
+/// An export file name split in parts, eg "dir/docs", ".jsonl", ".gz" for
+/// "dir/docs.jsonl.gz"
+struct ExportPathParts {
+  QString stem;
+  /// with its leading dot, or empty
+  QString extension;
+  /// with its leading dot, or empty
+  QString compressionSuffix;
+};
+
+ExportPathParts splitExportPath(const QString& filePath) {
+  auto uncompressed = stripCompressionSuffix(filePath);
+  auto compressionSuffix = filePath.mid(uncompressed.size());
+  auto extension = QFileInfo(uncompressed).suffix();
+  if (extension == QString()) {
+    return {uncompressed, QString(), compressionSuffix};
+  }
+  return {uncompressed.left(uncompressed.size() - extension.size() - 1),
+          "." + extension, compressionSuffix};
+}
+
+} // namespace
+
+QString shardFilePath(const QString& filePath, int shardIndex) {
+  auto parts = splitExportPath(filePath);
+  return parts.stem + QString("-%0").arg(shardIndex, 5, 10, QChar('0')) +
+         parts.extension + parts.compressionSuffix;
+}
+
+QString shardManifestPath(const QString& filePath) {
+  return splitExportPath(filePath).stem + ".manifest.json";
+}
+
+ExportShardSize parseExportShardSize(const QString& value, bool* ok) {
+  ExportShardSize shardSize{};
+  auto trimmed = value.trimmed();
+  bool isValid{};
+  if (trimmed.endsWith("MB", Qt::CaseInsensitive)) {
+    auto megabytes =
+        trimmed.left(trimmed.size() - 2).trimmed().toDouble(&isValid);
+    shardSize.nBytes = static_cast<qint64>(megabytes * 1e6);
+    isValid = isValid && shardSize.nBytes > 0;
+  } else {
+    shardSize.nDocs = trimmed.toInt(&isValid);
+    isValid = isValid && shardSize.nDocs > 0;
+  }
+  if (ok != nullptr) {
+    *ok = isValid;
+  }
+  return isValid ? shardSize : ExportShardSize();
+}
+
+namespace {
+
+/// Rotates the output of a sharded export and keeps its manifest.
+
+/// The manifest is a JSON object with the keys "format" (json or jsonl),
+/// "complete", "n_docs" and "shards", a list of objects with the keys "file"
+/// (the name of the shard, in the same directory as the manifest), "n_docs",
+/// "first_doc" (the position of its first document in the whole export),
+/// "start_byte" and "end_byte" (its position in the concatenation of the
+/// uncompressed shards) and "n_bytes" (its own uncompressed size). It is
+/// rewritten each time a shard is finished, and "complete" is true once the
+/// last one is. The shards listed by the manifest of a previous export to the
+/// same path that are not part of the new one are then removed.
+class ExportShards {
+
+public:
+  ExportShards(const QString& filePath, const QString& format,
+               const ExportShardSize& shardSize)
+      : filePath_{filePath}, format_{format}, shardSize_(shardSize) {
+    // read before the new export replaces the manifest
+    QFile previousManifest(shardManifestPath(filePath_));
+    if (previousManifest.open(QIODevice::ReadOnly)) {
+      for (const auto& shard : QJsonDocument::fromJson(
+                                   previousManifest.readAll())
+                                   .object()["shards"]
+                                   .toArray()) {
+        previousShards_ << shard.toObject()["file"].toString();
+      }
+    }
+  }
+
+  QString currentShardPath() const {
+    return shardFilePath(filePath_, shardIndex_);
+  }
+
+  /// Start a new shard if the current one is full; called before adding a
+  /// document.
+  void prepareNextDocument(DocsWriter& writer) {
+    if (nDocsInShard_ != 0 && isShardFull(writer)) {
+      writer.writeSuffix();
+      addShard(writer.nBytesWritten());
+      ++shardIndex_;
+      if (!writer.startNewFile(currentShardPath()) || !writeManifest(false)) {
+        hasError_ = true;
+      }
+      writer.writePrefix();
+    }
+    ++nDocsInShard_;
+  }
+
+  /// Add the last shard to the manifest, once its suffix has been written and
+  /// it has been closed; false if the manifest cannot be written
+  bool finish(qint64 nBytesWritten) {
+    addShard(nBytesWritten);
+    if (!writeManifest(true)) {
+      return false;
+    }
+    removeStaleShards();
+    return !hasError_;
+  }
+
+  bool hasError() const { return hasError_; }
+
+private:
+  bool isShardFull(const DocsWriter& writer) const {
+    return (shardSize_.nDocs > 0 && nDocsInShard_ >= shardSize_.nDocs) ||
+           (shardSize_.nBytes > 0 &&
+            writer.nBytesWritten() - shardStartByte_ >= shardSize_.nBytes);
+  }
+
+  void addShard(qint64 endByte) {
+    QJsonObject shard{};
+    shard["file"] = QFileInfo(currentShardPath()).fileName();
+    shard["n_docs"] = nDocsInShard_;
+    shard["first_doc"] = nDocs_;
+    shard["start_byte"] = shardStartByte_;
+    shard["end_byte"] = endByte;
+    shard["n_bytes"] = endByte - shardStartByte_;
+    shards_.append(shard);
+    nDocs_ += nDocsInShard_;
+    nDocsInShard_ = 0;
+    shardStartByte_ = endByte;
+  }
+
+  bool writeManifest(bool complete) const {
+    QJsonObject manifest{};
+    manifest["format"] = format_;
+    manifest["complete"] = complete;
+    manifest["n_docs"] = nDocs_;
+    manifest["shards"] = shards_;
+    // replaced atomically, so a reader never sees a partial manifest
+    QSaveFile file(shardManifestPath(filePath_));
+    if (!file.open(QIODevice::WriteOnly)) {
+      return false;
+    }
+    file.write(QJsonDocument(manifest).toJson());
+    return file.commit();
+  }
+
+  /// Remove the shards listed by the previous manifest that the new one does
+  /// not list; other files in the directory are left alone
+  void removeStaleShards() const {
+    QSet<QString> currentShards{};
+    for (const auto& shard : shards_) {
+      currentShards << shard.toObject()["file"].toString();
+    }
+    auto dir = QFileInfo(filePath_).absoluteDir();
+    for (const auto& fileName : previousShards_) {
+      // only names in the manifest's directory, as the export writes them
+      if (fileName.isEmpty() || QFileInfo(fileName).fileName() != fileName ||
+          currentShards.contains(fileName)) {
+        continue;
+      }
+      dir.remove(fileName);
+    }
+  }
+
+  QString filePath_;
+  QString format_;
+  ExportShardSize shardSize_;
+  QJsonArray shards_{};
+  /// the files listed by the manifest found when the export started
+  QStringList previousShards_{};
+  int shardIndex_{1};
+  int nDocsInShard_{};
+  qint64 nDocs_{};
+  qint64 shardStartByte_{};
+  bool hasError_{};
+};
+
+/// Reads the annotations of exported documents with a single query ordered by
+/// document, in step with the (also ordered) query that reads the documents.
+class ExportedAnnotationsCursor {
+
+public:
+  /// `docsFilter` restricts the documents whose annotations are read, eg
+  /// "where doc_id in (...)"
+  ExportedAnnotationsCursor(const QString& databaseName,
+                            const QString& docsFilter)
+      : query_(QSqlDatabase::database(databaseName)) {
+    // label names are looked up in memory rather than with a join, so the
+    // annotations are read in the order of the doc_id index without sorting
+    query_.exec("select id, name from label;");
+    while (query_.next()) {
+      labelNames_.insert(query_.value(0).toInt(), query_.value(1).toString());
+    }
+    query_.setForwardOnly(true);
+    query_.exec(QString("select doc_id, label_id, start_char, end_char, "
+                        "extra_data from annotation %0 order by doc_id, rowid;")
+                    .arg(docsFilter));
+    hasRow_ = query_.next();
+  }
+
+  /// The annotations of `docId`, which must be greater than the ids passed
+  /// to previous calls. Their UTF-8 positions are not set.
+  QList<Annotation> takeAnnotations(int docId) {
+    QList<Annotation> annotations{};
+    while (hasRow_) {
+      auto rowDocId = query_.value(0).toInt();
+      if (rowDocId > docId) {
+        break;
+      }
+      if (rowDocId == docId) {
+        annotations << Annotation{query_.value(2).toInt(),
+                                  query_.value(3).toInt(),
+                                  labelNames_.value(query_.value(1).toInt()),
+                                  query_.value(4).toString(),
+                                  Annotation::nullIndex,
+                                  Annotation::nullIndex};
+      }
+      hasRow_ = query_.next();
+    }
+    return annotations;
+  }
+
+private:
+  QSqlQuery query_;
+  QHash<int, QString> labelNames_{};
+  bool hasRow_{};
+};
+
+/// Set the UTF-8 positions of annotations from their Unicode positions.
+void setUtf8Positions(QList<Annotation>& annotations,
+                      const Utf8OffsetIndex& utf8Index) {
+  std::vector<int> unicodeIndices{};
+  unicodeIndices.reserve(2 * static_cast<std::size_t>(annotations.size()));
+  for (const auto& annotation : annotations) {
+    unicodeIndices.push_back(annotation.startChar);
+    unicodeIndices.push_back(annotation.endChar);
+  }
+  auto utf8Indices = convertUnsortedIndices(
+      unicodeIndices, [&utf8Index](const std::vector<int>& sorted) {
+        return utf8Index.unicodeToUtf8Sorted(sorted);
+      });
+  std::size_t i{};
+  for (auto& annotation : annotations) {
+    annotation.startByte = utf8Indices[i++];
+    annotation.endByte = utf8Indices[i++];
+  }
+}
+
+/// A document read from the database, before it is serialized
+struct ExportedDoc {
+  QString md5;
+  /// as stored in the database; empty unless the text is exported, or the
+  /// annotations are exported and the document has no stored UTF-8 index
+  QByteArray contentUtf8;
+  QByteArray metadata;
+  /// the stored `Utf8OffsetIndex`, if the annotations are exported
+  QByteArray utf8Index;
+  /// their UTF-8 positions are not set yet
+  QList<Annotation> annotations;
+  QString displayTitle;
+  QString listTitle;
+};
+
+/// Documents serialized together by a worker thread during an export
+constexpr int exportBatchSize = 256;
+
+/// Compute the UTF-8 positions and serialize a document into `output`.
+
+/// The positions are computed from the stored UTF-8 index, or if the document
+/// has none from an index of its text, which is not decoded. This only reads
+/// `writer`, so it can run on several threads at once.
+void serializeExportedDoc(const DocsWriter& writer, ExportedDoc& doc,
+                          QByteArray& output) {
+  if (!doc.annotations.isEmpty()) {
+    Utf8OffsetIndex utf8Index{};
+    if (doc.utf8Index.isEmpty() || !utf8Index.fromBytes(doc.utf8Index)) {
+      utf8Index.setText(doc.contentUtf8);
+    }
+    setUtf8Positions(doc.annotations, utf8Index);
+  }
+  writer.serializeDocument(doc.md5, doc.contentUtf8, doc.metadata,
+                           doc.annotations, doc.displayTitle, doc.listTitle,
+                           output);
+}
+
+} // namespace
+
 ExportDocsResult
 DatabaseCatalog::exportDocuments(const QString& filePath, bool labelledDocsOnly,
                                  bool includeText, bool includeAnnotations,
-                                 QProgressDialog* progress) const {
-  auto writer = getDocsWriter(filePath, includeText, includeAnnotations);
+                                 QProgressDialog* progress,
+                                 const QString& format, int nThreads,
+                                 const ExportShardSize& shardSize,
+                                 qint64 changedSince) const {
+  std::unique_ptr<ExportShards> shards{};
+  if (shardSize.isSharded() && !isStandardStream(filePath)) {
+    shards.reset(new ExportShards(
+        filePath, exportedDocsFormat(filePath, format), shardSize));
+  }
+  auto writer = getDocsWriter(
+      shards != nullptr ? shards->currentShardPath() : filePath, includeText,
+      includeAnnotations, format);
   if (!writer->isOpen()) {
     return {0, 0, ErrorCode::FileSystemError, QString("Could not open file.")};
   }
 
-  QSqlQuery query(QSqlDatabase::database(currentDatabase_));
-  int totalNDocs{};
-  if (labelledDocsOnly) {
-    query.exec("select count(*) from labelled_document;");
-    query.next();
-    totalNDocs = query.value(0).toInt();
-    query.exec("select id from labelled_document order by id;");
-  } else {
-    query.exec("select count(*) from document;");
-    query.next();
-    totalNDocs = query.value(0).toInt();
-    query.exec("select id from document order by id;");
-  }
+  // a changed document is exported even if it has no annotations left, so
+  // that removing them is exported too
+  auto table = labelledDocsOnly && changedSince < 0
+                   ? QString("labelled_document")
+                   : QString("document");
+  // the ids of changed documents are found with the change_id (rowid) of
+  // document_change, and the documents and annotations with their indexes, so
+  // an incremental export only reads the changed documents. a document that
+  // was deleted and imported again is exported as a changed document rather
+  // than as deleted.
+  auto changedDocIds =
+      changedSince < 0
+          ? QString()
+          : QString("in (select doc_id from document_change where change_id "
+                    "> %0 and deleted = 0 union select id from document where "
+                    "content_md5 in (select content_md5 from document_change "
+                    "where change_id > %0 and deleted = 1))")
+                .arg(changedSince);
+  auto docsFilter =
+      changedSince < 0 ? QString() : QString("where id %0").arg(changedDocIds);
+  QSqlQuery docsQuery(QSqlDatabase::database(currentDatabase_));
+  docsQuery.exec(
+      QString("select count(*) from %0 %1;").arg(table).arg(docsFilter));
+  docsQuery.next();
+  auto totalNDocs = docsQuery.value(0).toInt();
   if (progress != nullptr) {
     progress->setMaximum(totalNDocs + 1);
   }
 
+  // documents and their annotations are read in a single pass over two
+  // queries ordered by document id, rather than with 2 queries per document.
+  // the content is read as the UTF-8 that SQLite stores, rather than
+  // converted by SQLite to the UTF-16 used by QString, and only if it is
+  // needed: the UTF-8 positions of annotations are computed from the stored
+  // UTF-8 index, so exporting annotations without the text does not read the
+  // text of documents that have one. in a database that does not store
+  // UTF-8 the content is read as text, and QVariant::toByteArray encodes it.
+  auto content = utf8Database_ ? QString("cast(content as blob)")
+                               : QString("content");
+  QString contentColumn{"null"};
+  if (includeText) {
+    contentColumn = content;
+  } else if (includeAnnotations) {
+    contentColumn =
+        QString("case when utf8_index.runs is null then %0 end").arg(content);
+  }
+  docsQuery.setForwardOnly(true);
+  docsQuery.exec(
+      QString("select id, lower(hex(content_md5)), %0, metadata, "
+              "display_title, list_title, %1 from %2 %3 %4 order by id;")
+          .arg(contentColumn,
+               includeAnnotations ? "utf8_index.runs" : "null", table,
+               includeAnnotations
+                   ? "left join document_utf8_index as utf8_index on "
+                     "utf8_index.doc_id = id"
+                   : "",
+               docsFilter));
+  std::unique_ptr<ExportedAnnotationsCursor> annotationsCursor{};
+  if (includeAnnotations) {
+    annotationsCursor.reset(new ExportedAnnotationsCursor(
+        currentDatabase_, changedSince < 0
+                              ? QString()
+                              : QString("where doc_id %0").arg(changedDocIds)));
+  }
+
   int nDocs{};
   int nAnnotations{};
+  ProgressReporter reporter("export");
+  // with several threads, this thread reads the database and writes the
+  // output while batches of documents are serialized by the workers; the
+  // results are written in document order so the output is the same
+  std::unique_ptr<OrderedTaskQueue<std::vector<QByteArray>>> queue{};
+  if (nThreads > 1) {
+    queue.reset(
+        new OrderedTaskQueue<std::vector<QByteArray>>(nThreads, 2 * nThreads));
+  }
+  auto addToOutput = [&writer, &shards](const QByteArray& serialized) {
+    if (shards != nullptr) {
+      shards->prepareNextDocument(*writer);
+    }
+    writer->addSerializedDocument(serialized);
+  };
+  auto writeNextBatch = [&queue, &addToOutput]() -> bool {
+    std::vector<QByteArray> serializedDocs{};
+    if (!queue->takeNext(serializedDocs)) {
+      return false;
+    }
+    for (const auto& serialized : serializedDocs) {
+      addToOutput(serialized);
+    }
+    return true;
+  };
+  const DocsWriter* constWriter = writer.get();
+  auto submitBatch =
+      [&queue, &writeNextBatch,
+       constWriter](std::shared_ptr<std::vector<ExportedDoc>> batch) {
+        if (queue->isFull()) {
+          writeNextBatch();
+        }
+        queue->submit([constWriter, batch]() -> std::vector<QByteArray> {
+          std::vector<QByteArray> serializedDocs{};
+          for (auto& doc : *batch) {
+            QByteArray serialized{};
+            serializeExportedDoc(*constWriter, doc, serialized);
+            serializedDocs.push_back(std::move(serialized));
+          }
+          return serializedDocs;
+        });
+      };
+  std::shared_ptr<std::vector<ExportedDoc>> batch(
+      new std::vector<ExportedDoc>);
+  // reused for each document when serializing on this thread; a reserved
+  // QByteArray keeps its capacity when it is resized to 0
+  QByteArray buffer{};
+  buffer.reserve(1 << 16);
   writer->writePrefix();
-  std::cout << std::endl;
-  while (query.next()) {
-    if (progress != nullptr && progress->wasCanceled()) {
+  if (changedSince >= 0) {
+    // markers of the deleted documents, written before the changed ones
+    QSqlQuery deletedQuery(QSqlDatabase::database(currentDatabase_));
+    deletedQuery.exec(
+        QString("select distinct lower(hex(content_md5)) from document_change "
+                "where change_id > %0 and deleted = 1 and content_md5 not in "
+                "(select content_md5 from document);")
+            .arg(changedSince));
+    while (deletedQuery.next()) {
+      buffer.resize(0);
+      writer->serializeDeletedDocument(deletedQuery.value(0).toString(),
+                                       buffer);
+      addToOutput(buffer);
+    }
+  }
+  while (docsQuery.next()) {
+    if ((progress != nullptr && progress->wasCanceled()) ||
+        (shards != nullptr && shards->hasError())) {
       break;
     }
     ++nDocs;
-    auto docId = query.value(0).toInt();
-    nAnnotations += writeDoc(*writer, docId, includeText, includeAnnotations);
+    ExportedDoc doc{docsQuery.value(1).toString(),
+                    docsQuery.value(2).toByteArray(),
+                    docsQuery.value(3).toByteArray(),
+                    docsQuery.value(6).toByteArray(),
+                    {},
+                    docsQuery.value(4).toString(),
+                    docsQuery.value(5).toString()};
+    if (includeAnnotations) {
+      doc.annotations =
+          annotationsCursor->takeAnnotations(docsQuery.value(0).toInt());
+      nAnnotations += doc.annotations.size();
+    }
+    if (queue == nullptr) {
+      buffer.resize(0);
+      serializeExportedDoc(*writer, doc, buffer);
+      addToOutput(buffer);
+    } else {
+      batch->push_back(std::move(doc));
+      if (static_cast<int>(batch->size()) == exportBatchSize) {
+        submitBatch(batch);
+        batch.reset(new std::vector<ExportedDoc>);
+      }
+    }
     if (progress != nullptr) {
       progress->setValue(nDocs);
     }
-    std::cout << "Exported " << nDocs << " documents.\r" << std::flush;
+    if (reporter.isDue()) {
+      reporter.report(nDocs, writer->nBytesWritten(),
+                      static_cast<double>(nDocs) /
+                          static_cast<double>(totalNDocs));
+    }
+  }
+  if (queue != nullptr) {
+    if (!batch->empty()) {
+      submitBatch(batch);
+    }
+    queue->close();
+    while (writeNextBatch()) {
+    }
   }
-  std::cout << std::endl;
   writer->writeSuffix();
+  auto nBytesWritten = writer->nBytesWritten();
+  // close the last file before the manifest lists it
+  auto written = writer->close();
+  writer.reset();
+  reporter.finish(nDocs, nBytesWritten);
   if (progress != nullptr) {
     progress->setValue(progress->maximum());
   }
+  if (!written) {
+    // the manifest of a sharded export is left incomplete
+    return {nDocs, nAnnotations, ErrorCode::FileSystemError,
+            QString("Could not write file.")};
+  }
+  if (shards != nullptr && !shards->finish(nBytesWritten)) {
+    return {nDocs, nAnnotations, ErrorCode::FileSystemError,
+            QString("Could not write all the shards and their manifest.")};
+  }
   return {nDocs, nAnnotations, ErrorCode::NoError, ""};
 }
 
-int DatabaseCatalog::writeDoc(DocsWriter& writer, int docId, bool includeText,
-                              bool includeAnnotations) const {
-  assert(includeText == writer.isIncludingText());
-  assert(includeAnnotations == writer.isIncludingAnnotations());
-
-  QSqlQuery docQuery(QSqlDatabase::database(currentDatabase_));
-  docQuery.prepare("select lower(hex(content_md5)) as md5, content, "
-                   "metadata, display_title, list_title "
-                   "from document where id = :doc;");
-  docQuery.bindValue(":doc", docId);
-  docQuery.exec();
-  docQuery.next();
-  auto metadata =
-      QJsonDocument::fromJson(docQuery.value("metadata").toByteArray())
-          .object();
-  auto content = docQuery.value("content").toString();
-  QList<Annotation> annotations{};
-  if (includeAnnotations) {
-    annotations = getDocAnnotations(docId, content);
-  }
-  writer.addDocument(docQuery.value("md5").toString(), content, metadata,
-                     annotations, docQuery.value("display_title").toString(),
-                     docQuery.value("list_title").toString());
-  return annotations.size();
-}
-
-QList<Annotation>
-DatabaseCatalog::getDocAnnotations(int docId, const QString& content) const {
-  QSqlQuery annotationsQuery(QSqlDatabase::database(currentDatabase_));
-  annotationsQuery.prepare(
-      "select label.name as label_name, start_char, end_char, extra_data "
-      "from annotation inner join label on annotation.label_id = label.id "
-      "where annotation.doc_id = :doc order by annotation.rowid;");
-  annotationsQuery.bindValue(":doc", docId);
-  annotationsQuery.exec();
-
-  QList<Annotation> annotations{};
-  QList<int> unicodeIndices{};
-  while (annotationsQuery.next()) {
-    annotations << Annotation{annotationsQuery.value("start_char").toInt(),
-                              annotationsQuery.value("end_char").toInt(),
-                              annotationsQuery.value("label_name").toString(),
-                              annotationsQuery.value("extra_data").toString(),
-                              Annotation::nullIndex,
-                              Annotation::nullIndex};
-    unicodeIndices << annotationsQuery.value("start_char").toInt()
-                   << annotationsQuery.value("end_char").toInt();
-  }
-  if (annotations.size()) {
-    auto unicodeToUtf8 = CharIndices(content).unicodeToUtf8(
-        unicodeIndices.cbegin(), unicodeIndices.cend());
-    for (auto& anno : annotations) {
-      anno.startByte = unicodeToUtf8[anno.startChar];
-      anno.endByte = unicodeToUtf8[anno.endChar];
-    }
-  }
-  return annotations;
-}
-
 ExportLabelsResult
 DatabaseCatalog::exportLabels(const QString& filePath) const {
   QJsonArray labels{};
@@ -941,11 +2294,92 @@ ExportLabelsResult writeLabelsToJsonLines(const QJsonArray& labels,
   return {labels.size(), ErrorCode::NoError, ""};
 }
 
+namespace {
+
+/// Print the number of documents imported from each file and the throughput.
+
+/// The throughput is in documents read per second, as documents that are
+/// skipped (eg already in the database) also take time to read and check.
+void printImportSummary(const QList<ImportDocsFileResult>& fileResults) {
+  std::cout << "\nImported files:\n";
+  int totalRead{};
+  int totalDocs{};
+  int totalAnnotations{};
+  qint64 totalMs{};
+  auto printRow = [](const QString& name, int nRead, int nDocs,
+                     int nAnnotations, qint64 elapsedMs,
+                     const QString& status) {
+    std::cout << name.toStdString() << ": " << nRead << " documents read, "
+              << nDocs << " inserted, " << nAnnotations << " annotations, "
+              << static_cast<double>(elapsedMs) / 1000. << " s, "
+              << static_cast<int>(nRead * 1000. /
+                                  static_cast<double>(std::max(
+                                      elapsedMs, static_cast<qint64>(1))))
+              << " docs/s" << status.toStdString() << "\n";
+  };
+  for (const auto& fileRes : fileResults) {
+    totalRead += fileRes.result.nDocsRead;
+    totalDocs += fileRes.result.nDocs;
+    totalAnnotations += fileRes.result.nAnnotations;
+    totalMs += fileRes.elapsedMs;
+    printRow(fileRes.filePath, fileRes.result.nDocsRead, fileRes.result.nDocs,
+             fileRes.result.nAnnotations, fileRes.elapsedMs,
+             fileRes.result.errorCode == ErrorCode::NoError
+                 ? QString()
+                 : QString(" (error: %0)").arg(fileRes.result.errorMessage));
+  }
+  printRow("Total", totalRead, totalDocs, totalAnnotations, totalMs,
+           QString());
+  std::cout << std::flush;
+}
+
+/// Error message if documents cannot be imported from the standard input or
+/// exported to the standard output in `format`, empty otherwise
+QString streamFormatErrorMessage(const QString& format,
+                                 DatabaseCatalog::Action action) {
+  auto accepted =
+      acceptedAndDefaultFormats(action, DatabaseCatalog::ItemKind::Document)
+          .first;
+  if (accepted.contains(format)) {
+    return QString();
+  }
+  auto isImport = action == DatabaseCatalog::Action::Import;
+  return QString("%0 documents: '-' (standard %1) requires --format with one "
+                 "of: { %2 }.")
+      .arg(isImport ? "Import" : "Export")
+      .arg(isImport ? "input" : "output")
+      .arg(accepted.join(", "));
+}
+
+/// Sends what is printed to `std::cout` to `std::cerr` while it exists, so
+/// that the standard output only contains the exported documents
+class CoutToCerr {
+public:
+  CoutToCerr() : coutBuffer_{std::cout.rdbuf(std::cerr.rdbuf())} {}
+  ~CoutToCerr() { std::cout.rdbuf(coutBuffer_); }
+
+  CoutToCerr(const CoutToCerr&) = delete;
+  CoutToCerr& operator=(const CoutToCerr&) = delete;
+
+private:
+  std::streambuf* coutBuffer_;
+};
+
+} // namespace
+
 int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
                       const QList<QString>& docsFiles,
                       const QString& exportLabelsFile,
                       const QString& exportDocsFile, bool labelledDocsOnly,
-                      bool includeText, bool includeAnnotations, bool vacuum) {
+                      bool includeText, bool includeAnnotations, bool vacuum,
+                      const ImportDocsOptions& importOptions,
+                      const QString& exportDocsFormat,
+                      const ExportShardSize& exportShardSize,
+                      qint64 exportSince) {
+  std::unique_ptr<CoutToCerr> coutToCerr{};
+  if (isStandardStream(exportDocsFile)) {
+    coutToCerr.reset(new CoutToCerr);
+  }
   DatabaseCatalog catalog{};
   if (!catalog.openDatabase(dbPath, false)) {
     std::cerr << "Could not open database: " << dbPath.toStdString()
@@ -958,7 +2392,10 @@ int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
   }
   int errors{};
   QString errorMsg{};
-  for (const auto& lFile : labelsFiles) {
+  // a dry run does not write anything to the database
+  const auto& importedLabelsFiles =
+      importOptions.dryRun ? QList<QString>() : labelsFiles;
+  for (const auto& lFile : importedLabelsFiles) {
     errorMsg = DatabaseCatalog::fileExtensionErrorMessage(
         lFile, DatabaseCatalog::Action::Import,
         DatabaseCatalog::ItemKind::Label, false);
@@ -972,20 +2409,30 @@ int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
       std::cerr << errorMsg.toStdString() << std::endl;
     }
   }
+  QStringList validDocsFiles{};
   for (const auto& dFile : docsFiles) {
-    errorMsg = DatabaseCatalog::fileExtensionErrorMessage(
-        dFile, DatabaseCatalog::Action::Import,
-        DatabaseCatalog::ItemKind::Document, false);
+    errorMsg = isStandardStream(dFile)
+                   ? streamFormatErrorMessage(importOptions.stdinFormat,
+                                              DatabaseCatalog::Action::Import)
+                   : DatabaseCatalog::fileExtensionErrorMessage(
+                         dFile, DatabaseCatalog::Action::Import,
+                         DatabaseCatalog::ItemKind::Document, false);
     if (errorMsg == QString()) {
-      auto res = catalog.importDocuments(dFile);
-      if (res.errorCode != ErrorCode::NoError) {
-        errors = 1;
-      }
+      validDocsFiles << dFile;
     } else {
       errors = 1;
       std::cerr << errorMsg.toStdString() << std::endl;
     }
   }
+  auto fileResults = catalog.importDocumentFiles(validDocsFiles, importOptions);
+  for (const auto& fileRes : fileResults) {
+    if (fileRes.result.errorCode != ErrorCode::NoError) {
+      errors = 1;
+    }
+  }
+  if (fileResults.size() > 1) {
+    printImportSummary(fileResults);
+  }
   if (exportLabelsFile != QString()) {
     errorMsg = DatabaseCatalog::fileExtensionErrorMessage(
         exportLabelsFile, DatabaseCatalog::Action::Export,
@@ -1000,6 +2447,30 @@ int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
     }
   }
   if (exportDocsFile != QString()) {
+    // changes made after this are exported by --export-since with this value
+    std::cout << "Export watermark: " << catalog.getChangeWatermark()
+              << std::endl;
+  }
+  if (isStandardStream(exportDocsFile)) {
+    errorMsg = streamFormatErrorMessage(exportDocsFormat,
+                                        DatabaseCatalog::Action::Export);
+    if (errorMsg == QString() && exportShardSize.isSharded()) {
+      errorMsg = "Export documents: '-' (standard output) cannot be split in "
+                 "shards with --export-shard-size.";
+    }
+    if (errorMsg == QString()) {
+      auto res = catalog.exportDocuments(
+          exportDocsFile, labelledDocsOnly, includeText, includeAnnotations,
+          nullptr, exportDocsFormat, importOptions.nThreads, ExportShardSize(),
+          exportSince);
+      if (res.errorCode != ErrorCode::NoError) {
+        errors = 1;
+      }
+    } else {
+      errors = 1;
+      std::cerr << errorMsg.toStdString() << std::endl;
+    }
+  } else if (exportDocsFile != QString()) {
     errorMsg = DatabaseCatalog::fileExtensionErrorMessage(
         exportDocsFile, DatabaseCatalog::Action::Export,
         DatabaseCatalog::ItemKind::Document, true);
@@ -1007,8 +2478,11 @@ int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
       std::cerr << errorMsg.toStdString() << std::endl;
       // still exported, so don't count it as an error
     }
-    auto res = catalog.exportDocuments(exportDocsFile, labelledDocsOnly,
-                                       includeText, includeAnnotations);
+    // --threads is used for the export too
+    auto res = catalog.exportDocuments(
+        exportDocsFile, labelledDocsOnly, includeText, includeAnnotations,
+        nullptr, QString(), importOptions.nThreads, exportShardSize,
+        exportSince);
     if (res.errorCode != ErrorCode::NoError) {
       errors = 1;
     }
@@ -1016,6 +2490,15 @@ int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
   return errors;
 }
 
+qint64 DatabaseCatalog::getChangeWatermark() const {
+  QSqlQuery query(QSqlDatabase::database(currentDatabase_));
+  query.exec("select seq from sqlite_sequence where name = 'document_change';");
+  if (!query.next()) {
+    return 0;
+  }
+  return query.value(0).toLongLong();
+}
+
 void DatabaseCatalog::vacuumDb() const {
   QSqlQuery query(QSqlDatabase::database(currentDatabase_));
   query.exec("VACUUM;");
@@ -1052,7 +2535,17 @@ bool DatabaseCatalog::initializeDatabase(QSqlDatabase& database) {
             QString("PRAGMA application_id = %1;").arg(sqliteApplicationId_))) {
       return false;
     }
-    return (query.exec("PRAGMA foreign_keys = ON;"));
+    if (!query.exec("PRAGMA foreign_keys = ON;")) {
+      return false;
+    }
+    // databases created before documents changes were tracked, or before the
+    // UTF-8 indexes were stored
+    query.exec("BEGIN TRANSACTION;");
+    if (!(createChangeTracking(query) && createUtf8IndexTable(query))) {
+      query.exec("ROLLBACK;");
+      return false;
+    }
+    return query.exec("COMMIT;");
   }
   if (!query.exec("PRAGMA foreign_keys = ON;")) {
     return false;
@@ -1060,6 +2553,67 @@ bool DatabaseCatalog::initializeDatabase(QSqlDatabase& database) {
   return createTables(query);
 }
 
+const QList<SecondaryIndex>& secondaryIndexes() {
+  static const QList<SecondaryIndex> indexes{
+      // for some reason the auto index created for the primary key is not
+      // treated as a covering index in 'count(*) from document where id < xxx'
+      // but this is:
+      {"document_id_idx",
+       "CREATE INDEX IF NOT EXISTS document_id_idx ON document(id);"},
+      {"annotation_doc_id_idx", "CREATE INDEX IF NOT EXISTS "
+                                "annotation_doc_id_idx ON annotation(doc_id);"},
+      {"annotation_label_id_idx",
+       "CREATE INDEX IF NOT EXISTS annotation_label_id_idx ON "
+       "annotation(label_id);"}};
+  return indexes;
+}
+
+bool isUtf8Database(const QString& databaseName) {
+  QSqlQuery query(QSqlDatabase::database(databaseName));
+  if (!query.exec("PRAGMA encoding;") || !query.next()) {
+    return false;
+  }
+  return query.value(0).toString() == "UTF-8";
+}
+
+const QList<ChangeTrigger>& changeTriggers() {
+  static const QList<ChangeTrigger> triggers{
+      {"annotation_insert_change",
+       "CREATE TRIGGER IF NOT EXISTS annotation_insert_change AFTER INSERT ON "
+       "annotation BEGIN INSERT OR REPLACE INTO document_change (doc_id) "
+       "VALUES (new.doc_id); END;"},
+      {"annotation_update_change",
+       "CREATE TRIGGER IF NOT EXISTS annotation_update_change AFTER UPDATE ON "
+       "annotation BEGIN INSERT OR REPLACE INTO document_change (doc_id) "
+       "VALUES (old.doc_id); INSERT OR REPLACE INTO document_change (doc_id) "
+       "VALUES (new.doc_id); END;"},
+      // also when annotations are deleted by deleting their label
+      {"annotation_delete_change",
+       "CREATE TRIGGER IF NOT EXISTS annotation_delete_change AFTER DELETE ON "
+       "annotation BEGIN INSERT OR REPLACE INTO document_change (doc_id) "
+       "VALUES (old.doc_id); END;"},
+      // the label names are in the exported annotations
+      {"label_rename_change",
+       "CREATE TRIGGER IF NOT EXISTS label_rename_change AFTER UPDATE OF name "
+       "ON label BEGIN INSERT OR REPLACE INTO document_change (doc_id) SELECT "
+       "DISTINCT doc_id FROM annotation WHERE label_id = new.id; END;"},
+      {"document_update_change",
+       "CREATE TRIGGER IF NOT EXISTS document_update_change AFTER UPDATE OF "
+       "metadata, display_title, list_title ON document BEGIN INSERT OR "
+       "REPLACE INTO document_change (doc_id) VALUES (new.id); END;"},
+      // runs after its annotations have been deleted (and recorded) by the
+      // foreign key cascade. the row of the document is replaced by a
+      // tombstone, which keeps its checksum so the deletion can be exported
+      {"document_delete_change",
+       "CREATE TRIGGER IF NOT EXISTS document_delete_change AFTER DELETE ON "
+       "document BEGIN DELETE FROM document_change WHERE doc_id = old.id AND "
+       "deleted = 0; INSERT INTO document_change (doc_id, deleted, "
+       "content_md5) VALUES (old.id, 1, old.content_md5); END;"}};
+  return triggers;
+}
+
+const ChangeTrigger& annotationInsertTrigger() { return changeTriggers()[0]; }
+
 bool DatabaseCatalog::createTables(QSqlQuery& query) {
   query.exec("BEGIN TRANSACTION;");
   bool success{true};
@@ -1079,12 +2633,6 @@ bool DatabaseCatalog::createTables(QSqlQuery& query) {
           "content TEXT NOT NULL, metadata BLOB, "
           "list_title TEXT DEFAULT NULL, display_title TEXT DEFAULT NULL, "
           "CHECK (content != ''), CHECK (length(content_md5 = 128)));");
-  // for some reason the auto index created for the primary key is not treated
-  // as a covering index in 'count(*) from document where id < xxx' but this is:
-  success =
-      success && query.exec("CREATE INDEX IF NOT EXISTS document_id_idx ON "
-                            "document(id);");
-
   success = success &&
             query.exec(
                 "CREATE TABLE IF NOT EXISTS label(id INTEGER PRIMARY KEY, name "
@@ -1112,13 +2660,13 @@ bool DatabaseCatalog::createTables(QSqlQuery& query) {
   // annotations are created within labelbuddy because they come from a Qt
   // cursor position.
 
-  success = success &&
-            query.exec(" CREATE INDEX IF NOT EXISTS annotation_doc_id_idx ON "
-                       "annotation(doc_id);");
+  for (const auto& index : secondaryIndexes()) {
+    success = success && query.exec(index.createStatement);
+  }
 
-  success = success &&
-            query.exec("CREATE INDEX IF NOT EXISTS annotation_label_id_idx ON "
-                       "annotation(label_id);");
+  success = success && createChangeTracking(query);
+
+  success = success && createUtf8IndexTable(query);
 
   success =
       success &&
@@ -1173,4 +2721,45 @@ bool DatabaseCatalog::createTables(QSqlQuery& query) {
   return false;
 }
 
+bool DatabaseCatalog::createChangeTracking(QSqlQuery& query) {
+  query.exec("SELECT count(*) FROM sqlite_master WHERE type = 'table' AND "
+             "name = 'document_change';");
+  query.next();
+  bool exists = query.value(0).toInt() != 0;
+  bool success{true};
+  if (!exists) {
+    // a document has one row, replaced with a new change_id each time it
+    // changes, and deleted documents have a tombstone (deleted = 1) holding
+    // their checksum. AUTOINCREMENT ensures change ids are never reused, even
+    // after the row with the largest one is deleted.
+    success = success &&
+              query.exec("CREATE TABLE document_change (change_id INTEGER "
+                         "PRIMARY KEY AUTOINCREMENT, doc_id INTEGER NOT NULL, "
+                         "deleted INTEGER NOT NULL DEFAULT 0, content_md5 "
+                         "BLOB DEFAULT NULL);");
+    // the ids of deleted documents can be reused, so only the rows of
+    // existing documents are unique
+    success = success && query.exec("CREATE UNIQUE INDEX "
+                                    "document_change_doc_id_idx ON "
+                                    "document_change (doc_id) WHERE deleted "
+                                    "= 0;");
+    // annotations created before the changes were tracked
+    success =
+        success &&
+        query.exec("INSERT INTO document_change (doc_id) SELECT DISTINCT "
+                   "doc_id FROM annotation ORDER BY doc_id;");
+  }
+  for (const auto& trigger : changeTriggers()) {
+    success = success && query.exec(trigger.createStatement);
+  }
+  return success;
+}
+
+bool DatabaseCatalog::createUtf8IndexTable(QSqlQuery& query) {
+  // the content of a document never changes, so neither does its index
+  return query.exec("CREATE TABLE IF NOT EXISTS document_utf8_index (doc_id "
+                    "INTEGER PRIMARY KEY REFERENCES document(id) ON DELETE "
+                    "CASCADE, runs BLOB NOT NULL);");
+}
+
 } // namespace labelbuddy
@@ -5,12 +5,14 @@
 
 #include <QByteArray>
 #include <QFile>
+#include <QJsonObject>
 #include <QMap>
 #include <QObject>
 #include <QProgressDialog>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 
 #include "char_indices.h"
@@ -21,16 +23,105 @@
 namespace labelbuddy {
 
 struct Annotation;
-struct DocRecord;
+class BulkInserter;
+class DocsReader;
 class DocsWriter;
 
 enum class ErrorCode { NoError = 0, CriticalParsingError, FileSystemError };
 
+/// Options for `DatabaseCatalog::importDocuments`
+struct ImportDocsOptions {
+  /// Number of threads used to parse documents.
+
+  /// With 1 thread everything happens in the calling thread. Otherwise
+  /// documents are parsed by that many worker threads while the calling thread
+  /// inserts them in the database, in the same order.
+  int nThreads{1};
+
+  /// Tune the database for a large import (see `BulkLoadGuard`).
+
+  /// Secondary indexes are dropped and rebuilt after the import, and durability
+  /// is relaxed while it runs. The normal settings are restored afterwards,
+  /// even if the import fails.
+  bool bulkLoad{false};
+
+  /// Commit every `batchSize` documents; 0 imports the file in one transaction.
+
+  /// Each batch is a savepoint that is released (committed) together with a
+  /// checkpoint recording how far the file has been read, so that an
+  /// interrupted import keeps the batches already committed and can be
+  /// continued with `resume`.
+  int batchSize{0};
+
+  /// If not empty, invalid documents are skipped and appended to this file
+  /// instead of stopping the import with an error.
+  QString rejectsFile{};
+
+  /// Continue from the checkpoint left by an interrupted import of the same
+  /// file, if there is one.
+
+  /// The import starts from the beginning of the file if its size or
+  /// modification time are not the ones recorded in the checkpoint.
+  bool resume{false};
+
+  /// Format (json, jsonl or txt) of the documents read from the standard
+  /// input, which is used when the file path is "-".
+  QString stdinFormat{};
+
+  /// Read and check the documents without writing to the database.
+
+  /// Invalid documents are counted instead of stopping the import, the other
+  /// ones go through the same checks as in an import, and a report is printed
+  /// with the number of documents and annotations that would be imported or
+  /// dropped (by reason) and the reading and validation throughput.
+  /// Annotations that are already in the database are counted as dropped.
+  /// With `importDocumentFiles`, each file is checked as if the earlier ones
+  /// had been imported. `bulkLoad`, `batchSize` and `rejectsFile` are
+  /// ignored.
+  bool dryRun{false};
+};
+
+/// Maximum size of the files written by a sharded export.
+
+/// If one of the limits is positive, `DatabaseCatalog::exportDocuments` writes
+/// the documents to several files (shards) instead of one, starting a new file
+/// when the current one reaches either limit. Sizes are counted before
+/// compression, and a shard ends after the document that reaches the limit so
+/// it can be slightly larger than `nBytes`.
+struct ExportShardSize {
+  /// Documents per shard, 0 for no limit
+  int nDocs{0};
+
+  /// Bytes per shard, 0 for no limit
+  qint64 nBytes{0};
+
+  bool isSharded() const { return nDocs > 0 || nBytes > 0; }
+};
+
+/// Parse a shard size given as a number of documents (eg "10000") or of
+/// megabytes (eg "100MB").
+
+/// `ok` is set to false if `value` is not a positive size.
+ExportShardSize parseExportShardSize(const QString& value, bool* ok);
+
 struct ImportDocsResult {
   int nDocs;
   int nAnnotations;
   ErrorCode errorCode;
   QString errorMessage;
+
+  /// Documents read from the file by this import, including the invalid
+  /// ones and the ones that were already in the database
+  int nDocsRead;
+};
+
+/// Result of importing one of the files given to `importDocumentFiles`
+struct ImportDocsFileResult {
+  QString filePath;
+  ImportDocsResult result;
+
+  /// Time spent inserting the documents of this file, in milliseconds
+  qint64 elapsedMs;
 };
 
 struct ExportDocsResult {
@@ -104,8 +195,23 @@ public:
   /// Imports documents in .json, .jsonl, or .txt format
 
   /// If `progress` is not `nullptr`, used to display current progress.
-  ImportDocsResult importDocuments(const QString& filePath,
-                                   QProgressDialog* progress = nullptr);
+  ImportDocsResult
+  importDocuments(const QString& filePath, QProgressDialog* progress = nullptr,
+                  const ImportDocsOptions& options = ImportDocsOptions());
+
+  /// Imports several documents files, in order.
+
+  /// Each file is imported as by `importDocuments`, with its own transaction
+  /// (or batches) and result, and an error in one file does not stop the
+  /// import of the next ones. If `options.nThreads` is more than 1, up to
+  /// `nThreads` files are read and parsed at the same time by background
+  /// threads while the documents of the first one are inserted. Documents are
+  /// still inserted by the calling thread in the order of the files, then in
+  /// the order in which they appear in each file. With `options.bulkLoad` the
+  /// database is tuned once for all the files.
+  QList<ImportDocsFileResult>
+  importDocumentFiles(const QStringList& filePaths,
+                      const ImportDocsOptions& options = ImportDocsOptions());
 
   /// Imports labels in .txt or .json format
 
@@ -121,11 +227,37 @@ public:
   /// \param includeAnnotations the annotations are included -- exported docs
   /// will have a `labels` key.
   /// \param progress if not `nullptr`, used to display the export progress
-  ExportDocsResult exportDocuments(const QString& filePath,
-                                   bool labelledDocsOnly = true,
-                                   bool includeText = true,
-                                   bool includeAnnotations = true,
-                                   QProgressDialog* progress = nullptr) const;
+  /// \param format if not empty, the format (json or jsonl) used instead of
+  /// the one given by the file name extension. `filePath` can then be "-" to
+  /// write to the standard output.
+  /// \param nThreads if greater than 1, documents are serialized by this
+  /// number of worker threads while the calling thread reads the database
+  /// and writes the output. The output is the same as with 1 thread.
+  /// \param shardSize if it sets a limit, the documents are written to the
+  /// files given by `shardFilePath` (eg docs-00001.jsonl, docs-00002.jsonl for
+  /// docs.jsonl), and the manifest given by `shardManifestPath` lists them
+  /// with their number of documents and byte ranges. The manifest is updated
+  /// each time a shard is finished, so the shards it lists can be read while
+  /// the export continues. `filePath` itself is not written.
+  /// \param changedSince if not negative, only the documents that changed
+  /// after `getChangeWatermark` returned this value are exported: those whose
+  /// annotations were added, modified or deleted, whose labels were renamed,
+  /// or whose metadata or titles were modified, whether or not they are still
+  /// labelled (`labelledDocsOnly` is ignored). Documents deleted since then
+  /// are exported first as `{"deleted": true, "utf8_text_md5_checksum": ...}`.
+  ExportDocsResult
+  exportDocuments(const QString& filePath, bool labelledDocsOnly = true,
+                  bool includeText = true, bool includeAnnotations = true,
+                  QProgressDialog* progress = nullptr,
+                  const QString& format = QString(), int nThreads = 1,
+                  const ExportShardSize& shardSize = ExportShardSize(),
+                  qint64 changedSince = -1) const;
+
+  /// The position reached in the log of document changes.
+
+  /// Passing it as `changedSince` to a later `exportDocuments` exports the
+  /// documents changed in between. It is 0 for a new database.
+  qint64 getChangeWatermark() const;
 
   /// Exports labels to a .json file.
   ExportLabelsResult exportLabels(const QString& filePath) const;
@@ -174,6 +306,9 @@ private:
 
   QString currentDatabase_;
 
+  /// whether the current database stores text as UTF-8 (`isUtf8Database`)
+  bool utf8Database_{true};
+
   bool storeDbPath(const QString& dbPath) const;
 
   /// whether dbPath is an sqlite file as opposed to temp or in-memory db
@@ -184,26 +319,84 @@ private:
 
   static bool createTables(QSqlQuery& query);
 
-  /// transform to absolute path unless it is the temp db, :memory:, or ""
-  QString absoluteDatabasePath(const QString& databasePath) const;
+  /// Create the `document_change` table and its triggers if they don't exist.
+
+  /// Each time the annotations of a document (or their label names, or the
+  /// document's metadata or titles) change, the document's row in
+  /// `document_change` is replaced with one with a new, larger `change_id`.
+  /// When a document is deleted its row is replaced with a tombstone
+  /// (`deleted` = 1) that keeps its checksum. When the table is added to an
+  /// existing database, all the labelled documents are recorded as changed.
+  static bool createChangeTracking(QSqlQuery& query);
 
-  int insertDocRecord(const DocRecord& record, QSqlQuery& query);
+  /// Create the `document_utf8_index` table if it doesn't exist.
 
-  CharIndices getCharIndices(int docId, QSqlQuery& query) const;
+  /// It holds a `Utf8OffsetIndex` of each document, stored when the document
+  /// is imported, so the UTF-8 positions of annotations can be computed without
+  /// reading the text. Documents imported before the table existed have no
+  /// row and their text is used instead.
+  static bool createUtf8IndexTable(QSqlQuery& query);
 
-  int insertDocAnnotations(int docId, const QList<Annotation>& annotations,
-                           QSqlQuery& query);
+  /// transform to absolute path unless it is the temp db, :memory:, or ""
+  QString absoluteDatabasePath(const QString& databasePath) const;
+
+  /// Number of files read ahead by `importDocumentFiles` is bounded by the
+  /// number of threads, and the documents read ahead in each file by this
+  /// number of batches of `ParallelDocsReader`
+  static constexpr int lookaheadBatches_{32};
+
+  /// Create the reader for an import of `filePath`.
+
+  /// If `options.resume` is set the reader is moved to `checkpoint` and
+  /// `nDocsRead` is set to the number of documents before it, otherwise
+  /// `nDocsRead` is 0.
+  std::unique_ptr<DocsReader> openDocsReader(const QString& filePath,
+                                             const ImportDocsOptions& options,
+                                             const QJsonObject& checkpoint,
+                                             int& nDocsRead) const;
+
+  /// Insert the documents read by `reader`; see `importDocuments`
+
+  /// In a dry run, the documents are checked with `dryRunInserter` if it is
+  /// not `nullptr`, and otherwise with a dry-run inserter created for this
+  /// file only.
+  ImportDocsResult importFromReader(const QString& filePath,
+                                    DocsReader& reader, int nDocsRead,
+                                    QProgressDialog* progress,
+                                    const ImportDocsOptions& options,
+                                    BulkInserter* dryRunInserter = nullptr);
+
+  /// Check the documents read by `reader` with a dry-run `inserter`, without
+  /// inserting them; see `ImportDocsOptions::dryRun`
+
+  /// The caller opens and rolls back the transaction in which `inserter` was
+  /// created.
+  ImportDocsResult dryRunImport(DocsReader& reader, QProgressDialog* progress,
+                                BulkInserter& inserter);
+
+  /// The checkpoint left by an interrupted import, empty if there is none
+  QJsonObject getImportCheckpoint() const;
+
+  /// Move `reader` to `checkpoint` if it was left by an interrupted import of
+  /// `filePath` and return the number of documents read before it.
+
+  /// Returns 0 (and does not move the reader) otherwise, if the file's size
+  /// or modification time have changed since the checkpoint was saved, or if
+  /// `filePath` is the standard input.
+  int resumeImport(DocsReader& reader, const QString& filePath,
+                   const QJsonObject& checkpoint) const;
+
+  /// Record the position reached in `filePath`; does nothing for the standard
+  /// input, which cannot be resumed
+  void saveImportCheckpoint(const QString& filePath, qint64 position,
+                            int nDocs) const;
 
   void insertLabel(QSqlQuery& query, const QString& labelName,
                    const QString& color = QString(),
                    const QString& shortcutKey = QString());
 
-  int writeDoc(DocsWriter& writer, int docId, bool includeText,
-               bool includeAnnotations) const;
-
-  QList<Annotation> getDocAnnotations(int docId, const QString& content) const;
-
   int colorIndex_{};
+  const QString importCheckpointKey_{"import_checkpoint"};
   bool tmpDbDataLoaded_{};
   const QString tmpDbName_{":LABELBUDDY_TEMPORARY_DATABASE:"};
 };
@@ -220,11 +413,30 @@ private:
 /// printed, but the export is still performed in a default format (json) and it
 /// is not considered an error -- this function can still return 0 if there were
 /// no other errors.
-int batchImportExport(const QString& dbPath, const QList<QString>& labelsFiles,
-                      const QList<QString>& docsFiles,
-                      const QString& exportLabelsFile,
-                      const QString& exportDocsFile, bool labelledDocsOnly,
-                      bool includeText, bool includeAnnotations, bool vacuum);
+///
+/// `importOptions` are used for all the documents files.
+///
+/// A documents file can be "-" to import from the standard input or export to
+/// the standard output, with the format given by
+/// `importOptions.stdinFormat` or `exportDocsFormat`. When exporting to the
+/// standard output, messages are printed to the standard error instead.
+///
+/// If `exportShardSize` sets a limit, the exported documents are split in
+/// several files (see `DatabaseCatalog::exportDocuments`); this is an error
+/// when exporting to the standard output.
+///
+/// Before exporting documents, the current change watermark is printed. If
+/// `exportSince` is not negative, only the documents changed since that
+/// watermark are exported.
+int batchImportExport(
+    const QString& dbPath, const QList<QString>& labelsFiles,
+    const QList<QString>& docsFiles, const QString& exportLabelsFile,
+    const QString& exportDocsFile, bool labelledDocsOnly, bool includeText,
+    bool includeAnnotations, bool vacuum,
+    const ImportDocsOptions& importOptions = ImportDocsOptions(),
+    const QString& exportDocsFormat = QString(),
+    const ExportShardSize& exportShardSize = ExportShardSize(),
+    qint64 exportSince = -1);
 
 } // namespace labelbuddy
 
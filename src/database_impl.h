@@ -1,10 +1,14 @@
 #ifndef LABELBUDDY_DATABASE_IMPL_H
 #define LABELBUDDY_DATABASE_IMPL_H
 
+#include <vector>
+
 #include <QJsonArray>
-#include <QTextStream>
+#include <QTextCodec>
 
 #include "database.h"
+#include "line_index.h"
+#include "utf8_offset_index.h"
 
 namespace labelbuddy {
 
@@ -21,76 +25,294 @@ struct Annotation {
 
 struct DocRecord {
   QString content{};
+  /// UTF-8 encoding of `content`, if the reader had it without transcoding
+  /// (eg a JSON string without escapes); empty if unknown
+  QByteArray contentUtf8{};
   QByteArray metadata{};
   QString declaredMd5{};
+  /// MD5 checksum of the UTF-8 encoded content, empty until computed
+  QByteArray contentMd5{};
   QList<Annotation> annotations{};
   bool validContent = true;
   QString displayTitle{};
   QString listTitle{};
 };
 
+/// An index that is not needed to enforce a constraint
+struct SecondaryIndex {
+  QString name;
+  QString createStatement;
+};
+
+/// Indexes created with the tables, which are dropped and rebuilt around bulk
+/// loads (see `BulkLoadGuard`)
+const QList<SecondaryIndex>& secondaryIndexes();
+
+/// Whether the database stores text as UTF-8, SQLite's default encoding.
+
+/// The encoding is chosen when a database is created. If it is UTF-8 the
+/// content of documents is written and read as UTF-8 blobs cast to and from
+/// text, which SQLite stores unchanged; otherwise it goes through `QString`
+/// and SQLite's conversions.
+bool isUtf8Database(const QString& databaseName);
+
+/// A trigger that records changed documents in the `document_change` table
+struct ChangeTrigger {
+  QString name;
+  QString createStatement;
+};
+
+/// Triggers created with the `document_change` table
+const QList<ChangeTrigger>& changeTriggers();
+
+/// The change trigger that runs for each inserted annotation.
+
+/// It is dropped around bulk loads (see `BulkLoadGuard`), during which
+/// `BulkInserter` records the documents of the rows each batch inserted
+/// instead.
+const ChangeTrigger& annotationInsertTrigger();
+
+/// Fill the record's `contentUtf8` if it has content and it is not set yet
+void computeContentUtf8(DocRecord& record);
+
+/// Compute the record's `contentMd5` if it has content and it is not set yet
+
+/// `contentUtf8` is filled first if needed, and it is the hashed buffer.
+void computeContentMd5(DocRecord& record);
+
+/// A file that is decompressed or compressed on the fly if its name ends with
+/// ".gz" or ".zst", or a regular file otherwise. It is not opened yet.
+std::unique_ptr<QIODevice> makeDocsFile(const QString& filePath);
+
+/// Whether `filePath` is "-", which stands for the standard input or output
+bool isStandardStream(const QString& filePath);
+
+/// Open a file returned by `makeDocsFile`.
+
+/// If `filePath` is "-" the standard output is opened if `mode` is for
+/// writing, the standard input otherwise.
+bool openDocsFile(QIODevice& file, const QString& filePath,
+                  QIODevice::OpenMode mode);
+
+/// Reads documents from a file.
+
+/// Readers that can separate reading a document from parsing it implement
+/// `readRaw` and `parseRaw`: the first one is fast and sequential, the second
+/// one does the expensive work and can be called concurrently from several
+/// threads (see `ParallelDocsReader`). Other readers only implement `readNext`.
 class DocsReader {
 
 public:
   explicit DocsReader(const QString& filePath);
   virtual ~DocsReader() = default;
-  bool isOpen() const;
+  virtual bool isOpen() const;
   bool hasError() const;
   ErrorCode errorCode() const;
   QString errorMessage() const;
-  virtual bool readNext() = 0;
+
+  /// Read and parse the next document.
+
+  /// Returns false if there are no more documents or if an error occurred. The
+  /// default implementation uses `readRaw` and `parseRaw`.
+  virtual bool readNext();
   const DocRecord* getCurrentRecord() const;
+
+  /// Transfer ownership of the current record to the caller
+  std::unique_ptr<DocRecord> takeCurrentRecord();
+
+  /// Upper bound of `currentProgress`, 0 if the progress is unknown (eg when
+  /// reading the standard input)
   virtual int progressMax() const;
   virtual int currentProgress() const;
 
+  /// Whether this reader implements `readRaw` and `parseRaw`
+  virtual bool canReadRaw() const;
+
+  /// Read the bytes of the next document without parsing them.
+  virtual bool readRaw(QByteArray& rawDoc);
+
+  /// Parse a document returned by `readRaw`; nullptr if it is invalid.
+
+  /// Must not modify the reader as it can be called from worker threads.
+  virtual std::unique_ptr<DocRecord> parseRaw(const QByteArray& rawDoc) const;
+
+  /// Error message used when `parseRaw` fails
+  virtual QString parseErrorMessage() const;
+
+  /// Skip documents that cannot be parsed instead of stopping with an error.
+
+  /// The raw content of skipped documents can be retrieved with
+  /// `takeRejectedDocs`. Errors in the structure of the file (eg a truncated
+  /// JSON array) still stop the reader.
+  void setSkipInvalid(bool skipInvalid);
+  bool isSkippingInvalid() const;
+
+  /// Raw content of the documents skipped since the last call
+  QList<QByteArray> takeRejectedDocs();
+
+  /// Position in the file after the last document that was read or skipped
+  virtual qint64 position() const;
+
+  /// Continue reading after a document, at a value returned by `position`.
+  virtual bool seek(qint64 position);
+
 protected:
-  QFile* getFile();
+  /// A reader that does not read a file itself, eg wraps another reader
+  DocsReader() = default;
+
+  /// The (uncompressed) content of the file
+  QIODevice* getFile();
+  const QIODevice* getFile() const;
   void setCurrentRecord(std::unique_ptr<DocRecord>);
+
+  /// The current record reset to its default values, or a new one if it was
+  /// taken, so it can be filled without allocating (its `content` and
+  /// `contentUtf8` are kept to reuse their memory, and must be overwritten)
+  DocRecord& reuseCurrentRecord();
   static constexpr int progressRangeMax_{1000};
   void setError(ErrorCode code, const QString& message);
+  void addRejectedDoc(const QByteArray& rawDoc);
+
+  /// Called when the end of the file is reached: if it was reached early
+  /// because the file could not be read (eg corrupted compressed data), set
+  /// the error and return true.
+  bool checkReadError();
 
 private:
-  QFile file_;
+  std::unique_ptr<QIODevice> file_{nullptr};
   std::unique_ptr<DocRecord> currentRecord_{nullptr};
+  QList<QByteArray> rejectedDocs_{};
+  bool skipInvalid_{};
   double fileSize_{};
   ErrorCode errorCode_ = ErrorCode::NoError;
   QString errorMessage_{};
 };
 
+/// Fraction of the reader's progress range covered since it was at
+/// `startProgress`, for the progress reports.
+
+/// Returns -1 if it is unknown (eg when reading the standard input) or if it
+/// is not in [0, 1].
+double fractionRead(const DocsReader& reader, int startProgress);
+
+/// Reads a text file, one document per line.
+
+/// The file is read in large blocks, which are split on newlines. UTF-8
+/// files (with or without a BOM) are decoded directly into the content of the
+/// current record, which is reused from one document to the next if it has
+/// not been taken. Files that start with a UTF-16 or UTF-32 BOM are split in
+/// the same way, on newlines aligned to their code units, and each line is
+/// decoded with the corresponding `QTextCodec`. In all cases a line ends with
+/// "\n" or "\r\n", which is not part of the document, and invalid input is
+/// replaced with U+FFFD. `position` is the offset in the file of the next
+/// line.
 class TxtDocsReader : public DocsReader {
 
 public:
   explicit TxtDocsReader(const QString& filePath);
   bool readNext() override;
+  qint64 position() const override;
+  bool seek(qint64 position) override;
 
 private:
-  QTextStream stream_;
+  static constexpr int chunkSize_{1 << 20};
+
+  /// append a chunk of the file to the buffer; false at the end of the file
+  bool fillBuffer();
+
+  /// Offset in the buffer of the first newline at or after `from` that is
+  /// aligned to a code unit; -1 if there is none
+  int findNewline(int from) const;
+
+  /// nullptr for UTF-8
+  QTextCodec* codec_{};
+  /// the newline and carriage return encoded in the file's encoding
+  QByteArray newline_{"\n"};
+  QByteArray carriageReturn_{"\r"};
+  QByteArray buffer_{};
+  int bufferPos_{};
 };
 
 std::unique_ptr<DocRecord> jsonToDocRecord(const QJsonDocument&);
 std::unique_ptr<DocRecord> jsonToDocRecord(const QJsonValue&);
 std::unique_ptr<DocRecord> jsonToDocRecord(const QJsonObject&);
 
+/// Parse a JSON object, nullptr if `json` is not one.
+
+/// Uses `parseDocRecordFast`, and `QJsonDocument` for the inputs it does not
+/// recognize.
+std::unique_ptr<DocRecord> parseJsonDocRecord(const QByteArray& json);
+
+/// Reads a JSON array of documents one element at a time.
+
+/// Only the element being read (and at most one chunk of the file) is kept in
+/// memory, so the size of the file is not limited by the available memory or by
+/// the maximum size of a `QJsonDocument`.
 class JsonDocsReader : public DocsReader {
 
 public:
   explicit JsonDocsReader(const QString& filePath);
-  bool readNext() override;
-  int progressMax() const override;
-  int currentProgress() const override;
+  bool canReadRaw() const override;
+  bool readRaw(QByteArray& rawDoc) override;
+  std::unique_ptr<DocRecord> parseRaw(const QByteArray& rawDoc) const override;
+  QString parseErrorMessage() const override;
+  qint64 position() const override;
+  bool seek(qint64 position) override;
 
 private:
-  QJsonArray allDocs_;
-  QJsonArray::const_iterator currentDoc_;
-  int totalNDocs_;
-  int nSeen_{};
+  static constexpr int chunkSize_{1 << 20};
+
+  /// append a chunk of the file to the buffer; false at the end of the file
+  bool fillBuffer();
+
+  /// move to the next non-whitespace character; false at the end of the file
+  bool skipWhitespace();
+
+  /// find the end of the JSON value starting at `bufferPos_`
+  bool findElementEnd(int& elementEnd);
+
+  QByteArray buffer_{};
+  int bufferPos_{};
+  int nDocs_{};
+  bool atEnd_{};
 };
 
+/// Reads a JSON Lines file, one document per line.
+
+/// When possible (the file is not compressed and the address space is large
+/// enough), the file is memory-mapped and its lines are found once with a
+/// `LineIndex`. `readRaw` then returns lines that point into the mapping
+/// without copying them, and `position`, `seek` and `currentProgress` are
+/// computed from the line index. Otherwise lines are read one by one from the
+/// file.
 class JsonLinesDocsReader : public DocsReader {
 
 public:
   explicit JsonLinesDocsReader(const QString& filePath);
-  bool readNext() override;
+  bool canReadRaw() const override;
+
+  /// If the file is mapped, `rawDoc` refers to the mapping and is only valid
+  /// while the reader exists.
+  bool readRaw(QByteArray& rawDoc) override;
+  std::unique_ptr<DocRecord> parseRaw(const QByteArray& rawDoc) const override;
+  QString parseErrorMessage() const override;
+  int currentProgress() const override;
+  qint64 position() const override;
+  bool seek(qint64 position) override;
+
+  /// Whether the file is read through a memory mapping
+  bool isMapped() const;
+
+  /// The lines of the mapped file, nullptr if it is not mapped
+  const LineIndex* getLineIndex() const;
+
+private:
+  /// Map the file and index its lines; false if that is not possible
+  bool mapFile();
+
+  const char* mapped_{nullptr};
+  LineIndex lineIndex_{};
+  qint64 currentLine_{};
 };
 
 class DocsWriter {
@@ -104,22 +326,73 @@ public:
   bool isIncludingText() const;
   bool isIncludingAnnotations() const;
 
-  virtual void addDocument(const QString& md5, const QString& content,
-                           const QJsonObject& metadata,
-                           const QList<Annotation>& annotations,
-                           const QString& displayTitle,
-                           const QString& listTitle) = 0;
+  /// Number of (uncompressed) bytes written so far
+  qint64 nBytesWritten() const;
+
+  /// Serialize a document and add it to the output.
+
+  /// `contentUtf8` is the document's text encoded in UTF-8, and `metadata` a
+  /// serialized JSON object, as they are stored in the database.
+  void addDocument(const QString& md5, const QByteArray& contentUtf8,
+                   const QByteArray& metadata,
+                   const QList<Annotation>& annotations,
+                   const QString& displayTitle, const QString& listTitle);
+
+  /// Serialize a document without writing it.
+
+  /// The serialized document is appended to `output`. This does not modify
+  /// the writer, so it can be called from several threads at once, and the
+  /// results added in order with `addSerializedDocument` give the same output
+  /// as `addDocument`.
+  virtual void serializeDocument(const QString& md5,
+                                 const QByteArray& contentUtf8,
+                                 const QByteArray& metadata,
+                                 const QList<Annotation>& annotations,
+                                 const QString& displayTitle,
+                                 const QString& listTitle,
+                                 QByteArray& output) const = 0;
+
+  /// Serialize a marker for a deleted document, identified by its checksum.
+
+  /// It is added with `addSerializedDocument` like a document.
+  virtual void serializeDeletedDocument(const QString& md5,
+                                        QByteArray& output) const = 0;
+
+  /// Add a document returned by `serializeDocument` to the output.
+  virtual void addSerializedDocument(const QByteArray& serialized) = 0;
+
   /// at the start of the output file
   virtual void writePrefix();
 
   /// at the end of the output file
   virtual void writeSuffix();
 
+  /// Close the output file and continue writing to a new one.
+
+  /// The caller writes the suffix to the current file before, and the prefix
+  /// to the new file after. Returns false if the new file cannot be opened, or
+  /// if `close` fails for the current one.
+  virtual bool startNewFile(const QString& filePath);
+
+  /// Close the output file (which finishes a compressed stream).
+
+  /// Returns false if some of the output could not be written to the file
+  /// since the writer was created, including when it is closed.
+  bool close();
+
 protected:
-  QFile* getFile();
+  /// Compressed while it is written if the file name ends with ".gz" or ".zst"
+  QIODevice* getFile();
+
+  /// Write to the file and count the bytes
+  void write(const QByteArray& data);
 
 private:
-  QFile file_;
+  std::unique_ptr<QIODevice> file_{nullptr};
+  /// reused by `addDocument` for each document
+  QByteArray buffer_{};
+  qint64 nBytesWritten_{};
+  bool writeFailed_{};
   bool includeText_;
   bool includeAnnotations_;
 };
@@ -128,13 +401,17 @@ class JsonLinesDocsWriter : public DocsWriter {
 public:
   explicit JsonLinesDocsWriter(const QString& filePath, bool includeText,
                                bool includeAnnotations);
-  void addDocument(const QString& md5, const QString& content,
-                   const QJsonObject& metadata,
-                   const QList<Annotation>& annotations,
-                   const QString& displayTitle,
-                   const QString& listTitle) override;
+  void serializeDocument(const QString& md5, const QByteArray& contentUtf8,
+                         const QByteArray& metadata,
+                         const QList<Annotation>& annotations,
+                         const QString& displayTitle, const QString& listTitle,
+                         QByteArray& output) const override;
+  void serializeDeletedDocument(const QString& md5,
+                                QByteArray& output) const override;
+  void addSerializedDocument(const QByteArray& serialized) override;
 
   void writeSuffix() override;
+  bool startNewFile(const QString& filePath) override;
 
 protected:
   int getNDocs() const;
@@ -148,11 +425,7 @@ public:
   explicit JsonDocsWriter(const QString& filePath, bool includeText,
                           bool includeAnnotations);
 
-  void addDocument(const QString& md5, const QString& content,
-                   const QJsonObject& metadata,
-                   const QList<Annotation>& annotations,
-                   const QString& displayTitle,
-                   const QString& listTitle) override;
+  void addSerializedDocument(const QByteArray& serialized) override;
   void writePrefix() override;
   void writeSuffix() override;
 };
@@ -206,16 +479,38 @@ acceptedAndDefaultFormats(DatabaseCatalog::Action action,
 /// Last used database if it is found in QSettings and exists else ""
 QString getDefaultDatabasePath();
 
-QMap<int, int> getUtf8ToUnicode(const CharIndices& charIndices,
-                                const QList<Annotation>& annotations);
+/// Unicode positions of the annotations' UTF-8 positions.
 
-/// return a reader appropriate for the filename extension
-std::unique_ptr<DocsReader> getDocsReader(const QString& filePath);
+/// The result holds the start and end of each annotation in turn; missing or
+/// invalid UTF-8 positions give `Annotation::nullIndex`.
+std::vector<int> getUtf8ToUnicode(const Utf8OffsetIndex& utf8Index,
+                                  const QList<Annotation>& annotations);
 
-/// return a writer appropriate for the filename extension
+/// return a reader appropriate for `format` (json, jsonl or txt), or for the
+/// filename extension if it is empty
+std::unique_ptr<DocsReader> getDocsReader(const QString& filePath,
+                                          const QString& format = QString());
+
+/// "jsonl" if `format` is, or if it is empty and the file name (without a
+/// compression suffix) ends with .jsonl; "json" otherwise
+QString exportedDocsFormat(const QString& filePath, const QString& format);
+
+/// return a writer appropriate for `format` (json or jsonl), or for the
+/// filename extension if it is empty
 std::unique_ptr<DocsWriter> getDocsWriter(const QString& filePath,
                                           bool includeText,
-                                          bool includeAnnotations);
+                                          bool includeAnnotations,
+                                          const QString& format = QString());
+
+/// Path of a shard of a sharded export to `filePath`.
+
+/// The shard index, starting at 1, is inserted before the extension and the
+/// compression suffix: docs.jsonl.gz gives docs-00001.jsonl.gz, etc.
+QString shardFilePath(const QString& filePath, int shardIndex);
+
+/// Path of the manifest of a sharded export to `filePath`: docs.jsonl.gz gives
+/// docs.manifest.json
+QString shardManifestPath(const QString& filePath);
 
 ExportLabelsResult writeLabelsToJson(const QJsonArray& labels,
                                      const QString& filePath);
@@ -0,0 +1,615 @@
+#include <cstring>
+
+#include <QChar>
+#include <QJsonDocument>
+#include <QString>
+
+#include "doc_record_parser.h"
+#include "simd.h"
+#include "utf8.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// Deeper values are left to QJsonDocument, which has its own limit
+constexpr int maxDepth = 512;
+
+/// Longer numbers could overflow a double, which QJsonDocument rejects
+constexpr int maxNumberLength = 300;
+
+bool isSpecialInString(char c) {
+  auto u = static_cast<unsigned char>(c);
+  return u == '"' || u == '\\' || u < 0x20 || u >= 0x80;
+}
+
+/// First byte in [pos, end) that is a quote, a backslash, a control character
+/// or not ASCII, or `end`
+const char* findSpecialInString(const char* pos, const char* end) {
+#ifdef LABELBUDDY_SSE2
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  const auto space = _mm_set1_epi8(0x20);
+  while (end - pos >= 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    // the comparison is signed so bytes >= 0x80 are also less than a space
+    auto special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                             _mm_cmpeq_epi8(chunk, backslash)),
+                                _mm_cmplt_epi8(chunk, space));
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      return pos + countTrailingZeros(mask);
+    }
+    pos += 16;
+  }
+#endif
+  while (pos != end && !isSpecialInString(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+int hexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+template <int N>
+bool keyEquals(const char* key, int keySize, const char (&name)[N]) {
+  return keySize == N - 1 && std::memcmp(key, name, N - 1) == 0;
+}
+
+/// A recursive descent parser for one document.
+class DocRecordParser {
+public:
+  DocRecordParser(const char* json, int size)
+      : pos_{json}, end_{json + size} {}
+
+  bool parse(DocRecord& record);
+
+private:
+  enum DocField {
+    Text = 1 << 0,
+    Md5 = 1 << 1,
+    Annotations = 1 << 2,
+    Metadata = 1 << 3,
+    DisplayTitle = 1 << 4,
+    ListTitle = 1 << 5
+  };
+
+  enum AnnotationField {
+    StartChar = 1 << 0,
+    EndChar = 1 << 1,
+    LabelName = 1 << 2,
+    ExtraData = 1 << 3,
+    StartByte = 1 << 4,
+    EndByte = 1 << 5
+  };
+
+  void skipWhitespace();
+
+  /// Skip whitespace; false if the next character is not `c`
+  bool expect(char c);
+
+  /// Skip whitespace; true if the next character is `c`, which is consumed
+  bool accept(char c);
+
+  /// Skip whitespace; true if the next character is `c`, which is not consumed
+  bool peek(char c);
+
+  /// Validate a string and decode it into `result` unless it is nullptr.
+
+  /// If `utf8` is not nullptr, it receives the UTF-8 encoding of the string,
+  /// which is a copy of the input when the string has no escape sequences.
+  /// It is left empty if the string contains escaped unpaired surrogates,
+  /// which have no UTF-8 encoding.
+  bool parseString(QString* result, QByteArray* utf8 = nullptr);
+
+  /// A key without escape sequences, which is not decoded
+  bool parseKey(const char*& key, int& keySize);
+
+  bool parseInt(int& result);
+  bool parseAnnotations(QList<Annotation>& annotations);
+  bool parseAnnotation(Annotation& annotation);
+
+  /// Validate a metadata object and store it in the same (compact) form as
+  /// the `QJsonDocument` path.
+  bool parseMetadata(QByteArray& metadata);
+
+  /// Validate any JSON value without decoding it
+  bool skipValue(int depth);
+  bool skipNumber();
+  bool skipLiteral(const char* literal);
+
+  /// Mark `field` as seen; false if it was already seen
+  static bool markSeen(int& seenFields, int field);
+
+  const char* pos_;
+  const char* end_;
+};
+
+void DocRecordParser::skipWhitespace() {
+  while (pos_ != end_ &&
+         (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t')) {
+    ++pos_;
+  }
+}
+
+bool DocRecordParser::expect(char c) {
+  skipWhitespace();
+  if (pos_ == end_ || *pos_ != c) {
+    return false;
+  }
+  ++pos_;
+  return true;
+}
+
+bool DocRecordParser::accept(char c) {
+  skipWhitespace();
+  if (pos_ != end_ && *pos_ == c) {
+    ++pos_;
+    return true;
+  }
+  return false;
+}
+
+bool DocRecordParser::peek(char c) {
+  skipWhitespace();
+  return pos_ != end_ && *pos_ == c;
+}
+
+bool DocRecordParser::markSeen(int& seenFields, int field) {
+  if (seenFields & field) {
+    return false;
+  }
+  seenFields |= field;
+  return true;
+}
+
+bool DocRecordParser::parseString(QString* result, QByteArray* utf8) {
+  if (!expect('"')) {
+    return false;
+  }
+  // first find the end of the string and validate its UTF-8 encoding
+  auto start = pos_;
+  auto pos = pos_;
+  bool plain{true};
+  while (true) {
+    pos = findSpecialInString(pos, end_);
+    if (pos == end_) {
+      return false;
+    }
+    auto c = static_cast<unsigned char>(*pos);
+    if (c == '"') {
+      break;
+    }
+    if (c == '\\') {
+      plain = false;
+      if (end_ - pos < 2) {
+        return false;
+      }
+      pos += 2;
+    } else if (c < 0x20) {
+      return false;
+    } else {
+      auto length = utf8SequenceLength(pos, end_);
+      if (length == 0) {
+        return false;
+      }
+      pos += length;
+    }
+  }
+  pos_ = pos + 1;
+  auto stringEnd = pos;
+  if (plain && utf8 != nullptr) {
+    *utf8 = QByteArray(start, static_cast<int>(stringEnd - start));
+  }
+  // QString::fromUtf8 would drop a byte order mark at the start
+  if (plain && !(stringEnd - start >= 3 &&
+                 std::memcmp(start, "\xef\xbb\xbf", 3) == 0)) {
+    if (result != nullptr) {
+      *result = QString::fromUtf8(start, static_cast<int>(stringEnd - start));
+    }
+    return true;
+  }
+  // there are escape sequences: decode into a buffer that is large enough,
+  // and shrink it at the end
+  QString decoded(static_cast<int>(stringEnd - start), Qt::Uninitialized);
+  auto dest = reinterpret_cast<ushort*>(decoded.data());
+  auto destStart = dest;
+  // an escape sequence is never shorter than its UTF-8 encoding, and a
+  // surrogate pair takes 12 bytes as escapes and 4 in UTF-8
+  QByteArray encoded{};
+  char* utf8Dest{};
+  if (utf8 != nullptr) {
+    encoded.resize(static_cast<int>(stringEnd - start));
+    utf8Dest = encoded.data();
+  }
+  // high surrogate of a \u escape waiting for its low surrogate, or 0
+  uint highSurrogate{};
+  bool validUtf8{true};
+  pos = start;
+  while (pos != stringEnd) {
+    auto special = findSpecialInString(pos, stringEnd);
+    widenAscii(pos, special, dest);
+    dest += special - pos;
+    if (utf8Dest != nullptr) {
+      std::memcpy(utf8Dest, pos, static_cast<std::size_t>(special - pos));
+      utf8Dest += special - pos;
+      validUtf8 = validUtf8 && (highSurrogate == 0 || special == pos);
+    }
+    pos = special;
+    if (pos == stringEnd) {
+      break;
+    }
+    if (*pos != '\\') {
+      auto length = utf8SequenceLength(pos, stringEnd);
+      dest = decodeUtf8Sequence(pos, length, dest);
+      if (utf8Dest != nullptr) {
+        std::memcpy(utf8Dest, pos, static_cast<std::size_t>(length));
+        utf8Dest += length;
+        validUtf8 = validUtf8 && highSurrogate == 0;
+      }
+      pos += length;
+      continue;
+    }
+    auto escaped = pos[1];
+    pos += 2;
+    ushort unit{};
+    switch (escaped) {
+    case '"':
+    case '\\':
+    case '/':
+      unit = static_cast<ushort>(escaped);
+      break;
+    case 'b':
+      unit = '\b';
+      break;
+    case 'f':
+      unit = '\f';
+      break;
+    case 'n':
+      unit = '\n';
+      break;
+    case 'r':
+      unit = '\r';
+      break;
+    case 't':
+      unit = '\t';
+      break;
+    case 'u': {
+      if (stringEnd - pos < 4) {
+        return false;
+      }
+      for (int i = 0; i < 4; ++i) {
+        auto digit = hexDigitValue(pos[i]);
+        if (digit == -1) {
+          return false;
+        }
+        unit = static_cast<ushort>(unit * 16 + digit);
+      }
+      pos += 4;
+      break;
+    }
+    default:
+      return false;
+    }
+    // like QJsonDocument, unpaired surrogates are kept as they are
+    *dest++ = unit;
+    if (utf8Dest == nullptr) {
+      continue;
+    }
+    if (QChar::isHighSurrogate(unit)) {
+      validUtf8 = validUtf8 && highSurrogate == 0;
+      highSurrogate = unit;
+    } else if (QChar::isLowSurrogate(unit)) {
+      validUtf8 = validUtf8 && highSurrogate != 0;
+      if (validUtf8) {
+        utf8Dest = encodeUtf8(QChar::surrogateToUcs4(
+                                  static_cast<ushort>(highSurrogate), unit),
+                              utf8Dest);
+      }
+      highSurrogate = 0;
+    } else {
+      validUtf8 = validUtf8 && highSurrogate == 0;
+      utf8Dest = encodeUtf8(unit, utf8Dest);
+    }
+  }
+  if (result != nullptr) {
+    decoded.resize(static_cast<int>(dest - destStart));
+    *result = decoded;
+  }
+  if (utf8 != nullptr) {
+    if (validUtf8 && highSurrogate == 0) {
+      encoded.resize(static_cast<int>(utf8Dest - encoded.constData()));
+      *utf8 = encoded;
+    } else {
+      *utf8 = QByteArray();
+    }
+  }
+  return true;
+}
+
+bool DocRecordParser::parseKey(const char*& key, int& keySize) {
+  if (!expect('"')) {
+    return false;
+  }
+  auto keyEnd = findSpecialInString(pos_, end_);
+  if (keyEnd == end_ || *keyEnd != '"') {
+    // escapes or non-ASCII characters: not one of the keys we look for, and
+    // not worth handling here
+    return false;
+  }
+  key = pos_;
+  keySize = static_cast<int>(keyEnd - pos_);
+  pos_ = keyEnd + 1;
+  return expect(':');
+}
+
+bool DocRecordParser::parseInt(int& result) {
+  skipWhitespace();
+  auto pos = pos_;
+  bool negative{};
+  if (pos != end_ && *pos == '-') {
+    negative = true;
+    ++pos;
+  }
+  auto digitsStart = pos;
+  int value{};
+  while (pos != end_ && *pos >= '0' && *pos <= '9') {
+    value = value * 10 + (*pos - '0');
+    ++pos;
+    // more digits could overflow
+    if (pos - digitsStart > 9) {
+      return false;
+    }
+  }
+  auto nDigits = pos - digitsStart;
+  if (nDigits == 0 || (nDigits > 1 && *digitsStart == '0')) {
+    return false;
+  }
+  // fractions and exponents are left to QJsonDocument
+  if (pos != end_ && (*pos == '.' || *pos == 'e' || *pos == 'E')) {
+    return false;
+  }
+  result = negative ? -value : value;
+  pos_ = pos;
+  return true;
+}
+
+bool DocRecordParser::parseAnnotations(QList<Annotation>& annotations) {
+  if (!expect('[')) {
+    return false;
+  }
+  if (accept(']')) {
+    return true;
+  }
+  do {
+    annotations << Annotation{Annotation::nullIndex,
+                              Annotation::nullIndex,
+                              QString(),
+                              QString(""),
+                              Annotation::nullIndex,
+                              Annotation::nullIndex};
+    if (!parseAnnotation(annotations.last())) {
+      return false;
+    }
+  } while (accept(','));
+  return expect(']');
+}
+
+bool DocRecordParser::parseAnnotation(Annotation& annotation) {
+  if (!expect('{')) {
+    return false;
+  }
+  if (accept('}')) {
+    return true;
+  }
+  int seenFields{};
+  do {
+    const char* key{};
+    int keySize{};
+    if (!parseKey(key, keySize)) {
+      return false;
+    }
+    bool ok{};
+    if (keyEquals(key, keySize, "start_char")) {
+      ok = markSeen(seenFields, StartChar) && parseInt(annotation.startChar);
+    } else if (keyEquals(key, keySize, "end_char")) {
+      ok = markSeen(seenFields, EndChar) && parseInt(annotation.endChar);
+    } else if (keyEquals(key, keySize, "label_name")) {
+      // an empty name may be a null or an empty string in QJsonDocument
+      ok = markSeen(seenFields, LabelName) && peek('"') &&
+           parseString(&annotation.labelName) && annotation.labelName != "";
+    } else if (keyEquals(key, keySize, "extra_data")) {
+      ok = markSeen(seenFields, ExtraData) && peek('"') &&
+           parseString(&annotation.extraData);
+    } else if (keyEquals(key, keySize, "start_byte")) {
+      ok = markSeen(seenFields, StartByte) && parseInt(annotation.startByte);
+    } else if (keyEquals(key, keySize, "end_byte")) {
+      ok = markSeen(seenFields, EndByte) && parseInt(annotation.endByte);
+    } else {
+      ok = skipValue(2);
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (accept(','));
+  return expect('}');
+}
+
+bool DocRecordParser::skipValue(int depth) {
+  skipWhitespace();
+  if (pos_ == end_ || depth > maxDepth) {
+    return false;
+  }
+  switch (*pos_) {
+  case '"':
+    return parseString(nullptr);
+  case '{':
+    ++pos_;
+    if (accept('}')) {
+      return true;
+    }
+    do {
+      if (!parseString(nullptr) || !expect(':') || !skipValue(depth + 1)) {
+        return false;
+      }
+    } while (accept(','));
+    return expect('}');
+  case '[':
+    ++pos_;
+    if (accept(']')) {
+      return true;
+    }
+    do {
+      if (!skipValue(depth + 1)) {
+        return false;
+      }
+    } while (accept(','));
+    return expect(']');
+  case 't':
+    return skipLiteral("true");
+  case 'f':
+    return skipLiteral("false");
+  case 'n':
+    return skipLiteral("null");
+  default:
+    return skipNumber();
+  }
+}
+
+bool DocRecordParser::parseMetadata(QByteArray& metadata) {
+  auto start = pos_;
+  if (!skipValue(1)) {
+    return false;
+  }
+  auto size = static_cast<int>(pos_ - start);
+  if (size == 2) {
+    metadata = "{}";
+    return true;
+  }
+  // re-serialized rather than copied so that the stored metadata does not
+  // depend on the input's whitespace, key order or escapes, which exports and
+  // the search in the documents list would otherwise see
+  auto jsonDoc = QJsonDocument::fromJson(QByteArray::fromRawData(start, size));
+  if (!jsonDoc.isObject()) {
+    return false;
+  }
+  metadata = jsonDoc.toJson(QJsonDocument::Compact);
+  return true;
+}
+
+bool DocRecordParser::skipNumber() {
+  auto pos = pos_;
+  auto skipDigits = [&pos, this]() {
+    auto start = pos;
+    while (pos != end_ && *pos >= '0' && *pos <= '9') {
+      ++pos;
+    }
+    return pos - start;
+  };
+  if (pos != end_ && *pos == '-') {
+    ++pos;
+  }
+  auto intStart = pos;
+  auto nIntDigits = skipDigits();
+  if (nIntDigits == 0 || (nIntDigits > 1 && *intStart == '0')) {
+    return false;
+  }
+  if (pos != end_ && *pos == '.') {
+    ++pos;
+    if (skipDigits() == 0) {
+      return false;
+    }
+  }
+  if (pos != end_ && (*pos == 'e' || *pos == 'E')) {
+    return false;
+  }
+  if (pos - pos_ > maxNumberLength) {
+    return false;
+  }
+  pos_ = pos;
+  return true;
+}
+
+bool DocRecordParser::skipLiteral(const char* literal) {
+  auto length = static_cast<int>(std::strlen(literal));
+  if (end_ - pos_ < length ||
+      std::memcmp(pos_, literal, static_cast<std::size_t>(length)) != 0) {
+    return false;
+  }
+  pos_ += length;
+  return true;
+}
+
+bool DocRecordParser::parse(DocRecord& record) {
+  if (!expect('{')) {
+    return false;
+  }
+  int seenFields{};
+  if (!accept('}')) {
+    do {
+      const char* key{};
+      int keySize{};
+      if (!parseKey(key, keySize)) {
+        return false;
+      }
+      bool ok{};
+      if (keyEquals(key, keySize, "text")) {
+        // an empty text may be a null or an empty string in QJsonDocument
+        ok = markSeen(seenFields, Text) && peek('"') &&
+             parseString(&record.content, &record.contentUtf8) &&
+             record.content != "";
+      } else if (keyEquals(key, keySize, "utf8_text_md5_checksum")) {
+        ok = markSeen(seenFields, Md5) && peek('"') &&
+             parseString(&record.declaredMd5);
+      } else if (keyEquals(key, keySize, "annotations")) {
+        ok = markSeen(seenFields, Annotations) &&
+             parseAnnotations(record.annotations);
+      } else if (keyEquals(key, keySize, "metadata")) {
+        ok = markSeen(seenFields, Metadata) && peek('{') &&
+             parseMetadata(record.metadata);
+      } else if (keyEquals(key, keySize, "display_title")) {
+        ok = markSeen(seenFields, DisplayTitle) && peek('"') &&
+             parseString(&record.displayTitle);
+      } else if (keyEquals(key, keySize, "list_title")) {
+        ok = markSeen(seenFields, ListTitle) && peek('"') &&
+             parseString(&record.listTitle);
+      } else {
+        ok = skipValue(1);
+      }
+      if (!ok) {
+        return false;
+      }
+    } while (accept(','));
+    if (!expect('}')) {
+      return false;
+    }
+  }
+  skipWhitespace();
+  if (pos_ != end_) {
+    return false;
+  }
+  record.validContent = (seenFields & Text) != 0;
+  if (!(seenFields & Metadata)) {
+    record.metadata = "{}";
+  }
+  return true;
+}
+
+} // namespace
+
+bool parseDocRecordFast(const char* json, int size, DocRecord& record) {
+  return DocRecordParser(json, size).parse(record);
+}
+
+} // namespace labelbuddy
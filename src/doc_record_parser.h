@@ -0,0 +1,31 @@
+#ifndef LABELBUDDY_DOC_RECORD_PARSER_H
+#define LABELBUDDY_DOC_RECORD_PARSER_H
+
+#include "database_impl.h"
+
+/// \file
+/// Fast parsing of JSON documents that follow the labelbuddy schema.
+
+namespace labelbuddy {
+
+/// Parse a JSON object with the labelbuddy document schema into `record`.
+
+/// This handles the common case without building a `QJsonDocument` for the
+/// whole record: each field is decoded directly into the `DocRecord` (strings
+/// are copied once, into their final `QString`), and the input is scanned 16
+/// bytes at a time with SSE2 when it is available. Only a non-empty
+/// `metadata` object is parsed with `QJsonDocument` and serialized again, so
+/// it is stored in the same compact form as by the fallback.
+///
+/// Returns false if the input is not recognized: it is not valid JSON, a
+/// field has an unexpected type, or it contains something the fast parser
+/// does not handle (eg duplicate keys, escapes in keys, exponents in numbers,
+/// empty text). The input must then be parsed with `QJsonDocument`, which
+/// gives the same record or reports the error. `record` must be a
+/// default-constructed `DocRecord` and is left in an unspecified state when
+/// false is returned.
+bool parseDocRecordFast(const char* json, int size, DocRecord& record);
+
+} // namespace labelbuddy
+
+#endif
@@ -221,9 +221,9 @@ void ImportExportMenu::importDocuments() {
   auto startDir = suggestDir(DirRole::importDocuments);
   auto filePath = QFileDialog::getOpenFileName(
       this, "Docs & annotations file", startDir,
-      "labelbuddy documents (*.txt *.json *.jsonl);; Text files "
+      "labelbuddy documents (*.txt *.json *.jsonl *.gz *.zst);; Text files "
       "(*.txt);; JSON files (*.json);; JSONLines files (*.jsonl);; "
-      "All files (*)");
+      "Compressed files (*.gz *.zst);; All files (*)");
   if (filePath == QString()) {
     return;
   }
@@ -270,7 +270,7 @@ void ImportExportMenu::exportDocuments() {
       this, "Docs & annotations file", startDir,
       "labelbuddy documents (*.json *.jsonl);;"
       " JSON files (*.json);; JSONLines files (*.jsonl);; "
-      "All files (*)");
+      "Compressed files (*.gz *.zst);; All files (*)");
   if (filePath == QString()) {
     return;
   }
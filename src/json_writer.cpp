@@ -0,0 +1,201 @@
+#include "json_writer.h"
+#include "simd.h"
+
+namespace labelbuddy {
+
+namespace {
+
+bool needsEscape(char c) {
+  auto u = static_cast<unsigned char>(c);
+  return u == '"' || u == '\\' || u < 0x20;
+}
+
+/// First byte in [pos, end) that must be escaped in a JSON string, or `end`
+const char* findEscaped(const char* pos, const char* end) {
+#ifdef LABELBUDDY_SSE2
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  const auto maxControl = _mm_set1_epi8(0x1f);
+  while (end - pos >= 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    // unsigned comparison: the byte is <= 0x1f if max(byte, 0x1f) == 0x1f
+    auto control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, maxControl), maxControl);
+    auto special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                             _mm_cmpeq_epi8(chunk, backslash)),
+                                control);
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      return pos + countTrailingZeros(mask);
+    }
+    pos += 16;
+  }
+#endif
+  while (pos != end && !needsEscape(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+/// Position of the first surrogate in `text`, starting at `from`, that is not
+/// part of a pair, or the size of `text`
+int findUnpairedSurrogate(const QString& text, int from) {
+  auto size = text.size();
+  for (int i = from; i < size; ++i) {
+    auto c = text[i];
+    if (!c.isSurrogate()) {
+      continue;
+    }
+    if (c.isHighSurrogate() && i + 1 < size && text[i + 1].isLowSurrogate()) {
+      ++i;
+      continue;
+    }
+    return i;
+  }
+  return size;
+}
+
+} // namespace
+
+JsonWriter::JsonWriter(QByteArray& output) : output_(output) {}
+
+void JsonWriter::beginValue() {
+  if (afterKey_) {
+    afterKey_ = false;
+    return;
+  }
+  if (needComma_) {
+    output_.append(',');
+  }
+}
+
+void JsonWriter::beginObject() {
+  beginValue();
+  output_.append('{');
+  needComma_ = false;
+}
+
+void JsonWriter::endObject() {
+  output_.append('}');
+  needComma_ = true;
+}
+
+void JsonWriter::beginArray() {
+  beginValue();
+  output_.append('[');
+  needComma_ = false;
+}
+
+void JsonWriter::endArray() {
+  output_.append(']');
+  needComma_ = true;
+}
+
+void JsonWriter::key(const char* name) {
+  beginValue();
+  output_.append('"');
+  output_.append(name);
+  output_.append("\":", 2);
+  afterKey_ = true;
+}
+
+void JsonWriter::stringValue(const char* utf8, int size) {
+  beginValue();
+  output_.append('"');
+  appendEscaped(utf8, size);
+  output_.append('"');
+  needComma_ = true;
+}
+
+void JsonWriter::appendEscaped(const char* utf8, int size) {
+  auto pos = utf8;
+  auto end = utf8 + size;
+  while (pos != end) {
+    auto escaped = findEscaped(pos, end);
+    output_.append(pos, static_cast<int>(escaped - pos));
+    if (escaped == end) {
+      break;
+    }
+    auto c = static_cast<unsigned char>(*escaped);
+    switch (c) {
+    case '"':
+      output_.append("\\\"", 2);
+      break;
+    case '\\':
+      output_.append("\\\\", 2);
+      break;
+    case '\b':
+      output_.append("\\b", 2);
+      break;
+    case '\f':
+      output_.append("\\f", 2);
+      break;
+    case '\n':
+      output_.append("\\n", 2);
+      break;
+    case '\r':
+      output_.append("\\r", 2);
+      break;
+    case '\t':
+      output_.append("\\t", 2);
+      break;
+    default:
+      appendUnicodeEscape(c);
+    }
+    pos = escaped + 1;
+  }
+}
+
+void JsonWriter::appendUnicodeEscape(unsigned int codeUnit) {
+  // lowercase hexadecimal digits, as in QJsonDocument
+  const char* digits = "0123456789abcdef";
+  char unicodeEscape[] = {'\\',
+                          'u',
+                          digits[(codeUnit >> 12) & 0xf],
+                          digits[(codeUnit >> 8) & 0xf],
+                          digits[(codeUnit >> 4) & 0xf],
+                          digits[codeUnit & 0xf]};
+  output_.append(unicodeEscape, 6);
+}
+
+void JsonWriter::stringValue(const QByteArray& utf8) {
+  stringValue(utf8.constData(), utf8.size());
+}
+
+void JsonWriter::stringValue(const QString& value) {
+  auto unpaired = findUnpairedSurrogate(value, 0);
+  if (unpaired == value.size()) {
+    stringValue(value.toUtf8());
+    return;
+  }
+  // QString::toUtf8 would replace them with '?', while QJsonDocument escapes
+  // them, so the valid parts in between are encoded separately
+  beginValue();
+  output_.append('"');
+  int start{};
+  while (true) {
+    auto utf8 = value.midRef(start, unpaired - start).toUtf8();
+    appendEscaped(utf8.constData(), utf8.size());
+    if (unpaired == value.size()) {
+      break;
+    }
+    appendUnicodeEscape(value[unpaired].unicode());
+    start = unpaired + 1;
+    unpaired = findUnpairedSurrogate(value, start);
+  }
+  output_.append('"');
+  needComma_ = true;
+}
+
+void JsonWriter::intValue(qint64 value) {
+  beginValue();
+  output_.append(QByteArray::number(value));
+  needComma_ = true;
+}
+
+void JsonWriter::rawValue(const QByteArray& json) {
+  beginValue();
+  output_.append(json);
+  needComma_ = true;
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,67 @@
+#ifndef LABELBUDDY_JSON_WRITER_H
+#define LABELBUDDY_JSON_WRITER_H
+
+#include <QByteArray>
+#include <QString>
+
+/// \file
+/// Writing compact JSON without building a `QJsonDocument`.
+
+namespace labelbuddy {
+
+/// Appends compact JSON to a byte buffer.
+
+/// Keys and values are written directly into `output` as they are given, so
+/// no `QJsonObject` or `QJsonValue` is allocated and keys are not hashed or
+/// sorted: the caller writes them in the order they must appear. Strings are
+/// escaped like `QJsonDocument::toJson` does, so a document written with keys
+/// in alphabetical order is identical to its compact `QJsonDocument`
+/// serialization. Commas are inserted automatically.
+///
+/// `output` is appended to, so the same buffer can be reused for many
+/// documents (a buffer that has been `reserve`d keeps its memory when it is
+/// resized to 0).
+class JsonWriter {
+
+public:
+  explicit JsonWriter(QByteArray& output);
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+
+  /// Write a key, which must not need escaping (eg a literal ASCII name)
+  void key(const char* name);
+
+  /// Write a string value given as UTF-8, which must be valid
+  void stringValue(const char* utf8, int size);
+  void stringValue(const QByteArray& utf8);
+
+  /// Write a string value; unpaired surrogates, which have no UTF-8 encoding,
+  /// are escaped as `\uXXXX`
+  void stringValue(const QString& value);
+
+  void intValue(qint64 value);
+
+  /// Write a value that is already serialized JSON, unchanged
+  void rawValue(const QByteArray& json);
+
+private:
+  /// Write a comma if the value is not the first in its container
+  void beginValue();
+
+  /// Append the escaped contents of a string given as UTF-8, without quotes
+  void appendEscaped(const char* utf8, int size);
+
+  /// Append `\uXXXX`
+  void appendUnicodeEscape(unsigned int codeUnit);
+
+  QByteArray& output_;
+  bool needComma_{};
+  bool afterKey_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,39 @@
+#include <algorithm>
+#include <cstring>
+
+#include "line_index.h"
+
+namespace labelbuddy {
+
+LineIndex::LineIndex(const char* data, qint64 size) {
+  auto pos = data;
+  auto end = data + size;
+  while (pos != end) {
+    auto newline = static_cast<const char*>(
+        std::memchr(pos, '\n', static_cast<std::size_t>(end - pos)));
+    pos = newline == nullptr ? end : newline + 1;
+    offsets_.push_back(pos - data);
+  }
+}
+
+qint64 LineIndex::nLines() const {
+  return static_cast<qint64>(offsets_.size()) - 1;
+}
+
+qint64 LineIndex::lineStart(qint64 line) const {
+  return offsets_[static_cast<std::size_t>(line)];
+}
+
+qint64 LineIndex::lineEnd(qint64 line) const {
+  return offsets_[static_cast<std::size_t>(line + 1)];
+}
+
+qint64 LineIndex::findLine(qint64 position) const {
+  auto found = std::lower_bound(offsets_.cbegin(), offsets_.cend(), position);
+  if (found == offsets_.cend() || *found != position) {
+    return -1;
+  }
+  return found - offsets_.cbegin();
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,50 @@
+#ifndef LABELBUDDY_LINE_INDEX_H
+#define LABELBUDDY_LINE_INDEX_H
+
+#include <vector>
+
+#include <QtGlobal>
+
+/// \file
+/// Finding the lines of a file that is entirely in memory.
+
+namespace labelbuddy {
+
+/// Offsets of the lines in a buffer, such as a memory-mapped file.
+
+/// The buffer is scanned once for newlines (with `memchr`) when the index is
+/// built. After that, finding a line from its number or a line number from a
+/// position is constant or logarithmic time, so a file can be read from any
+/// line (eg to resume an interrupted import) and positions reported by a
+/// reader (eg `ParsedDoc::endPosition`) do not require any bookkeeping.
+///
+/// Line `i` spans [`lineStart(i)`, `lineEnd(i)`), including its newline if it
+/// has one. A last line without a terminating newline is a line too, but the
+/// empty string after a final newline is not.
+class LineIndex {
+
+public:
+  LineIndex() = default;
+  LineIndex(const char* data, qint64 size);
+
+  qint64 nLines() const;
+
+  qint64 lineStart(qint64 line) const;
+
+  /// Position after the line, ie the start of the next line
+  qint64 lineEnd(qint64 line) const;
+
+  /// Number of the line that starts at `position`.
+
+  /// `nLines()` if `position` is the end of the buffer, and -1 if it is not
+  /// at the start of a line.
+  qint64 findLine(qint64 position) const;
+
+private:
+  /// the start of each line followed by the size of the buffer
+  std::vector<qint64> offsets_{0};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -35,10 +35,58 @@ int main(int argc, char* argv[]) {
                 << "labels and documents or vacuum db" << std::endl;
       return 1;
     }
+    labelbuddy::ImportDocsOptions importOptions{};
+    bool validThreads{};
+    importOptions.nThreads = parser.value("threads").toInt(&validThreads);
+    if (!validThreads || importOptions.nThreads < 1) {
+      std::cerr << "--threads must be a positive integer" << std::endl;
+      return 1;
+    }
+    importOptions.bulkLoad = parser.isSet("bulk-load");
+    bool validBatchSize{};
+    importOptions.batchSize =
+        parser.value("batch-size").toInt(&validBatchSize);
+    if (!validBatchSize || importOptions.batchSize < 0) {
+      std::cerr << "--batch-size must be a non-negative integer" << std::endl;
+      return 1;
+    }
+    importOptions.rejectsFile = parser.value("rejects");
+    importOptions.resume = parser.isSet("resume");
+    if (importOptions.resume && docsFiles.contains("-")) {
+      std::cerr << "--resume cannot be used with documents read from the "
+                   "standard input"
+                << std::endl;
+      return 1;
+    }
+    importOptions.dryRun = parser.isSet("dry-run");
+    importOptions.stdinFormat = parser.value("format");
+    labelbuddy::ExportShardSize exportShardSize{};
+    if (parser.isSet("export-shard-size")) {
+      bool validShardSize{};
+      exportShardSize = labelbuddy::parseExportShardSize(
+          parser.value("export-shard-size"), &validShardSize);
+      if (!validShardSize) {
+        std::cerr << "--export-shard-size must be a positive number of docs "
+                     "or of megabytes followed by MB"
+                  << std::endl;
+        return 1;
+      }
+    }
+    qint64 exportSince{-1};
+    if (parser.isSet("export-since")) {
+      bool validWatermark{};
+      exportSince = parser.value("export-since").toLongLong(&validWatermark);
+      if (!validWatermark || exportSince < 0) {
+        std::cerr << "--export-since must be a non-negative integer"
+                  << std::endl;
+        return 1;
+      }
+    }
     return labelbuddy::batchImportExport(
         dbPath, labelsFiles, docsFiles, exportLabelsFile, exportDocsFile,
         parser.isSet("labelled-only"), !parser.isSet("no-text"),
-        !parser.isSet("no-annotations"), parser.isSet("vacuum"));
+        !parser.isSet("no-annotations"), parser.isSet("vacuum"),
+        importOptions, parser.value("format"), exportShardSize, exportSince);
   }
 
   std::unique_ptr<labelbuddy::LabelBuddy> labelBuddy(
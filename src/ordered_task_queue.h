@@ -0,0 +1,93 @@
+#ifndef LABELBUDDY_ORDERED_TASK_QUEUE_H
+#define LABELBUDDY_ORDERED_TASK_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \file
+/// A pool of worker threads whose results are retrieved in submission order.
+
+namespace labelbuddy {
+
+/// Run tasks on worker threads and retrieve their results in order.
+
+/// Tasks are executed concurrently by `nThreads` worker threads, but
+/// `takeNext` always returns the result of the oldest task that has not been
+/// retrieved yet, so consumers see results in the order in which the tasks were
+/// submitted.
+///
+/// At most `maxPending` tasks can be submitted and not yet retrieved; `submit`
+/// blocks until there is room. This bounds the memory used by results when the
+/// consumer is slower than the workers. When the same thread submits and
+/// retrieves results, it must check `isFull` and call `takeNext` before
+/// submitting, otherwise it would wait for itself.
+///
+/// `Result` must be default-constructible and movable.
+template <typename Result> class OrderedTaskQueue {
+
+public:
+  OrderedTaskQueue(int nThreads, int maxPending);
+
+  /// Aborts and waits for the worker threads to finish their current task.
+  ~OrderedTaskQueue();
+
+  OrderedTaskQueue(const OrderedTaskQueue&) = delete;
+  OrderedTaskQueue& operator=(const OrderedTaskQueue&) = delete;
+
+  /// Add a task to the queue.
+
+  /// Blocks while `maxPending` results have not been retrieved. Returns false
+  /// (and discards the task) if the queue has been closed or aborted.
+  bool submit(std::function<Result()> task);
+
+  /// Retrieve the result of the oldest task that has not been retrieved yet.
+
+  /// Waits until that task is finished. Returns false if the queue has been
+  /// aborted, or if it has been closed and all results have been retrieved.
+  bool takeNext(Result& result);
+
+  /// Number of submitted tasks whose result has not been retrieved
+  int nPending() const;
+
+  /// Whether `submit` would block
+  bool isFull() const;
+
+  /// Signal that no more tasks will be submitted.
+  void close();
+
+  /// Stop as soon as possible.
+
+  /// Tasks that have not started are dropped, and blocked calls to `submit`
+  /// and `takeNext` return false.
+  void abort();
+
+private:
+  struct Slot {
+    bool done = false;
+    Result result{};
+  };
+
+  void runWorker();
+
+  std::deque<std::pair<Slot*, std::function<Result()>>> tasks_{};
+  std::deque<std::unique_ptr<Slot>> slots_{};
+  std::vector<std::thread> workers_{};
+  mutable std::mutex mutex_{};
+  std::condition_variable taskAvailable_{};
+  std::condition_variable resultReady_{};
+  std::condition_variable roomAvailable_{};
+  std::size_t maxPending_;
+  bool closed_{};
+  bool aborted_{};
+};
+
+} // namespace labelbuddy
+
+#include "ordered_task_queue.tpp"
+
+#endif
@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "ordered_task_queue.h"
+
+namespace labelbuddy {
+
+template <typename Result>
+OrderedTaskQueue<Result>::OrderedTaskQueue(int nThreads, int maxPending)
+    : maxPending_{static_cast<std::size_t>(std::max(1, maxPending))} {
+  for (int i = 0; i < std::max(1, nThreads); ++i) {
+    workers_.emplace_back(&OrderedTaskQueue<Result>::runWorker, this);
+  }
+}
+
+template <typename Result> OrderedTaskQueue<Result>::~OrderedTaskQueue() {
+  abort();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+template <typename Result>
+bool OrderedTaskQueue<Result>::submit(std::function<Result()> task) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  roomAvailable_.wait(lock, [this]() {
+    return aborted_ || closed_ || slots_.size() < maxPending_;
+  });
+  if (aborted_ || closed_) {
+    return false;
+  }
+  std::unique_ptr<Slot> slot(new Slot);
+  tasks_.emplace_back(slot.get(), std::move(task));
+  slots_.push_back(std::move(slot));
+  taskAvailable_.notify_one();
+  return true;
+}
+
+template <typename Result>
+bool OrderedTaskQueue<Result>::takeNext(Result& result) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  resultReady_.wait(lock, [this]() {
+    return aborted_ || (slots_.empty() && closed_) ||
+           (!slots_.empty() && slots_.front()->done);
+  });
+  if (aborted_ || slots_.empty()) {
+    return false;
+  }
+  result = std::move(slots_.front()->result);
+  slots_.pop_front();
+  roomAvailable_.notify_one();
+  return true;
+}
+
+template <typename Result> int OrderedTaskQueue<Result>::nPending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<int>(slots_.size());
+}
+
+template <typename Result> bool OrderedTaskQueue<Result>::isFull() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return slots_.size() >= maxPending_;
+}
+
+template <typename Result> void OrderedTaskQueue<Result>::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  roomAvailable_.notify_all();
+  resultReady_.notify_all();
+}
+
+template <typename Result> void OrderedTaskQueue<Result>::abort() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  aborted_ = true;
+  tasks_.clear();
+  taskAvailable_.notify_all();
+  roomAvailable_.notify_all();
+  resultReady_.notify_all();
+}
+
+template <typename Result> void OrderedTaskQueue<Result>::runWorker() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    taskAvailable_.wait(lock,
+                        [this]() { return aborted_ || !tasks_.empty(); });
+    if (aborted_) {
+      return;
+    }
+    auto slot = tasks_.front().first;
+    auto task = std::move(tasks_.front().second);
+    tasks_.pop_front();
+    lock.unlock();
+    auto result = task();
+    lock.lock();
+    // the slot is not done yet so takeNext cannot have removed it
+    slot->result = std::move(result);
+    slot->done = true;
+    resultReady_.notify_all();
+  }
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,148 @@
+#include <utility>
+
+#include <QByteArray>
+#include <QList>
+
+#include "parallel_docs_reader.h"
+
+namespace labelbuddy {
+
+constexpr int ParallelDocsReader::batchSize_;
+
+ParallelDocsReader::ParallelDocsReader(std::unique_ptr<DocsReader> source,
+                                       int nThreads, bool trackPositions,
+                                       int maxPendingBatches)
+    : source_(std::move(source)),
+      queue_(nThreads,
+             maxPendingBatches > 0 ? maxPendingBatches : 2 * nThreads),
+      trackPositions_{trackPositions} {
+  sourceIsOpen_ = source_->isOpen();
+  progressMax_ = source_->progressMax();
+  setSkipInvalid(source_->isSkippingInvalid());
+  if (source_->hasError()) {
+    setError(source_->errorCode(), source_->errorMessage());
+    queue_.close();
+    return;
+  }
+  position_ = source_->position();
+  producer_ = std::thread(&ParallelDocsReader::produce, this);
+}
+
+ParallelDocsReader::~ParallelDocsReader() {
+  queue_.abort();
+  if (producer_.joinable()) {
+    producer_.join();
+  }
+}
+
+bool ParallelDocsReader::isOpen() const { return sourceIsOpen_; }
+
+int ParallelDocsReader::progressMax() const { return progressMax_; }
+
+int ParallelDocsReader::currentProgress() const { return progress_.load(); }
+
+qint64 ParallelDocsReader::position() const { return position_; }
+
+bool ParallelDocsReader::seek(qint64 position) {
+  Q_UNUSED(position);
+  return false;
+}
+
+void ParallelDocsReader::produce() {
+  const DocsReader* source = source_.get();
+  auto readRaw = source_->canReadRaw();
+  auto skipInvalid = source_->isSkippingInvalid();
+  bool atEnd{};
+  while (!atEnd) {
+    // raw documents to parse, or records already parsed by the wrapped reader
+    std::shared_ptr<std::vector<ParsedDoc>> docs(new std::vector<ParsedDoc>);
+    for (int i = 0; i < batchSize_; ++i) {
+      ParsedDoc doc{};
+      if (readRaw) {
+        if (!source_->readRaw(doc.rawDoc)) {
+          atEnd = true;
+          break;
+        }
+      } else {
+        if (!source_->readNext()) {
+          atEnd = true;
+          break;
+        }
+        doc.record = source_->takeCurrentRecord();
+      }
+      if (trackPositions_) {
+        doc.endPosition = source_->position();
+      }
+      docs->push_back(std::move(doc));
+    }
+    progress_.store(source_->currentProgress());
+    if (docs->empty()) {
+      break;
+    }
+    if (!trackPositions_) {
+      docs->back().endPosition = source_->position();
+    }
+    std::function<ParsedDocsBatch()> task =
+        [source, docs, readRaw, skipInvalid]() {
+          ParsedDocsBatch batch{};
+          for (auto& doc : *docs) {
+            if (readRaw) {
+              doc.record = source->parseRaw(doc.rawDoc);
+              if (doc.record == nullptr && !skipInvalid) {
+                batch.hasError = true;
+                batch.errorMessage = source->parseErrorMessage();
+                break;
+              }
+              if (doc.record != nullptr) {
+                doc.rawDoc.clear();
+              }
+            }
+            if (doc.record != nullptr) {
+              computeContentMd5(*doc.record);
+            }
+            batch.docs.push_back(std::move(doc));
+          }
+          return batch;
+        };
+    if (!queue_.submit(task)) {
+      return;
+    }
+  }
+  // the wrapped reader's own errors (if any) are reported by `readNext` once
+  // all the batches have been consumed
+  queue_.close();
+}
+
+bool ParallelDocsReader::readNext() {
+  while (!hasError()) {
+    if (positionInBatch_ == currentBatch_.docs.size()) {
+      if (currentBatch_.hasError) {
+        setError(ErrorCode::CriticalParsingError, currentBatch_.errorMessage);
+        return false;
+      }
+      if (!queue_.takeNext(currentBatch_)) {
+        // the producer has finished so reading the wrapped reader is safe
+        if (source_->hasError()) {
+          setError(source_->errorCode(), source_->errorMessage());
+        }
+        return false;
+      }
+      positionInBatch_ = 0;
+      continue;
+    }
+    auto& doc = currentBatch_.docs[positionInBatch_];
+    ++positionInBatch_;
+    if (doc.endPosition != -1) {
+      position_ = doc.endPosition;
+    }
+    if (doc.record == nullptr) {
+      addRejectedDoc(doc.rawDoc);
+      continue;
+    }
+    setCurrentRecord(std::move(doc.record));
+    return true;
+  }
+  return false;
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,100 @@
+#ifndef LABELBUDDY_PARALLEL_DOCS_READER_H
+#define LABELBUDDY_PARALLEL_DOCS_READER_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <QString>
+
+#include "database_impl.h"
+#include "ordered_task_queue.h"
+
+/// \file
+/// Reading and parsing documents on several threads during imports.
+
+namespace labelbuddy {
+
+/// A document parsed by a worker thread.
+struct ParsedDoc {
+  /// nullptr if the document could not be parsed and was skipped
+  std::unique_ptr<DocRecord> record{};
+
+  /// raw content, only kept if the document was skipped
+  QByteArray rawDoc{};
+
+  /// position of the wrapped reader after this document, -1 if not tracked
+  qint64 endPosition{-1};
+};
+
+/// Documents parsed by a worker thread.
+
+/// If `hasError` is true, parsing failed after the last document in `docs`.
+struct ParsedDocsBatch {
+  std::vector<ParsedDoc> docs{};
+  bool hasError{};
+  QString errorMessage{};
+};
+
+/// Reads documents from another reader using a pool of worker threads.
+
+/// A producer thread reads batches of unparsed documents from the wrapped
+/// reader, and the worker threads parse them and compute their MD5 checksums.
+/// `readNext` returns the records in the same order as the wrapped reader
+/// would, so the thread that inserts them in the database (the one that owns
+/// the connection) sees exactly the same sequence as with a sequential import.
+///
+/// If the wrapped reader cannot separate reading from parsing
+/// (`canReadRaw()` is false), the producer reads full records and the workers
+/// only compute the checksums.
+///
+/// The number of batches that have been read but not consumed by `readNext` is
+/// bounded (by `maxPendingBatches`, or twice the number of threads if it is
+/// 0), so memory usage does not depend on the size of the input.
+///
+/// Whether invalid documents are skipped is taken from the wrapped reader when
+/// the `ParallelDocsReader` is created. If `trackPositions` is true, the
+/// wrapped reader's position is recorded after every document so that
+/// `position` is exact; otherwise it is only updated once per batch.
+class ParallelDocsReader : public DocsReader {
+
+public:
+  ParallelDocsReader(std::unique_ptr<DocsReader> source, int nThreads,
+                     bool trackPositions = false, int maxPendingBatches = 0);
+
+  /// Stops the producer and worker threads.
+  ~ParallelDocsReader() override;
+
+  bool isOpen() const override;
+  bool readNext() override;
+  int progressMax() const override;
+  int currentProgress() const override;
+
+  /// Position of the wrapped reader after the last document consumed by
+  /// `readNext`
+  qint64 position() const override;
+
+  /// Not supported: seek the wrapped reader before creating this one
+  bool seek(qint64 position) override;
+
+private:
+  static constexpr int batchSize_{256};
+
+  void produce();
+
+  std::unique_ptr<DocsReader> source_;
+  OrderedTaskQueue<ParsedDocsBatch> queue_;
+  std::thread producer_{};
+  ParsedDocsBatch currentBatch_{};
+  std::size_t positionInBatch_{};
+  std::atomic<int> progress_{0};
+  qint64 position_{};
+  bool trackPositions_{};
+  bool sourceIsOpen_{};
+  int progressMax_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+
+#include "progress_reporter.h"
+
+namespace labelbuddy {
+
+constexpr qint64 ProgressReporter::terminalIntervalMs;
+constexpr qint64 ProgressReporter::jsonLinesIntervalMs;
+
+namespace {
+
+bool isTerminal(FILE* stream) {
+#ifdef _WIN32
+  return _isatty(_fileno(stream)) != 0;
+#else
+  return isatty(fileno(stream)) != 0;
+#endif
+}
+
+/// Eg "1:05:03" or "5:03"
+std::string formatDuration(double seconds) {
+  auto total = static_cast<long long>(seconds + .5);
+  std::ostringstream formatted{};
+  if (total >= 3600) {
+    formatted << total / 3600 << ":" << std::setw(2) << std::setfill('0');
+  }
+  formatted << (total % 3600) / 60 << ":" << std::setw(2) << std::setfill('0')
+            << total % 60;
+  return formatted.str();
+}
+
+} // namespace
+
+ProgressReporter::ProgressReporter(const QString& operation, Mode mode,
+                                   std::ostream& out)
+    : operation_{operation}, mode_{mode}, out_(out),
+      intervalMs_{mode == Mode::Terminal ? terminalIntervalMs
+                                         : jsonLinesIntervalMs} {
+  timer_.start();
+}
+
+ProgressReporter::Mode ProgressReporter::defaultMode() {
+  auto stream = std::cout.rdbuf() == std::cerr.rdbuf() ? stderr : stdout;
+  return isTerminal(stream) ? Mode::Terminal : Mode::JsonLines;
+}
+
+bool ProgressReporter::isDue() const {
+  return timer_.elapsed() - lastReportMs_ >= intervalMs_;
+}
+
+void ProgressReporter::report(qint64 nDocs, qint64 nBytes,
+                              double fractionDone) {
+  lastReportMs_ = timer_.elapsed();
+  write(nDocs, nBytes, fractionDone, false);
+}
+
+void ProgressReporter::finish(qint64 nDocs, qint64 nBytes) {
+  write(nDocs, nBytes, 1., true);
+}
+
+void ProgressReporter::write(qint64 nDocs, qint64 nBytes, double fractionDone,
+                             bool done) {
+  auto elapsed = static_cast<double>(timer_.elapsed()) / 1000.;
+  auto seconds = elapsed > 0. ? elapsed : 1e-3;
+  auto docsPerSecond = static_cast<double>(nDocs) / seconds;
+  auto mbPerSecond = static_cast<double>(nBytes) / 1e6 / seconds;
+  bool hasEta = !done && fractionDone > 0.;
+  auto eta = hasEta ? elapsed * (1. - fractionDone) / fractionDone : 0.;
+
+  if (mode_ == Mode::JsonLines) {
+    QJsonObject line{};
+    line["operation"] = operation_;
+    line["docs"] = nDocs;
+    line["bytes"] = nBytes;
+    line["elapsed_s"] = elapsed;
+    line["docs_per_s"] = docsPerSecond;
+    line["mb_per_s"] = mbPerSecond;
+    line["eta_s"] = hasEta ? QJsonValue(eta) : QJsonValue();
+    line["done"] = done;
+    out_ << QJsonDocument(line).toJson(QJsonDocument::Compact).constData()
+         << std::endl;
+    return;
+  }
+  std::ostringstream text{};
+  text << operation_.toStdString() << ": " << nDocs << " documents, "
+       << std::fixed << std::setprecision(1)
+       << static_cast<double>(nBytes) / 1e6 << " MB ("
+       << static_cast<qint64>(docsPerSecond) << " docs/s, " << mbPerSecond
+       << " MB/s";
+  if (hasEta) {
+    text << ", ETA " << formatDuration(eta);
+  } else if (done) {
+    text << ", " << formatDuration(elapsed);
+  }
+  text << ")";
+  auto line = text.str();
+  auto length = line.size();
+  if (length < lineLength_) {
+    // erase the end of the previous, longer line
+    line.append(lineLength_ - length, ' ');
+  }
+  lineLength_ = length;
+  out_ << "\r" << line;
+  if (done) {
+    out_ << std::endl;
+  } else {
+    out_ << std::flush;
+  }
+}
+
+} // namespace labelbuddy
@@ -0,0 +1,76 @@
+#ifndef LABELBUDDY_PROGRESS_REPORTER_H
+#define LABELBUDDY_PROGRESS_REPORTER_H
+
+#include <iostream>
+
+#include <QElapsedTimer>
+#include <QString>
+
+/// \file
+/// Progress and throughput of command-line imports and exports.
+
+namespace labelbuddy {
+
+/// Reports how many documents and bytes an operation has processed.
+
+/// `isDue` can be called for every document: it only checks a monotonic
+/// clock, and returns true at most every `terminalIntervalMs` (or
+/// `jsonLinesIntervalMs` in JSON lines mode), when the caller gathers the
+/// numbers and calls `report`. Each report shows the throughput in documents
+/// and megabytes per second, and an estimated time remaining when the
+/// fraction of work done is known.
+///
+/// In `Terminal` mode a single line is rewritten in place, and `finish` ends
+/// it with a newline. In `JsonLines` mode, used when the output is not a
+/// terminal, each report is a JSON object on its own line, for example:
+///
+///     {"operation":"import","docs":1200,"bytes":5300000,"elapsed_s":1.0,
+///      "docs_per_s":1200,"mb_per_s":5.3,"eta_s":3.2,"done":false}
+///
+/// (on a single line) where `eta_s` is null when it is unknown.
+class ProgressReporter {
+
+public:
+  enum class Mode { Terminal, JsonLines };
+
+  static constexpr qint64 terminalIntervalMs = 100;
+  static constexpr qint64 jsonLinesIntervalMs = 1000;
+
+  /// `operation` names the operation in the reports, eg "import"
+  explicit ProgressReporter(const QString& operation,
+                            Mode mode = defaultMode(),
+                            std::ostream& out = std::cout);
+
+  /// `Terminal` if `std::cout` writes to a terminal, `JsonLines` otherwise.
+
+  /// While `std::cout` is redirected to `std::cerr` (when documents are
+  /// exported to the standard output), the standard error is checked.
+  static Mode defaultMode();
+
+  /// Whether the last report is old enough for a new one
+  bool isDue() const;
+
+  /// Write a report.
+
+  /// `fractionDone` is in [0, 1], or negative if it is unknown.
+  void report(qint64 nDocs, qint64 nBytes, double fractionDone = -1.);
+
+  /// Write the final report.
+  void finish(qint64 nDocs, qint64 nBytes);
+
+private:
+  void write(qint64 nDocs, qint64 nBytes, double fractionDone, bool done);
+
+  QString operation_;
+  Mode mode_;
+  std::ostream& out_;
+  QElapsedTimer timer_{};
+  qint64 intervalMs_;
+  qint64 lastReportMs_{};
+  /// length of the line last written in terminal mode, to erase it
+  std::size_t lineLength_{};
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef LABELBUDDY_SIMD_H
+#define LABELBUDDY_SIMD_H
+
+/// \file
+/// SIMD instructions available to the text scanning functions.
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LABELBUDDY_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace labelbuddy {
+
+#ifdef LABELBUDDY_SSE2
+
+/// Index of the lowest set bit of a non-zero mask
+inline int countTrailingZeros(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long index{};
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+#endif
+
+} // namespace labelbuddy
+
+#endif
@@ -0,0 +1,158 @@
+#include <QChar>
+
+#include "simd.h"
+#include "utf8.h"
+
+namespace labelbuddy {
+
+void widenAscii(const char* src, const char* srcEnd, ushort* dest) {
+#ifdef LABELBUDDY_SSE2
+  const auto zero = _mm_setzero_si128();
+  while (srcEnd - src >= 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),
+                     _mm_unpacklo_epi8(chunk, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 8),
+                     _mm_unpackhi_epi8(chunk, zero));
+    src += 16;
+    dest += 16;
+  }
+#endif
+  while (src != srcEnd) {
+    *dest++ = static_cast<unsigned char>(*src++);
+  }
+}
+
+const char* findNonAscii(const char* pos, const char* end) {
+#ifdef LABELBUDDY_SSE2
+  while (end - pos >= 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    // the high bit of each byte
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(chunk));
+    if (mask != 0) {
+      return pos + countTrailingZeros(mask);
+    }
+    pos += 16;
+  }
+#endif
+  while (pos != end && static_cast<unsigned char>(*pos) < 0x80) {
+    ++pos;
+  }
+  return pos;
+}
+
+namespace {
+
+bool isContinuationByte(unsigned char c) { return (c & 0xc0) == 0x80; }
+
+} // namespace
+
+int utf8SequenceLength(const char* pos, const char* end) {
+  auto s = reinterpret_cast<const unsigned char*>(pos);
+  auto available = end - pos;
+  if (s[0] < 0xc2) {
+    return 0;
+  }
+  if (s[0] < 0xe0) {
+    return (available >= 2 && isContinuationByte(s[1])) ? 2 : 0;
+  }
+  if (s[0] < 0xf0) {
+    if (available < 3 || !isContinuationByte(s[1]) ||
+        !isContinuationByte(s[2])) {
+      return 0;
+    }
+    if ((s[0] == 0xe0 && s[1] < 0xa0) || (s[0] == 0xed && s[1] >= 0xa0)) {
+      return 0;
+    }
+    return 3;
+  }
+  if (s[0] < 0xf5) {
+    if (available < 4 || !isContinuationByte(s[1]) ||
+        !isContinuationByte(s[2]) || !isContinuationByte(s[3])) {
+      return 0;
+    }
+    if ((s[0] == 0xf0 && s[1] < 0x90) || (s[0] == 0xf4 && s[1] >= 0x90)) {
+      return 0;
+    }
+    return 4;
+  }
+  return 0;
+}
+
+ushort* decodeUtf8Sequence(const char* pos, int length, ushort* dest) {
+  auto s = reinterpret_cast<const unsigned char*>(pos);
+  uint codePoint{};
+  switch (length) {
+  case 2:
+    codePoint = ((s[0] & 0x1fu) << 6) | (s[1] & 0x3fu);
+    break;
+  case 3:
+    codePoint = ((s[0] & 0x0fu) << 12) | ((s[1] & 0x3fu) << 6) | (s[2] & 0x3fu);
+    break;
+  default:
+    codePoint = ((s[0] & 0x07u) << 18) | ((s[1] & 0x3fu) << 12) |
+                ((s[2] & 0x3fu) << 6) | (s[3] & 0x3fu);
+    break;
+  }
+  if (QChar::requiresSurrogates(codePoint)) {
+    *dest++ = QChar::highSurrogate(codePoint);
+    *dest++ = QChar::lowSurrogate(codePoint);
+  } else {
+    *dest++ = static_cast<ushort>(codePoint);
+  }
+  return dest;
+}
+
+char* encodeUtf8(uint codePoint, char* dest) {
+  if (codePoint < 0x80) {
+    *dest++ = static_cast<char>(codePoint);
+  } else if (codePoint < 0x800) {
+    *dest++ = static_cast<char>(0xc0 | (codePoint >> 6));
+    *dest++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+  } else if (codePoint < 0x10000) {
+    *dest++ = static_cast<char>(0xe0 | (codePoint >> 12));
+    *dest++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+    *dest++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+  } else {
+    *dest++ = static_cast<char>(0xf0 | (codePoint >> 18));
+    *dest++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+    *dest++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+    *dest++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+  }
+  return dest;
+}
+
+bool decodeUtf8(const char* text, int size, QString& result) {
+  // a UTF-8 sequence never has fewer bytes than UTF-16 code units
+  result.resize(size);
+  auto begin = reinterpret_cast<ushort*>(result.data());
+  auto dest = begin;
+  auto pos = text;
+  auto end = text + size;
+  while (pos != end) {
+    auto nonAscii = findNonAscii(pos, end);
+    widenAscii(pos, nonAscii, dest);
+    dest += nonAscii - pos;
+    pos = nonAscii;
+    while (pos != end && static_cast<unsigned char>(*pos) >= 0x80) {
+      auto length = utf8SequenceLength(pos, end);
+      if (length == 0) {
+        return false;
+      }
+      dest = decodeUtf8Sequence(pos, length, dest);
+      pos += length;
+    }
+  }
+  result.resize(static_cast<int>(dest - begin));
+  return true;
+}
+
+QString decodeUtf8(const QByteArray& text) {
+  QString result{};
+  if (!decodeUtf8(text.constData(), text.size(), result)) {
+    result = QString::fromUtf8(text.constData(), text.size());
+  }
+  return result;
+}
+
+} // namespace labelbuddy
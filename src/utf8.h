@@ -0,0 +1,49 @@
+#ifndef LABELBUDDY_UTF8_H
+#define LABELBUDDY_UTF8_H
+
+#include <QByteArray>
+#include <QString>
+
+/// \file
+/// Decoding UTF-8 directly into UTF-16 buffers and `QString`s, and encoding
+/// code points as UTF-8.
+
+namespace labelbuddy {
+
+/// Copy ASCII characters to UTF-16
+void widenAscii(const char* src, const char* srcEnd, ushort* dest);
+
+/// First byte in [pos, end) that is not ASCII, or `end`
+const char* findNonAscii(const char* pos, const char* end);
+
+/// Length of the UTF-8 sequence starting at `pos`, 0 if it is invalid.
+
+/// Overlong encodings, surrogates and code points above U+10FFFF are invalid,
+/// as in Qt's UTF-8 decoder and the QJsonDocument parser.
+int utf8SequenceLength(const char* pos, const char* end);
+
+/// Decode a valid UTF-8 sequence of `length` bytes; returns the new `dest`
+ushort* decodeUtf8Sequence(const char* pos, int length, ushort* dest);
+
+/// Encode a code point that is not a surrogate; returns the new `dest`
+char* encodeUtf8(uint codePoint, char* dest);
+
+/// Decode UTF-8 text into `result`.
+
+/// The memory already allocated by `result` is reused when it is large enough
+/// and not shared, and runs of ASCII characters are copied 16 bytes at a time
+/// with SSE2 when it is available. Returns false if the text is not valid
+/// UTF-8, in which case `result` is left in an unspecified state and the text
+/// should be decoded with `QString::fromUtf8`, which replaces the invalid
+/// sequences.
+bool decodeUtf8(const char* text, int size, QString& result);
+
+/// Decode UTF-8 text.
+
+/// Unlike `QString::fromUtf8`, a byte order mark at the start and null bytes
+/// are kept. Invalid sequences are replaced as by `QString::fromUtf8`.
+QString decodeUtf8(const QByteArray& text);
+
+} // namespace labelbuddy
+
+#endif
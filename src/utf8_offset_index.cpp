@@ -0,0 +1,160 @@
+#include <limits>
+
+#include "utf8.h"
+#include "utf8_offset_index.h"
+
+namespace labelbuddy {
+
+bool Utf8OffsetIndex::setText(const QByteArray& utf8Text) {
+  unicodeStarts_.assign(1, 0);
+  utf8Starts_.assign(1, 0);
+  const auto* pos = utf8Text.constData();
+  const auto* end = pos + utf8Text.size();
+  while (pos != end) {
+    const auto* asciiEnd = findNonAscii(pos, end);
+    if (asciiEnd != pos) {
+      appendRun(static_cast<int>(asciiEnd - pos), 1);
+      pos = asciiEnd;
+      continue;
+    }
+    auto length = utf8SequenceLength(pos, end);
+    if (length == 0) {
+      unicodeStarts_.assign(1, 0);
+      utf8Starts_.assign(1, 0);
+      return false;
+    }
+    appendRun(1, length);
+    pos += length;
+  }
+  return true;
+}
+
+void Utf8OffsetIndex::appendRun(int length, int size) {
+  auto nRuns = unicodeStarts_.size() - 1;
+  if (nRuns != 0 && charSize(nRuns - 1) == size) {
+    // extend the last run
+    unicodeStarts_.back() += length;
+    utf8Starts_.back() += length * size;
+    return;
+  }
+  unicodeStarts_.push_back(unicodeStarts_.back() + length);
+  utf8Starts_.push_back(utf8Starts_.back() + length * size);
+}
+
+int Utf8OffsetIndex::charSize(std::size_t run) const {
+  return (utf8Starts_[run + 1] - utf8Starts_[run]) /
+         (unicodeStarts_[run + 1] - unicodeStarts_[run]);
+}
+
+QByteArray Utf8OffsetIndex::toBytes() const {
+  QByteArray bytes{};
+  for (std::size_t run = 0; run + 1 < unicodeStarts_.size(); ++run) {
+    // LEB128: 7 bits per byte, the high bit is set if more bytes follow
+    auto value = (static_cast<quint64>(unicodeStarts_[run + 1] -
+                                       unicodeStarts_[run])
+                  << 2) |
+                 static_cast<quint64>(charSize(run) - 1);
+    while (value >= 0x80) {
+      bytes.append(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    bytes.append(static_cast<char>(value));
+  }
+  return bytes;
+}
+
+bool Utf8OffsetIndex::fromBytes(const QByteArray& bytes) {
+  unicodeStarts_.assign(1, 0);
+  utf8Starts_.assign(1, 0);
+  qint64 unicodeLength{};
+  qint64 utf8Length{};
+  quint64 value{};
+  int shift{};
+  for (auto byte : bytes) {
+    auto bits = static_cast<unsigned char>(byte);
+    value |= static_cast<quint64>(bits & 0x7f) << shift;
+    shift += 7;
+    if (bits & 0x80) {
+      if (shift > 35) {
+        break;
+      }
+      continue;
+    }
+    auto length = static_cast<qint64>(value >> 2);
+    auto charSize = static_cast<int>(value & 3) + 1;
+    unicodeLength += length;
+    utf8Length += length * charSize;
+    if (length == 0 || utf8Length > std::numeric_limits<int>::max()) {
+      break;
+    }
+    appendRun(static_cast<int>(length), charSize);
+    value = 0;
+    shift = 0;
+  }
+  if (shift != 0 || utf8Starts_.back() != utf8Length) {
+    unicodeStarts_.assign(1, 0);
+    utf8Starts_.assign(1, 0);
+    return false;
+  }
+  return true;
+}
+
+int Utf8OffsetIndex::unicodeLength() const { return unicodeStarts_.back(); }
+
+int Utf8OffsetIndex::utf8Length() const { return utf8Starts_.back(); }
+
+bool Utf8OffsetIndex::isValidUnicodeIndex(int index) const {
+  return 0 <= index && index <= unicodeLength();
+}
+
+std::vector<int> Utf8OffsetIndex::unicodeToUtf8Sorted(
+    const std::vector<int>& unicodeIndices) const {
+  std::vector<int> utf8Indices{};
+  utf8Indices.reserve(unicodeIndices.size());
+  auto nRuns = unicodeStarts_.size() - 1;
+  std::size_t run{};
+  for (auto target : unicodeIndices) {
+    if (!isValidUnicodeIndex(target)) {
+      utf8Indices.push_back(-1);
+      continue;
+    }
+    if (nRuns == 0) {
+      utf8Indices.push_back(0);
+      continue;
+    }
+    while (run + 1 < nRuns && unicodeStarts_[run + 1] <= target) {
+      ++run;
+    }
+    utf8Indices.push_back(utf8Starts_[run] +
+                          (target - unicodeStarts_[run]) * charSize(run));
+  }
+  return utf8Indices;
+}
+
+std::vector<int> Utf8OffsetIndex::utf8ToUnicodeSorted(
+    const std::vector<int>& utf8Indices) const {
+  std::vector<int> unicodeIndices{};
+  unicodeIndices.reserve(utf8Indices.size());
+  auto nRuns = unicodeStarts_.size() - 1;
+  std::size_t run{};
+  for (auto target : utf8Indices) {
+    if (target < 0 || target > utf8Length()) {
+      unicodeIndices.push_back(-1);
+      continue;
+    }
+    if (nRuns == 0) {
+      unicodeIndices.push_back(0);
+      continue;
+    }
+    while (run + 1 < nRuns && utf8Starts_[run + 1] <= target) {
+      ++run;
+    }
+    auto offset = target - utf8Starts_[run];
+    auto size = charSize(run);
+    unicodeIndices.push_back(
+        offset % size == 0 ? unicodeStarts_[run] + offset / size : -1);
+  }
+  return unicodeIndices;
+}
+
+} // namespace labelbuddy
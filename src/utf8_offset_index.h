@@ -0,0 +1,81 @@
+#ifndef LABELBUDDY_UTF8_OFFSET_INDEX_H
+#define LABELBUDDY_UTF8_OFFSET_INDEX_H
+
+#include <cstddef>
+#include <vector>
+
+#include <QByteArray>
+
+/// \file
+/// Conversions between Unicode and UTF-8 positions of a document without its
+/// text.
+
+namespace labelbuddy {
+
+/// Where the multi-byte characters of a UTF-8 text are, as runs of characters.
+
+/// The text is split into runs of consecutive characters that have the same
+/// UTF-8 length (1 byte for ASCII, 2 for most accented Latin letters, 3 for
+/// most CJK characters, 4 for emoji and other characters outside of the Basic
+/// Multilingual Plane). Knowing where each run starts in Unicode chars and in
+/// bytes is enough to convert any position, so annotation positions can be
+/// converted without reading or decoding the text.
+///
+/// The index is built from the document's UTF-8 when it is imported and
+/// stored next to it in the `document_utf8_index` table. `toBytes` stores
+/// each run as a variable-length integer holding its length and its
+/// characters' UTF-8 length, so an ASCII document takes a few bytes and an
+/// accented letter in an English text takes about 2.
+class Utf8OffsetIndex {
+
+public:
+  Utf8OffsetIndex() = default;
+
+  /// Index a UTF-8 text; returns false if it is not valid UTF-8.
+  bool setText(const QByteArray& utf8Text);
+
+  /// Read an index stored with `toBytes`; returns false if it is not one.
+  bool fromBytes(const QByteArray& bytes);
+
+  QByteArray toBytes() const;
+
+  /// Length of text as string of Unicode chars.
+  int unicodeLength() const;
+
+  /// Length (in bytes) of UTF-8 encoded text.
+  int utf8Length() const;
+
+  /// Whether a Unicode char position is valid for this text.
+  bool isValidUnicodeIndex(int index) const;
+
+  /// Convert sorted indices in Unicode string to indices in UTF-8 text.
+
+  /// Same as `CharIndices::unicodeToUtf8Sorted`: `unicodeIndices` must be in
+  /// increasing order and invalid indices give -1. Linear in the number of
+  /// indices and runs.
+  std::vector<int>
+  unicodeToUtf8Sorted(const std::vector<int>& unicodeIndices) const;
+
+  /// Convert sorted indices in UTF-8 text to indices in Unicode string.
+
+  /// Same as `CharIndices::utf8ToUnicodeSorted`: positions out of range or in
+  /// the middle of a multi-byte sequence give -1.
+  std::vector<int>
+  utf8ToUnicodeSorted(const std::vector<int>& utf8Indices) const;
+
+private:
+  /// start of each run in Unicode chars and in bytes, followed by the lengths
+  /// of the text
+  std::vector<int> unicodeStarts_{0};
+  std::vector<int> utf8Starts_{0};
+
+  /// UTF-8 length of the characters in run `run`
+  int charSize(std::size_t run) const;
+
+  /// Append a run of `length` characters of `size` bytes each
+  void appendRun(int length, int size);
+};
+
+} // namespace labelbuddy
+
+#endif
@@ -67,10 +67,40 @@ void prepareParser(QCommandLineParser& parser) {
   parser.addOption({"import-docs",
                     "Docs & annotations file to import in database.",
                     "docs file"});
+  parser.addOption({"threads",
+                    "Number of threads used to parse imported documents "
+                    "and serialize exported documents.",
+                    "number of threads", "1"});
+  parser.addOption({"bulk-load", "Drop indexes and relax durability while "
+                                 "importing docs, for very large imports."});
+  parser.addOption({"batch-size",
+                    "Commit imported docs in batches of this size (0: commit "
+                    "once at the end).",
+                    "number of docs", "0"});
+  parser.addOption({"rejects",
+                    "Skip invalid imported docs and append them to this file.",
+                    "rejects file"});
+  parser.addOption(
+      {"resume", "Resume an interrupted import of the same docs file."});
+  parser.addOption({"dry-run", "Check the imported docs and report what "
+                               "would be imported, without modifying the "
+                               "database."});
+  parser.addOption({"format",
+                    "Format (json, jsonl or txt) of the docs imported from or "
+                    "exported to '-' (standard input or output).",
+                    "format"});
   parser.addOption(
       {"export-labels", "Labels file to export to.", "exported labels file"});
   parser.addOption({"export-docs", "Docs & annotations file to export to.",
                     "exported docs file"});
+  parser.addOption({"export-shard-size",
+                    "Split exported docs in files of this many docs (eg "
+                    "10000) or megabytes (eg 100MB), listed in a manifest.",
+                    "size"});
+  parser.addOption({"export-since",
+                    "Export only docs changed since this watermark, printed "
+                    "by a previous export, and the checksums of deleted docs.",
+                    "watermark"});
   parser.addOption({"labelled-only", "Export only labelled documents."});
   parser.addOption({"no-text", "Do not include doc text when exporting."});
   parser.addOption(
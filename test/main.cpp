@@ -11,6 +11,7 @@
 #include "test_doc_list.h"
 #include "test_doc_list_model.h"
 #include "test_import_export_menu.h"
+#include "test_json_writer.h"
 #include "test_label_list.h"
 #include "test_label_list_model.h"
 #include "test_main_window.h"
@@ -42,5 +43,6 @@ int main(int argc, char* argv[]) {
   status |= QTest::qExec(new labelbuddy::TestCharIndices, argc, argv);
   status |= QTest::qExec(new labelbuddy::TestAnnotationsListModel, argc, argv);
   status |= QTest::qExec(new labelbuddy::TestAnnotationsList, argc, argv);
+  status |= QTest::qExec(new labelbuddy::TestJsonWriter, argc, argv);
   return status;
 }
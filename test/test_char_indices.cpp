@@ -1,9 +1,12 @@
+#include <vector>
+
 #include <QList>
 #include <QMap>
 #include <QTest>
 
 #include "char_indices.h"
 #include "test_char_indices.h"
+#include "utf8_offset_index.h"
 
 namespace labelbuddy {
 
@@ -88,6 +91,124 @@ void TestCharIndices::testQStringToUnicodeSingle() {
   }
 }
 
+void TestCharIndices::testSingleMatchesBatch() {
+  // surrogate pairs at the start, end, and next to each other
+  CharIndices charIndices{"😀a😀😀é😀bc𝄞"};
+  QList<int> unicodeIndices{};
+  for (int i = 0; i <= charIndices.unicodeLength(); ++i) {
+    unicodeIndices << i;
+  }
+  auto unicodeToQString = charIndices.unicodeToQString(
+      unicodeIndices.cbegin(), unicodeIndices.cend());
+  for (auto item = unicodeToQString.cbegin(); item != unicodeToQString.cend();
+       ++item) {
+    QCOMPARE(charIndices.unicodeToQString(item.key()), item.value());
+  }
+  auto qStringToUnicode = charIndices.qStringToUnicode(
+      unicodeToQString.cbegin(), unicodeToQString.cend());
+  for (auto item = qStringToUnicode.cbegin(); item != qStringToUnicode.cend();
+       ++item) {
+    QCOMPARE(charIndices.qStringToUnicode(item.key()), item.value());
+  }
+}
+
+void TestCharIndices::testSortedMatchesMaps() {
+  // unpaired surrogates are encoded as '?' and count as 1 char
+  const QChar high(0xd83d);
+  const QChar low(0xde00);
+  const QList<QString> texts{
+      "😀a😀😀é😀bc𝄞 中文 abcdefghijklmnopqrstuvwxyz é",
+      QString("a") + high + "b" + low + "é😀",
+      QString(low) + high + "😀" + high,
+      QString(high) + high + low + low};
+  for (const auto& text : texts) {
+    CharIndices charIndices{text};
+    std::vector<int> unicodeIndices{-2, -1};
+    QList<int> unicodeIndicesList{};
+    for (int i = 0; i <= charIndices.unicodeLength(); ++i) {
+      unicodeIndices.push_back(i);
+      unicodeIndices.push_back(i);
+      unicodeIndicesList << i;
+    }
+    unicodeIndices.push_back(charIndices.unicodeLength() + 1);
+    auto unicodeToUtf8Map = charIndices.unicodeToUtf8(
+        unicodeIndicesList.cbegin(), unicodeIndicesList.cend());
+    auto unicodeToUtf8 = charIndices.unicodeToUtf8Sorted(unicodeIndices);
+    QCOMPARE(unicodeToUtf8.size(), unicodeIndices.size());
+    for (std::size_t i = 0; i != unicodeIndices.size(); ++i) {
+      QCOMPARE(unicodeToUtf8[i],
+               unicodeToUtf8Map.value(unicodeIndices[i], -1));
+    }
+
+    std::vector<int> utf8Indices{-1};
+    QList<int> utf8IndicesList{};
+    for (int i = 0; i <= charIndices.utf8Length() + 1; ++i) {
+      utf8Indices.push_back(i);
+      utf8IndicesList << i;
+    }
+    auto utf8ToUnicodeMap = charIndices.utf8ToUnicode(
+        utf8IndicesList.cbegin(), utf8IndicesList.cend());
+    auto utf8ToUnicode = charIndices.utf8ToUnicodeSorted(utf8Indices);
+    QCOMPARE(utf8ToUnicode.size(), utf8Indices.size());
+    for (std::size_t i = 0; i != utf8Indices.size(); ++i) {
+      QCOMPARE(utf8ToUnicode[i], utf8ToUnicodeMap.value(utf8Indices[i], -1));
+    }
+    // the end of the text is the same position in all representations
+    QCOMPARE(utf8ToUnicode[static_cast<std::size_t>(
+                 charIndices.utf8Length() + 1)],
+             charIndices.unicodeLength());
+    QCOMPARE(charIndices.unicodeToQString(charIndices.unicodeLength()),
+             charIndices.qStringLength());
+  }
+  QCOMPARE(CharIndices(texts[1]).unicodeLength(), 6);
+  QCOMPARE(CharIndices(texts[3]).unicodeLength(), 3);
+
+  CharIndices charIndices{texts[0]};
+  // positions in the middle of a code point's bytes are invalid
+  QCOMPARE(charIndices.utf8ToUnicodeSorted({1, 4, 6}),
+           (std::vector<int>{-1, 1, -1}));
+
+  CharIndices ascii{"abc"};
+  QCOMPARE(ascii.unicodeToUtf8Sorted({-1, 0, 3, 4}),
+           (std::vector<int>{-1, 0, 3, -1}));
+  QCOMPARE(ascii.utf8ToUnicodeSorted({-1, 0, 3, 4}),
+           (std::vector<int>{-1, 0, 3, -1}));
+}
+
+void TestCharIndices::testUtf8OffsetIndex() {
+  for (const auto& text :
+       {QString(""), QString("abc"), QString("é"),
+        QString("😀a😀😀é😀bc𝄞 中文 abcdefghijklmnopqrstuvwxyz é")}) {
+    CharIndices charIndices{text};
+    Utf8OffsetIndex built{};
+    QVERIFY(built.setText(text.toUtf8()));
+    Utf8OffsetIndex utf8Index{};
+    QVERIFY(utf8Index.fromBytes(built.toBytes()));
+    QCOMPARE(utf8Index.unicodeLength(), charIndices.unicodeLength());
+    QCOMPARE(utf8Index.utf8Length(), charIndices.utf8Length());
+    std::vector<int> unicodeIndices{-1};
+    for (int i = 0; i <= charIndices.unicodeLength() + 1; ++i) {
+      unicodeIndices.push_back(i);
+    }
+    QCOMPARE(utf8Index.unicodeToUtf8Sorted(unicodeIndices),
+             charIndices.unicodeToUtf8Sorted(unicodeIndices));
+    std::vector<int> utf8Indices{-1};
+    for (int i = 0; i <= charIndices.utf8Length() + 1; ++i) {
+      utf8Indices.push_back(i);
+    }
+    QCOMPARE(utf8Index.utf8ToUnicodeSorted(utf8Indices),
+             charIndices.utf8ToUnicodeSorted(utf8Indices));
+  }
+  // one run for the ASCII text and one for the CJK characters
+  Utf8OffsetIndex utf8Index{};
+  utf8Index.setText((QString(1000, 'a') + "中文").toUtf8());
+  QCOMPARE(utf8Index.toBytes().size(), 3);
+
+  QVERIFY(!utf8Index.setText("a\xc3"));
+  QVERIFY(!utf8Index.fromBytes("\x85"));
+  QVERIFY(!utf8Index.fromBytes(QByteArray(1, '\0')));
+}
+
 void TestCharIndices::testLengths() {
   CharIndices charIndices{};
   QCOMPARE(charIndices.unicodeLength(), 0);
@@ -122,4 +243,71 @@ void TestCharIndices::testIsValid() {
   QCOMPARE(charIndices.isValidUtf8Index(10), false);
 }
 
+void TestCharIndices::testScannedBlocks() {
+  // a non-ASCII char or surrogate pair at every position of the blocks
+  // scanned at once
+  for (const auto& inserted : {"é", "😀", "é😀"}) {
+    for (int i = 0; i <= 40; ++i) {
+      auto text = QString(40, 'a').insert(i, QString::fromUtf8(inserted));
+      CharIndices charIndices{text};
+      auto nPairs =
+          QString(inserted).size() - QString(inserted).toUcs4().size();
+      QCOMPARE(charIndices.qStringLength(), text.size());
+      QCOMPARE(charIndices.unicodeLength(), text.size() - nPairs);
+      QCOMPARE(charIndices.utf8Length(), text.toUtf8().size());
+      auto end = charIndices.unicodeLength();
+      QCOMPARE(charIndices.unicodeToQString(end), text.size());
+      QCOMPARE(charIndices.qStringToUnicode(text.size()), end);
+      QList<int> indices{i, i + 1, end};
+      auto toUtf8 =
+          charIndices.unicodeToUtf8(indices.cbegin(), indices.cend());
+      QCOMPARE(toUtf8[end], text.toUtf8().size());
+      QCOMPARE(toUtf8[i], i);
+    }
+  }
+  // unpaired surrogates count as 1 char, as QString::toUtf8 encodes each of
+  // them as '?'
+  QString unpaired(20, 'a');
+  unpaired[3] = QChar(0xd83d);
+  unpaired[17] = QChar(0xde00);
+  CharIndices charIndices{unpaired};
+  QCOMPARE(charIndices.qStringLength(), 20);
+  QCOMPARE(charIndices.unicodeLength(), 20);
+  QCOMPARE(charIndices.utf8Length(), unpaired.toUtf8().size());
+  QCOMPARE(charIndices.qStringToUnicode(18), 18);
+  QCOMPARE(charIndices.unicodeToQString(4), 4);
+
+  // in valid text the positions are those of the code points, as SQLite
+  // counts them, so the positions of stored annotations do not change
+  auto valid = QString::fromUtf8("a😀bé😀😀c 中文 😀");
+  CharIndices validIndices{valid};
+  auto codePoints = valid.toUcs4();
+  QCOMPARE(validIndices.unicodeLength(), codePoints.size());
+  int qStringIndex{};
+  for (int i = 0; i != codePoints.size(); ++i) {
+    QCOMPARE(validIndices.unicodeToQString(i), qStringIndex);
+    QCOMPARE(validIndices.qStringToUnicode(qStringIndex), i);
+    qStringIndex += QChar::requiresSurrogates(codePoints[i]) ? 2 : 1;
+  }
+  QCOMPARE(qStringIndex, valid.size());
+}
+
+void TestCharIndices::testAsciiText() {
+  auto text = QString::fromLatin1("hello\0world, this is ASCII", 26);
+  CharIndices charIndices{text};
+  QCOMPARE(charIndices.utf8Length(), 26);
+  QVERIFY(charIndices.isValidUtf8Index(26));
+  QVERIFY(!charIndices.isValidUtf8Index(27));
+  QList<int> indices{-1, 0, 6, 26, 27};
+  QMap<int, int> expected{{0, 0}, {6, 6}, {26, 26}};
+  QCOMPARE(charIndices.utf8ToQString(indices.cbegin(), indices.cend()),
+           expected);
+  QCOMPARE(charIndices.utf8ToUnicode(indices.cbegin(), indices.cend()),
+           expected);
+  QCOMPARE(charIndices.qStringToUtf8(indices.cbegin(), indices.cend()),
+           expected);
+  QCOMPARE(charIndices.unicodeToUtf8(indices.cbegin(), indices.cend()),
+           expected);
+}
+
 } // namespace labelbuddy
@@ -21,9 +21,14 @@ private slots:
 
   void testUnicodeToQStringSingle();
   void testQStringToUnicodeSingle();
+  void testSingleMatchesBatch();
+  void testSortedMatchesMaps();
+  void testUtf8OffsetIndex();
 
   void testLengths();
   void testIsValid();
+  void testScannedBlocks();
+  void testAsciiText();
 };
 
 } // namespace labelbuddy
@@ -1,12 +1,26 @@
+#include <sstream>
+
+#include <QCryptographicHash>
 #include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QMap>
 #include <QSettings>
 #include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlField>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
 #include <QTemporaryDir>
 #include <QTextStream>
 
+#include "compressed_file.h"
+#include "database_impl.h"
+#include "doc_record_parser.h"
+#include "progress_reporter.h"
 #include "test_database.h"
 
 namespace labelbuddy {
@@ -271,6 +285,1585 @@ void TestDatabase::testImportAnnotations() {
   QCOMPARE(query.value(0), 4);
 }
 
+void TestDatabase::testBulkInsertAnnotations() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  QString text(300, 'a');
+  auto md5 = QString::fromLatin1(
+      QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Md5)
+          .toHex());
+  {
+    // more annotations than fit in one batch, with duplicates and bad ones
+    QStringList annotations{};
+    for (int i = 0; i < 250; ++i) {
+      annotations << QString(R"({"label_name": "l%0", "start_char": %1, )"
+                             R"("end_char": %2})")
+                         .arg(i % 3)
+                         .arg(i)
+                         .arg(i + 1);
+    }
+    annotations << R"({"label_name": "l0", "start_char": 0, "end_char": 1})";
+    annotations << R"({"label_name": "", "start_char": 0, "end_char": 2})";
+    annotations << R"({"label_name": "l3", "start_char": 0, "end_char": 301})";
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(QString(R"({"text": "%0", "annotations": [%1]})"
+                           "\n")
+                       .arg(text)
+                       .arg(annotations.join(", "))
+                       .toUtf8());
+    // already imported document and document referenced by its checksum
+    docsFile.write(QString(R"({"text": "%0", "annotations": )"
+                           R"([{"label_name": "l4", "start_char": 0, )"
+                           R"("end_char": 300}]})"
+                           "\n")
+                       .arg(text)
+                       .toUtf8());
+    docsFile.write(QString(R"({"utf8_text_md5_checksum": "%0", )"
+                           R"("annotations": [{"label_name": "l0", )"
+                           R"("start_byte": 2, "end_byte": 300}]})"
+                           "\n")
+                       .arg(md5)
+                       .toUtf8());
+  }
+  auto dbPath = tmpDir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(dbPath);
+  auto res = catalog.importDocuments(docsPath);
+  QCOMPARE(res.nDocs, 1);
+  QCOMPARE(res.nAnnotations, 252);
+
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 252);
+  query.exec("select name from label order by id;");
+  QStringList labels{};
+  while (query.next()) {
+    labels << query.value(0).toString();
+  }
+  QCOMPARE(labels, (QStringList{"l0", "l1", "l2", "l4"}));
+  query.exec("select count(distinct color) from label;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 4);
+
+  // documents already in the database are resolved by their checksum
+  res = catalog.importDocuments(docsPath);
+  QCOMPARE(res.nDocs, 0);
+  QCOMPARE(res.nAnnotations, 0);
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 252);
+}
+
+void TestDatabase::testBulkLoad() {
+  QTemporaryDir tmpDir{};
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  ImportDocsOptions options{};
+  options.bulkLoad = true;
+  // settings are restored after successful and failed imports
+  for (const auto& docsFile : {":test/data/test_documents.json",
+                               ":test/data/invalid_files/docs_9.jsonl"}) {
+    catalog.importDocuments(docsFile, nullptr, options);
+    query.exec("select count(*) from sqlite_master where type = 'index' and "
+               "name in ('document_id_idx', 'annotation_doc_id_idx', "
+               "'annotation_label_id_idx');");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 3);
+    query.exec("select count(*) from sqlite_master where type = 'trigger' "
+               "and name = 'annotation_insert_change';");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 1);
+    query.exec("pragma journal_mode;");
+    query.next();
+    QCOMPARE(query.value(0).toString(), QString("delete"));
+    query.exec("pragma synchronous;");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 2);
+    query.finish();
+  }
+  query.exec("select count(*) from document;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 6);
+
+  // the inserter records each document its batches annotated once, rather
+  // than a trigger replacing its row for each annotation
+  auto docsPath = tmpDir.filePath("annotated.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 2; ++i) {
+      docsFile.write(QString(R"({"text": "annotated %0", "annotations": [)"
+                             R"({"label_name": "a", "start_char": 0, )"
+                             R"("end_char": 1}, {"label_name": "a", )"
+                             R"("start_char": 1, "end_char": 2}, )"
+                             R"({"label_name": "b", "start_char": 0, )"
+                             R"("end_char": 2}]})"
+                             "\n")
+                         .arg(i)
+                         .toUtf8());
+    }
+  }
+  QCOMPARE(catalog.getChangeWatermark(), Q_INT64_C(0));
+  catalog.importDocuments(docsPath, nullptr, options);
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 6);
+  QCOMPARE(catalog.getChangeWatermark(), Q_INT64_C(2));
+  query.exec("select count(*) from document_change;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 2);
+  query.finish();
+
+  // importing the same annotations again inserts nothing, so no document
+  // changes
+  catalog.importDocuments(docsPath, nullptr, options);
+  query.exec("select count(*) from annotation;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 6);
+  QCOMPARE(catalog.getChangeWatermark(), Q_INT64_C(2));
+  query.finish();
+}
+
+void TestDatabase::testImportRejects() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 1000; ++i) {
+      docsFile.write((i % 100 == 7 ? QString("not json %0\n")
+                                   : QString("{\"text\": \"doc %0\"}\n"))
+                         .arg(i)
+                         .toUtf8());
+    }
+  }
+  for (auto nThreads : {1, 3}) {
+    DatabaseCatalog catalog{};
+    catalog.openDatabase(
+        tmpDir.filePath(QString("db_%0.sqlite").arg(nThreads)));
+    ImportDocsOptions options{};
+    options.nThreads = nThreads;
+    options.batchSize = 64;
+    options.rejectsFile =
+        tmpDir.filePath(QString("rejects_%0").arg(nThreads));
+    auto res = catalog.importDocuments(docsPath, nullptr, options);
+    QCOMPARE(static_cast<int>(res.errorCode),
+             static_cast<int>(ErrorCode::NoError));
+    QCOMPARE(res.nDocs, 990);
+    QFile rejectsFile{options.rejectsFile};
+    rejectsFile.open(QIODevice::ReadOnly);
+    auto rejected = rejectsFile.readAll().split('\n');
+    QCOMPARE(rejected.size(), 11);
+    QCOMPARE(rejected[0], QByteArray("not json 7"));
+    QCOMPARE(rejected[9], QByteArray("not json 907"));
+  }
+}
+
+void TestDatabase::testDryRunImport() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  auto unknownMd5 = QString::fromLatin1(
+      QCryptographicHash::hash("unknown", QCryptographicHash::Md5).toHex());
+  auto newDocMd5 = QString::fromLatin1(
+      QCryptographicHash::hash("new doc", QCryptographicHash::Md5).toHex());
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(R"({"text": "existing doc"})"
+                   "\n");
+    // valid, out of the text, empty span, bad label
+    docsFile.write(R"({"text": "new doc", "annotations": [)"
+                   R"({"label_name": "l0", "start_char": 0, "end_char": 3}, )"
+                   R"({"label_name": "l0", "start_char": 0, "end_char": 30}, )"
+                   R"({"label_name": "l1", "start_char": 2, "end_char": 2}, )"
+                   R"({"label_name": "", "start_char": 0, "end_char": 1}]})"
+                   "\n");
+    docsFile.write(R"({"text": "new doc", "annotations": [)"
+                   R"({"label_name": "l1", "start_char": 4, "end_char": 7}]})"
+                   "\n");
+    docsFile.write(R"({"text": ""})"
+                   "\n");
+    docsFile.write("not json\n");
+    docsFile.write(QString(R"({"utf8_text_md5_checksum": "%0", )"
+                           R"("annotations": [{"label_name": "l0", )"
+                           R"("start_char": 0, "end_char": 1}]})"
+                           "\n")
+                       .arg(unknownMd5)
+                       .toUtf8());
+    // annotates the document added by an earlier record
+    docsFile.write(QString(R"({"utf8_text_md5_checksum": "%0", )"
+                           R"("annotations": [{"label_name": "l2", )"
+                           R"("start_byte": 4, "end_byte": 7}]})"
+                           "\n")
+                       .arg(newDocMd5)
+                       .toUtf8());
+  }
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  query.prepare("insert into document (content, content_md5) values "
+                "('existing doc', :md5);");
+  query.bindValue(":md5", QCryptographicHash::hash(QByteArray("existing doc"),
+                                                   QCryptographicHash::Md5));
+  query.exec();
+
+  ImportDocsOptions options{};
+  options.dryRun = true;
+  auto dryRunRes = catalog.importDocuments(docsPath, nullptr, options);
+  QCOMPARE(static_cast<int>(dryRunRes.errorCode),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(dryRunRes.nDocs, 1);
+  QCOMPARE(dryRunRes.nAnnotations, 3);
+  query.exec("select count(*) from document;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 1);
+  query.exec("select count(*) from label;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 0);
+  query.finish();
+
+  // the dry run predicts the result of the import
+  options.dryRun = false;
+  options.rejectsFile = tmpDir.filePath("rejects");
+  auto res = catalog.importDocuments(docsPath, nullptr, options);
+  QCOMPARE(res.nDocs, dryRunRes.nDocs);
+  QCOMPARE(res.nAnnotations, dryRunRes.nAnnotations);
+
+  // annotations already in the database would not be imported again
+  options.dryRun = true;
+  dryRunRes = catalog.importDocuments(docsPath, nullptr, options);
+  QCOMPARE(dryRunRes.nDocs, 0);
+  QCOMPARE(dryRunRes.nAnnotations, 0);
+
+  // each file is checked as if the earlier ones had been imported
+  auto otherDocMd5 = QString::fromLatin1(
+      QCryptographicHash::hash("other doc", QCryptographicHash::Md5).toHex());
+  auto firstPath = tmpDir.filePath("first.jsonl");
+  auto secondPath = tmpDir.filePath("second.jsonl");
+  {
+    QFile firstFile{firstPath};
+    firstFile.open(QIODevice::WriteOnly);
+    firstFile.write(R"({"text": "other doc", "annotations": [)"
+                    R"({"label_name": "l3", "start_char": 0, "end_char": 5}]})"
+                    "\n");
+    QFile secondFile{secondPath};
+    secondFile.open(QIODevice::WriteOnly);
+    // the same annotation, a new one, and the new one again
+    secondFile.write(QString(R"({"utf8_text_md5_checksum": "%0", )"
+                             R"("annotations": [{"label_name": "l3", )"
+                             R"("start_char": 0, "end_char": 5}, )"
+                             R"({"label_name": "l3", "start_char": 6, )"
+                             R"("end_char": 9}, {"label_name": "l3", )"
+                             R"("start_char": 6, "end_char": 9}]})"
+                             "\n")
+                         .arg(otherDocMd5)
+                         .toUtf8());
+  }
+  auto results = catalog.importDocumentFiles({firstPath, secondPath}, options);
+  QCOMPARE(results.size(), 2);
+  QCOMPARE(results[0].result.nDocs, 1);
+  QCOMPARE(results[0].result.nAnnotations, 1);
+  QCOMPARE(results[1].result.nDocs, 0);
+  QCOMPARE(results[1].result.nAnnotations, 1);
+  query.exec("select count(*) from document;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 2);
+  query.finish();
+  options.dryRun = false;
+  results = catalog.importDocumentFiles({firstPath, secondPath}, options);
+  QCOMPARE(results[0].result.nAnnotations, 1);
+  QCOMPARE(results[1].result.nAnnotations, 1);
+}
+
+namespace {
+
+/// Create an empty labelbuddy database that stores text in `encoding`.
+
+/// SQLite fixes the encoding when the schema is first written, so the schema
+/// and rows of a new labelbuddy database are copied into a database whose
+/// encoding is set before anything is written.
+void createDatabaseWithEncoding(const QString& dbPath,
+                                const QString& encoding) {
+  QTemporaryDir tmpDir{};
+  auto templatePath = tmpDir.filePath("template.sqlite");
+  QStringList statements{};
+  {
+    DatabaseCatalog catalog{};
+    catalog.openDatabase(templatePath, false);
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    for (const auto& pragma : {"application_id", "user_version"}) {
+      query.exec(QString("PRAGMA %0;").arg(pragma));
+      query.next();
+      statements << QString("PRAGMA %0 = %1;")
+                        .arg(pragma)
+                        .arg(query.value(0).toInt());
+    }
+    query.exec("select type, name, sql from sqlite_master where sql is not "
+               "null and name not like 'sqlite_%' order by rowid;");
+    QStringList tables{};
+    while (query.next()) {
+      statements << query.value(2).toString();
+      if (query.value(0).toString() == "table") {
+        tables << query.value(1).toString();
+      }
+    }
+    for (const auto& table : tables) {
+      query.exec(QString("select * from %0;").arg(table));
+      while (query.next()) {
+        auto record = query.record();
+        QStringList values{};
+        for (int i = 0; i < record.count(); ++i) {
+          values << query.driver()->formatValue(record.field(i));
+        }
+        statements << QString("insert into %0 values (%1);")
+                          .arg(table)
+                          .arg(values.join(", "));
+      }
+    }
+  }
+  QSqlDatabase::removeDatabase(templatePath);
+  {
+    auto db = QSqlDatabase::addDatabase("QSQLITE", "with_encoding");
+    db.setDatabaseName(dbPath);
+    db.open();
+    QSqlQuery query(db);
+    query.exec(QString("PRAGMA encoding = '%0';").arg(encoding));
+    for (const auto& statement : statements) {
+      query.exec(statement);
+    }
+  }
+  QSqlDatabase::removeDatabase("with_encoding");
+}
+
+} // namespace
+
+void TestDatabase::testUtf8ContentImport_data() {
+  QTest::addColumn<QString>("encoding");
+  QTest::newRow("UTF-8") << QString("UTF-8");
+  // the content cannot be written and read as UTF-8 blobs
+  QTest::newRow("UTF-16le") << QString("UTF-16le");
+}
+
+void TestDatabase::testUtf8ContentImport() {
+  QFETCH(QString, encoding);
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    // a plain string, and escapes including a surrogate pair
+    docsFile.write("{\"text\": \"a\xc3\xa9\xf0\x9f\x98\x80"
+                   "b\", \"annotations\": [{\"label_name\": \"l\", "
+                   "\"start_byte\": 7, \"end_byte\": 8}]}\n");
+    docsFile.write(R"({"text": "\ud83d\ude00\n)"
+                   "\xc3\xa9"
+                   R"(\"x", "annotations": )"
+                   R"([{"label_name": "l", "start_char": 3, "end_char": 5}]})"
+                   "\n");
+  }
+  auto txtPath = tmpDir.filePath("docs.txt");
+  {
+    QFile txtFile{txtPath};
+    txtFile.open(QIODevice::WriteOnly);
+    txtFile.write("line \xe6\x97\xa5\r\nbad \xff\n");
+  }
+  QStringList expected{
+      QString::fromUtf8("a\xc3\xa9\xf0\x9f\x98\x80" "b"),
+      QString::fromUtf8("\xf0\x9f\x98\x80\n\xc3\xa9\"x"),
+      QString::fromUtf8("line \xe6\x97\xa5"),
+      QString::fromUtf8("bad \xef\xbf\xbd")};
+
+  auto dbPath = tmpDir.filePath("db.sqlite");
+  if (encoding != "UTF-8") {
+    createDatabaseWithEncoding(dbPath, encoding);
+  }
+  DatabaseCatalog catalog{};
+  QVERIFY(catalog.openDatabase(dbPath));
+  QCOMPARE(isUtf8Database(catalog.getCurrentDatabase()),
+           encoding == "UTF-8");
+  QCOMPARE(catalog.importDocuments(docsPath).nDocs, 2);
+  QCOMPARE(catalog.importDocuments(txtPath).nDocs, 2);
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  query.exec("PRAGMA encoding;");
+  query.next();
+  QCOMPARE(query.value(0).toString(), encoding);
+  query.exec("select content, content_md5, typeof(content) from document "
+             "order by id;");
+  QStringList stored{};
+  while (query.next()) {
+    stored << query.value(0).toString();
+    QCOMPARE(query.value(1).toByteArray(),
+             QCryptographicHash::hash(query.value(0).toString().toUtf8(),
+                                      QCryptographicHash::Md5));
+    QCOMPARE(query.value(2).toString(), QString("text"));
+  }
+  QCOMPARE(stored, expected);
+  query.exec("select start_char, end_char from annotation order by doc_id;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 3);
+  QCOMPARE(query.value(1).toInt(), 4);
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 3);
+  QCOMPARE(query.value(1).toInt(), 5);
+  query.finish();
+
+  auto exportPath = tmpDir.filePath("export.jsonl");
+  catalog.exportDocuments(exportPath, false, true, true);
+  QFile exportFile{exportPath};
+  exportFile.open(QIODevice::ReadOnly);
+  auto lines = exportFile.readAll().split('\n');
+  QStringList exported{};
+  for (const auto& line : lines) {
+    if (!line.isEmpty()) {
+      exported << QJsonDocument::fromJson(line).object()["text"].toString();
+    }
+  }
+  QCOMPARE(exported, expected);
+  auto annotation = QJsonDocument::fromJson(lines[1])
+                        .object()["annotations"]
+                        .toArray()[0]
+                        .toObject();
+  QCOMPARE(annotation["start_byte"].toInt(), 7);
+  QCOMPARE(annotation["end_byte"].toInt(), 9);
+}
+
+void TestDatabase::testStoredUtf8Index() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    // é (2 bytes), an emoji (4 bytes), a CJK character (3 bytes)
+    docsFile.write("{\"text\": \"\xc3\xa9 \xf0\x9f\x98\x80 \xe4\xb8\xad x\", "
+                   "\"annotations\": [{\"label_name\": \"l\", \"start_char\": "
+                   "4, \"end_char\": 5}, {\"label_name\": \"l\", "
+                   "\"start_char\": 6, \"end_char\": 7}]}\n");
+    docsFile.write(R"({"text": "ascii", "annotations": [{"label_name": "l", )"
+                   R"("start_char": 1, "end_char": 3}]})"
+                   "\n");
+  }
+  auto dbPath = tmpDir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(dbPath);
+  QCOMPARE(catalog.importDocuments(docsPath).nDocs, 2);
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  query.exec("select count(*) from document_utf8_index;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 2);
+  query.finish();
+
+  auto exportPath = tmpDir.filePath("export.jsonl");
+  auto exportedAnnotations =
+      [&catalog, &exportPath](bool includeText) -> QList<QJsonArray> {
+        catalog.exportDocuments(exportPath, false, includeText, true);
+        QFile exportFile{exportPath};
+        exportFile.open(QIODevice::ReadOnly);
+        QList<QJsonArray> annotations{};
+        for (const auto& line : exportFile.readAll().split('\n')) {
+          if (!line.isEmpty()) {
+            annotations << QJsonDocument::fromJson(line)
+                               .object()["annotations"]
+                               .toArray();
+          }
+        }
+        return annotations;
+      };
+  auto withText = exportedAnnotations(true);
+  QCOMPARE(withText.size(), 2);
+  QCOMPARE(withText[0][0].toObject()["start_byte"].toInt(), 8);
+  QCOMPARE(withText[0][0].toObject()["end_byte"].toInt(), 11);
+  QCOMPARE(withText[0][1].toObject()["start_byte"].toInt(), 12);
+  QCOMPARE(withText[0][1].toObject()["end_byte"].toInt(), 13);
+  QCOMPARE(withText[1][0].toObject()["start_byte"].toInt(), 1);
+  QCOMPARE(withText[1][0].toObject()["end_byte"].toInt(), 3);
+  QCOMPARE(exportedAnnotations(false), withText);
+
+  // documents imported before the indexes were stored use their text
+  query.exec("delete from document_utf8_index;");
+  QCOMPARE(exportedAnnotations(false), withText);
+
+  // annotations given with UTF-8 positions for a document in the database
+  auto annotationsPath = tmpDir.filePath("annotations.jsonl");
+  {
+    QFile annotationsFile{annotationsPath};
+    annotationsFile.open(QIODevice::WriteOnly);
+    annotationsFile.write(
+        QString(R"({"utf8_text_md5_checksum": "%0", "annotations": [)"
+                R"({"label_name": "m", "start_byte": 3, "end_byte": 7}, )"
+                R"({"label_name": "m", "start_byte": 4, "end_byte": 7}]})")
+            .arg(QString(QCryptographicHash::hash(
+                             "\xc3\xa9 \xf0\x9f\x98\x80 \xe4\xb8\xad x",
+                             QCryptographicHash::Md5)
+                             .toHex()))
+            .toUtf8());
+  }
+  auto result = catalog.importDocuments(annotationsPath);
+  QCOMPARE(result.nAnnotations, 1);
+  query.exec("select start_char, end_char from annotation where label_id = "
+             "(select id from label where name = 'm');");
+  QVERIFY(query.next());
+  QCOMPARE(query.value(0).toInt(), 2);
+  QCOMPARE(query.value(1).toInt(), 3);
+  // the index of the document was stored
+  query.exec("select count(*) from document_utf8_index;");
+  query.next();
+  QCOMPARE(query.value(0).toInt(), 1);
+}
+
+void TestDatabase::testProgressReporter() {
+  std::ostringstream jsonOut{};
+  ProgressReporter jsonReporter("import", ProgressReporter::Mode::JsonLines,
+                                jsonOut);
+  QVERIFY(!jsonReporter.isDue());
+  jsonReporter.report(10, 2000000, .25);
+  QVERIFY(!jsonReporter.isDue());
+  jsonReporter.finish(40, 8000000);
+  auto lines = QByteArray::fromStdString(jsonOut.str()).split('\n');
+  QCOMPARE(lines.size(), 3);
+  QCOMPARE(lines[2], QByteArray());
+  auto first = QJsonDocument::fromJson(lines[0]).object();
+  QCOMPARE(first["operation"].toString(), QString("import"));
+  QCOMPARE(first["docs"].toInt(), 10);
+  QCOMPARE(first["bytes"].toInt(), 2000000);
+  QVERIFY(first["docs_per_s"].toDouble() > 0.);
+  QVERIFY(first["mb_per_s"].toDouble() > 0.);
+  QVERIFY(first["eta_s"].isDouble());
+  QCOMPARE(first["done"].toBool(), false);
+  auto last = QJsonDocument::fromJson(lines[1]).object();
+  QCOMPARE(last["docs"].toInt(), 40);
+  QVERIFY(last["eta_s"].isNull());
+  QCOMPARE(last["done"].toBool(), true);
+
+  std::ostringstream terminalOut{};
+  ProgressReporter terminalReporter("export", ProgressReporter::Mode::Terminal,
+                                    terminalOut);
+  terminalReporter.report(10, 2000000, .5);
+  terminalReporter.finish(20, 4000000);
+  auto text = QString::fromStdString(terminalOut.str());
+  QVERIFY(text.startsWith("\rexport: 10 documents, 2.0 MB ("));
+  QVERIFY(text.contains("docs/s"));
+  QVERIFY(text.contains("ETA"));
+  QVERIFY(text.contains("\rexport: 20 documents, 4.0 MB ("));
+  QVERIFY(text.endsWith(")\n"));
+  QCOMPARE(text.count('\n'), 1);
+}
+
+void TestDatabase::testReaderProgress() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.txt");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 10; ++i) {
+      docsFile.write(QString("doc %0\n").arg(i).toUtf8());
+    }
+  }
+  TxtDocsReader fileReader(docsPath);
+  QCOMPARE(fileReader.progressMax(), 1000);
+  QCOMPARE(fileReader.currentProgress(), 0);
+  QCOMPARE(fractionRead(fileReader, 0), 0.);
+  // a start after the current progress would give -4
+  QCOMPARE(fractionRead(fileReader, 800), -1.);
+  while (fileReader.readNext()) {
+  }
+  QCOMPARE(fileReader.currentProgress(), fileReader.progressMax());
+  QCOMPARE(fractionRead(fileReader, 0), 1.);
+
+  // the size of the standard input is unknown if it is a pipe or a terminal,
+  // and then the progress is 0 out of 0
+  JsonLinesDocsReader stdinReader("-");
+  auto progressMax = stdinReader.progressMax();
+  QVERIFY(progressMax == 0 || progressMax == 1000);
+  QVERIFY(stdinReader.currentProgress() >= 0);
+  QVERIFY(stdinReader.currentProgress() <= progressMax);
+  auto fraction = fractionRead(stdinReader, stdinReader.currentProgress());
+  QVERIFY(fraction == -1. || (fraction >= 0. && fraction <= 1.));
+  if (progressMax == 0) {
+    QCOMPARE(fraction, -1.);
+  }
+}
+
+void TestDatabase::testStreamingExport() {
+  QTemporaryDir tmpDir{};
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  for (const auto& text : {"doc 1", "doc 2", "doc 3", "doc 4"}) {
+    query.prepare(
+        "insert into document (content, content_md5) values (:c, :md5);");
+    query.bindValue(":c", text);
+    query.bindValue(":md5", QCryptographicHash::hash(QByteArray(text),
+                                                     QCryptographicHash::Md5));
+    query.exec();
+  }
+  query.exec("insert into label (name) values ('a'), ('b');");
+  // annotations are not inserted in the order of their documents
+  query.exec("insert into annotation (doc_id, label_id, start_char, end_char) "
+             "values (3, 2, 0, 1), (1, 1, 1, 2), (3, 1, 2, 3), (1, 2, 0, 5);");
+  query.finish();
+
+  for (bool labelledOnly : {false, true}) {
+    auto exportPath = tmpDir.filePath("export.jsonl");
+    auto res = catalog.exportDocuments(exportPath, labelledOnly);
+    QCOMPARE(res.nDocs, labelledOnly ? 2 : 4);
+    QCOMPARE(res.nAnnotations, 4);
+    QFile exportFile{exportPath};
+    exportFile.open(QIODevice::ReadOnly);
+    QStringList texts{};
+    QStringList annotations{};
+    for (const auto& line : exportFile.readAll().split('\n')) {
+      if (line.isEmpty()) {
+        continue;
+      }
+      auto doc = QJsonDocument::fromJson(line).object();
+      texts << doc["text"].toString();
+      QStringList docAnnotations{};
+      for (const auto& annotation : doc["annotations"].toArray()) {
+        auto annotationObj = annotation.toObject();
+        docAnnotations << QString("%0:%1-%2")
+                              .arg(annotationObj["label_name"].toString())
+                              .arg(annotationObj["start_char"].toInt())
+                              .arg(annotationObj["end_byte"].toInt());
+      }
+      annotations << docAnnotations.join(",");
+    }
+    if (labelledOnly) {
+      QCOMPARE(texts, QStringList({"doc 1", "doc 3"}));
+      QCOMPARE(annotations, QStringList({"a:1-2,b:0-5", "b:0-1,a:2-3"}));
+    } else {
+      QCOMPARE(texts, QStringList({"doc 1", "doc 2", "doc 3", "doc 4"}));
+      QCOMPARE(annotations,
+               QStringList({"a:1-2,b:0-5", "", "b:0-1,a:2-3", ""}));
+    }
+    exportFile.remove();
+  }
+}
+
+void TestDatabase::testParallelExport() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    // several batches, with and without annotations
+    for (int i = 0; i < 1000; ++i) {
+      auto doc = QString(R"({"text": "doc %0 é😀 text", )"
+                         R"("metadata": {"i": %0}, "annotations": [)")
+                     .arg(i);
+      if (i % 3 != 0) {
+        doc += QString(R"({"label_name": "l%0", "start_char": 4, )"
+                       R"("end_char": 12})")
+                   .arg(i % 5);
+      }
+      doc += "]}\n";
+      docsFile.write(doc.toUtf8());
+    }
+  }
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  QCOMPARE(catalog.importDocuments(docsPath).nDocs, 1000);
+  for (const auto& suffix : {"json", "jsonl"}) {
+    QList<QByteArray> outputs{};
+    for (int nThreads : {1, 4}) {
+      auto exportPath =
+          tmpDir.filePath(QString("export_%0.%1").arg(nThreads).arg(suffix));
+      auto res = catalog.exportDocuments(exportPath, false, true, true,
+                                         nullptr, QString(), nThreads);
+      QCOMPARE(res.nDocs, 1000);
+      QCOMPARE(res.nAnnotations, 666);
+      QFile exportFile{exportPath};
+      exportFile.open(QIODevice::ReadOnly);
+      outputs << exportFile.readAll();
+    }
+    QVERIFY(outputs[0].size() > 0);
+    QCOMPARE(outputs[1], outputs[0]);
+  }
+}
+
+void TestDatabase::testShardedExport() {
+  QCOMPARE(shardFilePath("dir/docs.jsonl.gz", 2),
+           QString("dir/docs-00002.jsonl.gz"));
+  QCOMPARE(shardFilePath("docs.json", 12), QString("docs-00012.json"));
+  QCOMPARE(shardFilePath("docs", 1), QString("docs-00001"));
+  QCOMPARE(shardManifestPath("dir/docs.jsonl.zst"),
+           QString("dir/docs.manifest.json"));
+  bool ok{};
+  QCOMPARE(parseExportShardSize("1000", &ok).nDocs, 1000);
+  QVERIFY(ok);
+  QCOMPARE(parseExportShardSize("2.5MB", &ok).nBytes, Q_INT64_C(2500000));
+  QVERIFY(ok);
+  for (const auto& invalid : {"0", "-3", "MB", "10GB", ""}) {
+    parseExportShardSize(invalid, &ok);
+    QVERIFY(!ok);
+  }
+
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 25; ++i) {
+      docsFile.write(QString(R"({"text": "doc %0", "annotations": )"
+                             R"([{"label_name": "l", "start_char": 0, )"
+                             R"("end_char": 3}]})"
+                             "\n")
+                         .arg(i)
+                         .toUtf8());
+    }
+  }
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  QCOMPARE(catalog.importDocuments(docsPath).nDocs, 25);
+  auto unshardedPath = tmpDir.filePath("unsharded.jsonl");
+  catalog.exportDocuments(unshardedPath, false);
+  QFile unshardedFile{unshardedPath};
+  unshardedFile.open(QIODevice::ReadOnly);
+  auto unsharded = unshardedFile.readAll();
+
+  for (int nThreads : {1, 3}) {
+    auto exportPath =
+        tmpDir.filePath(QString("export_%0.jsonl").arg(nThreads));
+    ExportShardSize shardSize{};
+    shardSize.nDocs = 10;
+    auto res = catalog.exportDocuments(exportPath, false, true, true, nullptr,
+                                       QString(), nThreads, shardSize);
+    QCOMPARE(res.nDocs, 25);
+    QVERIFY(!QFile::exists(exportPath));
+
+    QFile manifestFile{shardManifestPath(exportPath)};
+    QVERIFY(manifestFile.open(QIODevice::ReadOnly));
+    auto manifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+    QCOMPARE(manifest["complete"].toBool(), true);
+    QCOMPARE(manifest["format"].toString(), QString("jsonl"));
+    QCOMPARE(manifest["n_docs"].toInt(), 25);
+    auto shards = manifest["shards"].toArray();
+    QCOMPARE(shards.size(), 3);
+    QByteArray concatenated{};
+    for (int i = 0; i < shards.size(); ++i) {
+      auto shard = shards[i].toObject();
+      QCOMPARE(shard["file"].toString(),
+               QFileInfo(shardFilePath(exportPath, i + 1)).fileName());
+      QCOMPARE(shard["n_docs"].toInt(), i < 2 ? 10 : 5);
+      QCOMPARE(shard["first_doc"].toInt(), 10 * i);
+      QCOMPARE(shard["start_byte"].toInt(), concatenated.size());
+      QFile shardFile{shardFilePath(exportPath, i + 1)};
+      shardFile.open(QIODevice::ReadOnly);
+      auto content = shardFile.readAll();
+      QCOMPARE(content.count('\n'), shard["n_docs"].toInt());
+      concatenated += content;
+      QCOMPARE(shard["end_byte"].toInt(), concatenated.size());
+      QCOMPARE(shard["n_bytes"].toInt(), content.size());
+    }
+    // jsonl shards are pieces of the same output
+    QCOMPARE(concatenated, unsharded);
+  }
+
+  // a limit in bytes, json shards
+  auto exportPath = tmpDir.filePath("export.json");
+  ExportShardSize shardSize{};
+  shardSize.nBytes = unsharded.size() / 4;
+  catalog.exportDocuments(exportPath, false, true, true, nullptr, QString(), 1,
+                          shardSize);
+  QFile manifestFile{shardManifestPath(exportPath)};
+  manifestFile.open(QIODevice::ReadOnly);
+  auto manifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+  QCOMPARE(manifest["format"].toString(), QString("json"));
+  auto shards = manifest["shards"].toArray();
+  QVERIFY(shards.size() > 1);
+  int nDocs{};
+  for (int i = 0; i < shards.size(); ++i) {
+    QFile shardFile{shardFilePath(exportPath, i + 1)};
+    shardFile.open(QIODevice::ReadOnly);
+    auto docs = QJsonDocument::fromJson(shardFile.readAll()).array();
+    QCOMPARE(docs.size(), shards[i].toObject()["n_docs"].toInt());
+    QCOMPARE(docs[0].toObject()["text"].toString(),
+             QString("doc %0").arg(nDocs));
+    nDocs += docs.size();
+  }
+  QCOMPARE(nDocs, 25);
+
+  // a re-export with fewer shards removes the ones listed by the previous
+  // manifest that it does not replace, but not other files, even if they are
+  // named like shards
+  auto nShards = shards.size();
+  QStringList otherFiles{tmpDir.filePath("export-00001.csv"),
+                         tmpDir.filePath("other-00002.json"),
+                         shardFilePath(exportPath, nShards + 1),
+                         shardFilePath(exportPath + ".gz", nShards + 2)};
+  for (const auto& path : otherFiles) {
+    QFile file{path};
+    file.open(QIODevice::WriteOnly);
+  }
+  shardSize.nBytes = 0;
+  shardSize.nDocs = 25;
+  auto res = catalog.exportDocuments(exportPath, false, true, true, nullptr,
+                                     QString(), 1, shardSize);
+  QCOMPARE(static_cast<int>(res.errorCode),
+           static_cast<int>(ErrorCode::NoError));
+  manifestFile.close();
+  manifestFile.open(QIODevice::ReadOnly);
+  manifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+  QCOMPARE(manifest["shards"].toArray().size(), 1);
+  QVERIFY(QFile::exists(shardFilePath(exportPath, 1)));
+  for (int i = 2; i <= nShards; ++i) {
+    QVERIFY(!QFile::exists(shardFilePath(exportPath, i)));
+  }
+  for (const auto& path : otherFiles) {
+    QVERIFY(QFile::exists(path));
+  }
+}
+
+namespace {
+
+/// Texts of the exported documents and their number of annotations, and
+/// checksums of the deleted documents with -1
+QMap<QString, int> exportedSince(const DatabaseCatalog& catalog,
+                                 const QString& exportPath, qint64 watermark,
+                                 bool labelledOnly = false) {
+  catalog.exportDocuments(exportPath, labelledOnly, true, true, nullptr,
+                          QString(), 1, ExportShardSize(), watermark);
+  QFile exportFile{exportPath};
+  exportFile.open(QIODevice::ReadOnly);
+  QMap<QString, int> exported{};
+  auto docs = QJsonDocument::fromJson(exportFile.readAll()).array();
+  for (const auto& doc : docs) {
+    auto docObj = doc.toObject();
+    if (docObj["deleted"].toBool()) {
+      exported[docObj["utf8_text_md5_checksum"].toString()] = -1;
+    } else {
+      exported[docObj["text"].toString()] =
+          docObj["annotations"].toArray().size();
+    }
+  }
+  return exported;
+}
+
+QString md5Hex(const QString& text) {
+  return QString::fromLatin1(
+      QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Md5)
+          .toHex());
+}
+
+} // namespace
+
+void TestDatabase::testIncrementalExport() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 5; ++i) {
+      docsFile.write(QString(R"({"text": "doc %0", "annotations": [%1]})"
+                             "\n")
+                         .arg(i)
+                         .arg(i < 2 ? R"({"label_name": "l", "start_char": 0, )"
+                                      R"("end_char": 3})"
+                                    : "")
+                         .toUtf8());
+    }
+  }
+  auto dbPath = tmpDir.filePath("db.sqlite");
+  auto exportPath = tmpDir.filePath("export.json");
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(dbPath);
+  QCOMPARE(catalog.getChangeWatermark(), Q_INT64_C(0));
+  QCOMPARE(catalog.importDocuments(docsPath).nDocs, 5);
+  auto watermark = catalog.getChangeWatermark();
+  QVERIFY(watermark > 0);
+  QCOMPARE(exportedSince(catalog, exportPath, 0),
+           (QMap<QString, int>{{"doc 0", 1}, {"doc 1", 1}}));
+  QVERIFY(exportedSince(catalog, exportPath, watermark).isEmpty());
+  // a full export
+  QCOMPARE(exportedSince(catalog, exportPath, -1).size(), 5);
+
+  {
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.exec("insert into annotation (doc_id, label_id, start_char, "
+               "end_char) select id, 1, 1, 2 from document where content = "
+               "'doc 3';");
+    query.exec("delete from annotation where doc_id = (select id from "
+               "document where content = 'doc 0');");
+  }
+  QCOMPARE(exportedSince(catalog, exportPath, watermark),
+           (QMap<QString, int>{{"doc 0", 0}, {"doc 3", 1}}));
+  // doc 0 lost its last annotation but it is still exported
+  QCOMPARE(exportedSince(catalog, exportPath, watermark, true),
+           (QMap<QString, int>{{"doc 0", 0}, {"doc 3", 1}}));
+  auto newWatermark = catalog.getChangeWatermark();
+  QVERIFY(newWatermark > watermark);
+  QVERIFY(exportedSince(catalog, exportPath, newWatermark).isEmpty());
+
+  {
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.exec("update label set name = 'renamed';");
+    query.exec("delete from document where content = 'doc 3';");
+    query.exec("select count(*) from document_change;");
+    query.next();
+    // doc 0 (its annotation was deleted), doc 1 and the tombstone of doc 3
+    QCOMPARE(query.value(0).toInt(), 3);
+  }
+  QCOMPARE(exportedSince(catalog, exportPath, newWatermark),
+           (QMap<QString, int>{{"doc 1", 1}, {md5Hex("doc 3"), -1}}));
+  QCOMPARE(exportedSince(catalog, exportPath, newWatermark, true),
+           (QMap<QString, int>{{"doc 1", 1}, {md5Hex("doc 3"), -1}}));
+  // a deleted document imported again is exported as changed, not deleted
+  auto deletedWatermark = catalog.getChangeWatermark();
+  {
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.exec("delete from document where content = 'doc 4';");
+  }
+  QCOMPARE(exportedSince(catalog, exportPath, deletedWatermark),
+           (QMap<QString, int>{{md5Hex("doc 4"), -1}}));
+  auto reimportedPath = tmpDir.filePath("reimported.jsonl");
+  {
+    QFile reimportedFile{reimportedPath};
+    reimportedFile.open(QIODevice::WriteOnly);
+    reimportedFile.write(R"({"text": "doc 4"})");
+  }
+  QCOMPARE(catalog.importDocuments(reimportedPath).nDocs, 1);
+  QCOMPARE(exportedSince(catalog, exportPath, deletedWatermark),
+           (QMap<QString, int>{{"doc 4", 0}}));
+
+  // a database created before changes were tracked
+  {
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    for (const auto& trigger : changeTriggers()) {
+      QVERIFY(query.exec(QString("drop trigger %0;").arg(trigger.name)));
+    }
+    QVERIFY(query.exec("drop table document_change;"));
+  }
+  QSqlDatabase::removeDatabase(catalog.getCurrentDatabase());
+  DatabaseCatalog reopened{};
+  QVERIFY(reopened.openDatabase(dbPath));
+  // the labelled documents are recorded as changed
+  QCOMPARE(reopened.getChangeWatermark(), Q_INT64_C(1));
+  QCOMPARE(exportedSince(reopened, exportPath, 0),
+           (QMap<QString, int>{{"doc 1", 1}}));
+  QVERIFY(exportedSince(reopened, exportPath, 1).isEmpty());
+}
+
+void TestDatabase::testResumeImport_data() {
+  QTest::addColumn<QString>("newline");
+  QTest::newRow("LF") << "\n";
+  // the checkpoint is an offset in the file, which includes the "\r"
+  QTest::newRow("CRLF") << "\r\n";
+}
+
+void TestDatabase::testResumeImport() {
+  QFETCH(QString, newline);
+  QTemporaryDir tmpDir{};
+  QStringList docs{};
+  for (int i = 0; i < 25; ++i) {
+    docs << QString("{\"text\": \"doc %0\"}").arg(i, 2, 10, QChar('0'));
+  }
+  auto content = QString("[%0]").arg(docs.join("," + newline)).toUtf8();
+  // the import stops at the 23rd document, which is invalid
+  content.replace("\"doc 22\"", "doc 22");
+  auto docsPath = tmpDir.filePath("docs.json");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(content);
+  }
+  ImportDocsOptions options{};
+  options.batchSize = 10;
+  options.resume = true;
+  auto rejectsPath = tmpDir.filePath("rejects.json");
+  auto count = [](const DatabaseCatalog& catalog, const QString& content) {
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.prepare("select count(*) from document where content = :content;");
+    query.bindValue(":content", content);
+    query.exec();
+    query.next();
+    return query.value(0).toInt();
+  };
+  auto interruptedImport = [&](DatabaseCatalog& catalog,
+                               const QString& dbName) {
+    catalog.openDatabase(tmpDir.filePath(dbName));
+    auto res = catalog.importDocuments(docsPath, nullptr, options);
+    QCOMPARE(static_cast<int>(res.errorCode),
+             static_cast<int>(ErrorCode::CriticalParsingError));
+    // the 2 complete batches are kept
+    QCOMPARE(res.nDocs, 20);
+    QVERIFY(
+        !catalog.getAppStateExtra("import_checkpoint", QVariant()).isNull());
+    // to check whether the import is resumed after the last batch or
+    // restarted
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.exec("delete from document where content = 'doc 00';");
+  };
+  auto resumeWithRejects = [&](DatabaseCatalog& catalog) {
+    auto resumeOptions = options;
+    resumeOptions.rejectsFile = rejectsPath;
+    return catalog.importDocuments(docsPath, nullptr, resumeOptions);
+  };
+
+  {
+    // the file is unchanged so the import is resumed
+    DatabaseCatalog catalog{};
+    interruptedImport(catalog, "resumed.sqlite");
+    auto res = resumeWithRejects(catalog);
+    QCOMPARE(static_cast<int>(res.errorCode),
+             static_cast<int>(ErrorCode::NoError));
+    QCOMPARE(res.nDocs, 4);
+    QCOMPARE(count(catalog, "doc 00"), 0);
+    QCOMPARE(count(catalog, "doc 24"), 1);
+    QVERIFY(
+        catalog.getAppStateExtra("import_checkpoint", QVariant()).isNull());
+  }
+  {
+    // the file has changed so the position may not be after a document: the
+    // import starts from the beginning
+    DatabaseCatalog catalog{};
+    interruptedImport(catalog, "restarted.sqlite");
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::Append);
+    docsFile.write(newline.toUtf8());
+    docsFile.close();
+    auto res = resumeWithRejects(catalog);
+    QCOMPARE(static_cast<int>(res.errorCode),
+             static_cast<int>(ErrorCode::NoError));
+    QCOMPARE(res.nDocs, 5);
+    QCOMPARE(count(catalog, "doc 00"), 1);
+    QCOMPARE(count(catalog, "doc 24"), 1);
+  }
+}
+
+void TestDatabase::testParallelImport() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 2000; ++i) {
+      docsFile.write(QString(R"({"text": "document %0 \ud834\udd1e", )"
+                             R"("annotations": [{"label_name": "l%1", )"
+                             R"("start_char": 0, "end_char": 8}]})"
+                             "\n")
+                         .arg(i)
+                         .arg(i % 7)
+                         .toUtf8());
+    }
+  }
+  QStringList contents{};
+  for (auto nThreads : {1, 4}) {
+    auto dbPath = tmpDir.filePath(QString("db_%0.sqlite").arg(nThreads));
+    DatabaseCatalog catalog{};
+    catalog.openDatabase(dbPath);
+    ImportDocsOptions options{};
+    options.nThreads = nThreads;
+    auto res = catalog.importDocuments(docsPath, nullptr, options);
+    QCOMPARE(res.nDocs, 2000);
+    QCOMPARE(res.nAnnotations, 2000);
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.exec("select group_concat(content, '|') from "
+               "(select content from document order by id);");
+    query.next();
+    contents << query.value(0).toString();
+  }
+  QCOMPARE(contents[0], contents[1]);
+
+  DatabaseCatalog catalog{};
+  ImportDocsOptions options{};
+  options.nThreads = 3;
+  auto res = catalog.importDocuments(":test/data/invalid_files/docs_9.jsonl",
+                                     nullptr, options);
+  QCOMPARE(static_cast<int>(res.errorCode),
+           static_cast<int>(ErrorCode::CriticalParsingError));
+  QCOMPARE(res.nDocs, 0);
+}
+
+void TestDatabase::testImportDocumentFiles() {
+  QTemporaryDir tmpDir{};
+  QStringList docsPaths{};
+  for (int fileIdx = 0; fileIdx < 5; ++fileIdx) {
+    docsPaths << tmpDir.filePath(QString("docs_%0.jsonl").arg(fileIdx));
+    QFile docsFile{docsPaths.last()};
+    docsFile.open(QIODevice::WriteOnly);
+    for (int i = 0; i < 300 * (fileIdx + 1); ++i) {
+      docsFile.write(QString(R"({"text": "file %0 document %1", )"
+                             R"("annotations": [{"label_name": "l%2", )"
+                             R"("start_char": 0, "end_char": 4}]})"
+                             "\n")
+                         .arg(fileIdx)
+                         .arg(i)
+                         .arg(i % 3)
+                         .toUtf8());
+    }
+  }
+  // an error in one file does not stop the import of the next ones
+  docsPaths.insert(2, ":test/data/invalid_files/docs_9.jsonl");
+  QStringList contents{};
+  for (auto nThreads : {1, 3, 8}) {
+    auto dbPath = tmpDir.filePath(QString("db_%0.sqlite").arg(nThreads));
+    DatabaseCatalog catalog{};
+    catalog.openDatabase(dbPath);
+    ImportDocsOptions options{};
+    options.nThreads = nThreads;
+    auto results = catalog.importDocumentFiles(docsPaths, options);
+    QCOMPARE(results.size(), 6);
+    for (int i = 0; i < results.size(); ++i) {
+      QCOMPARE(results[i].filePath, docsPaths[i]);
+      if (i == 2) {
+        QCOMPARE(static_cast<int>(results[i].result.errorCode),
+                 static_cast<int>(ErrorCode::CriticalParsingError));
+        QCOMPARE(results[i].result.nDocs, 0);
+      } else {
+        auto nDocs = 300 * (i < 2 ? i + 1 : i);
+        QCOMPARE(static_cast<int>(results[i].result.errorCode),
+                 static_cast<int>(ErrorCode::NoError));
+        QCOMPARE(results[i].result.nDocs, nDocs);
+        QCOMPARE(results[i].result.nDocsRead, nDocs);
+        QCOMPARE(results[i].result.nAnnotations, nDocs);
+      }
+    }
+    // documents already in the database are read but not inserted
+    auto again = catalog.importDocumentFiles({docsPaths[0]}, options);
+    QCOMPARE(again.size(), 1);
+    QCOMPARE(again[0].result.nDocs, 0);
+    QCOMPARE(again[0].result.nDocsRead, 300);
+    QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+    query.exec("select count(*) from document;");
+    query.next();
+    QCOMPARE(query.value(0).toInt(), 300 * (1 + 2 + 3 + 4 + 5));
+    query.exec("select group_concat(content, '|') from "
+               "(select content from document order by id);");
+    query.next();
+    contents << query.value(0).toString();
+  }
+  QCOMPARE(contents[0], contents[1]);
+  QCOMPARE(contents[0], contents[2]);
+  QVERIFY(contents[0].startsWith("file 0 document 0|file 0 document 1|"));
+  QVERIFY(contents[0].endsWith("|file 4 document 1499"));
+}
+
+void TestDatabase::testStreamingJsonImport() {
+  QTemporaryDir tmpDir{};
+  // large enough for documents to straddle the reader's buffer boundaries
+  QByteArray docs{"\xef\xbb\xbf[\n"};
+  for (int i = 0; i < 3000; ++i) {
+    if (i != 0) {
+      docs.append(",\n");
+    }
+    docs.append(QString(R"({"text": "doc %0 [{,\"}] %1", "meta": {"i": %0}})")
+                    .arg(i)
+                    .arg(QString(400, 'x'))
+                    .toUtf8());
+  }
+  docs.append("\n]\n");
+  auto docsPath = tmpDir.filePath("docs.json");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(docs);
+  }
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  auto res = catalog.importDocuments(docsPath);
+  QCOMPARE(static_cast<int>(res.errorCode),
+           static_cast<int>(ErrorCode::NoError));
+  QCOMPARE(res.nDocs, 3000);
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  query.exec("select content from document order by id desc limit 1;");
+  query.next();
+  QVERIFY(query.value(0).toString().startsWith("doc 2999 [{,\"}] xxx"));
+
+  for (const auto& invalid :
+       {docs.left(docs.size() - 4), docs.left(docs.size() - 3) + ",]",
+        docs + "[]"}) {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(invalid);
+    docsFile.close();
+    DatabaseCatalog invalidCatalog{};
+    res = invalidCatalog.importDocuments(docsPath);
+    QCOMPARE(static_cast<int>(res.errorCode),
+             static_cast<int>(ErrorCode::CriticalParsingError));
+    QCOMPARE(res.nDocs, 0);
+  }
+}
+
+void TestDatabase::testCompressedImportExport() {
+  QTemporaryDir tmpDir{};
+  QByteArray docs{};
+  for (int i = 0; i < 3000; ++i) {
+    docs.append(QString("{\"text\": \"doc %0 %1\"}\n")
+                    .arg(i)
+                    .arg(QString(100, 'x'))
+                    .toUtf8());
+  }
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(docs);
+  }
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  catalog.importDocuments(docsPath);
+  auto plainExportPath = tmpDir.filePath("exported.jsonl");
+  catalog.exportDocuments(plainExportPath, false, true, true);
+  QFile plainExport{plainExportPath};
+  plainExport.open(QIODevice::ReadOnly);
+  auto expected = plainExport.readAll();
+
+  int nTested{};
+  for (auto compression : {Compression::Gzip, Compression::Zstd}) {
+    if (!isCompressionSupported(compression)) {
+      continue;
+    }
+    ++nTested;
+    auto suffix = compressionSuffix(compression);
+    auto exportPath = tmpDir.filePath(QString("exported.jsonl%0").arg(suffix));
+    QVERIFY(DatabaseCatalog::fileExtensionErrorMessage(
+                exportPath, DatabaseCatalog::Action::Export,
+                DatabaseCatalog::ItemKind::Document, false) == QString());
+    auto exportRes = catalog.exportDocuments(exportPath, false, true, true);
+    QCOMPARE(exportRes.nDocs, 3000);
+    QVERIFY(QFileInfo(exportPath).size() < expected.size());
+    {
+      CompressedFile compressed{exportPath, compression};
+      QVERIFY(compressed.open(QIODevice::ReadOnly));
+      QCOMPARE(compressed.readAll(), expected);
+      QVERIFY(compressed.seek(1000));
+      QCOMPARE(compressed.read(10), expected.mid(1000, 10));
+      QVERIFY(compressed.seek(10));
+      QCOMPARE(compressed.readLine(),
+               expected.mid(10, expected.indexOf('\n') - 9));
+    }
+
+    DatabaseCatalog importCatalog{};
+    importCatalog.openDatabase(
+        tmpDir.filePath(QString("imported_%0.sqlite").arg(nTested)));
+    auto res = importCatalog.importDocuments(exportPath);
+    QCOMPARE(static_cast<int>(res.errorCode),
+             static_cast<int>(ErrorCode::NoError));
+    QCOMPARE(res.nDocs, 3000);
+
+    // the format of the content is given by the suffix before the compression
+    auto txtPath = tmpDir.filePath(QString("docs.txt%0").arg(suffix));
+    {
+      CompressedFile txtFile{txtPath, compression};
+      txtFile.open(QIODevice::WriteOnly);
+      txtFile.write("first doc\nsecond doc\n");
+    }
+    res = importCatalog.importDocuments(txtPath);
+    QCOMPARE(res.nDocs, 2);
+
+    // concatenated gzip members or zstd frames are read as one stream, as
+    // with `gzip -d`
+    QByteArray concatenated{};
+    for (const char* part : {"first part\n", "second part\n"}) {
+      auto partPath = tmpDir.filePath(QString("part.txt%0").arg(suffix));
+      {
+        CompressedFile partFile{partPath, compression};
+        QVERIFY(partFile.open(QIODevice::WriteOnly));
+        partFile.write(part);
+      }
+      QFile partFile{partPath};
+      partFile.open(QIODevice::ReadOnly);
+      concatenated.append(partFile.readAll());
+    }
+    auto concatenatedPath =
+        tmpDir.filePath(QString("concatenated.txt%0").arg(suffix));
+    {
+      QFile concatenatedFile{concatenatedPath};
+      concatenatedFile.open(QIODevice::WriteOnly);
+      concatenatedFile.write(concatenated);
+    }
+    {
+      CompressedFile concatenatedFile{concatenatedPath, compression};
+      QVERIFY(concatenatedFile.open(QIODevice::ReadOnly));
+      QCOMPARE(concatenatedFile.readAll(),
+               QByteArray("first part\nsecond part\n"));
+      QVERIFY(!concatenatedFile.hasError());
+    }
+
+    if (QFileInfo::exists("/dev/full")) {
+      // the end of the stream is written when the file is closed, and fails
+      CompressedFile fullFile{"/dev/full", compression};
+      QVERIFY(fullFile.open(QIODevice::WriteOnly));
+      fullFile.write("some data");
+      fullFile.close();
+      QVERIFY(fullFile.hasError());
+      QVERIFY(fullFile.errorString() != QString());
+    }
+
+    QFile exported{exportPath};
+    exported.open(QIODevice::ReadOnly);
+    auto truncated = exported.readAll();
+    truncated.chop(20);
+    auto truncatedPath =
+        tmpDir.filePath(QString("truncated.jsonl%0").arg(suffix));
+    QFile truncatedFile{truncatedPath};
+    truncatedFile.open(QIODevice::WriteOnly);
+    truncatedFile.write(truncated);
+    truncatedFile.close();
+    DatabaseCatalog truncatedCatalog{};
+    truncatedCatalog.openDatabase(
+        tmpDir.filePath(QString("truncated_%0.sqlite").arg(nTested)));
+    res = truncatedCatalog.importDocuments(truncatedPath);
+    QVERIFY(res.errorCode != ErrorCode::NoError);
+  }
+  if (QFileInfo::exists("/dev/full")) {
+    // the data buffered by the file is written when it is closed, and fails
+    JsonLinesDocsWriter writer{"/dev/full", true, true};
+    QVERIFY(writer.isOpen());
+    writer.addDocument("abc", "some text", "{}", {}, "", "");
+    writer.writeSuffix();
+    QVERIFY(!writer.close());
+  }
+  if (nTested == 0) {
+    QSKIP("labelbuddy was built without compression libraries");
+  }
+}
+
+void TestDatabase::testTxtDocsReader() {
+  QTemporaryDir tmpDir{};
+  // long enough for a line to straddle the reader's buffer boundaries
+  QString longLine(1500000, QChar('a'));
+  longLine[1048575] = QChar(0x00e9);
+  QStringList lines{"doc 0", "", "café \U0001d11e", "a\rb", longLine,
+                    "last"};
+  QByteArray utf8 = "\xef\xbb\xbf" + lines.join("\r\n").toUtf8();
+  utf8.replace("last", "l\xffst\r");
+  QByteArray utf16{"\xff\xfe"};
+  for (auto c : lines.join("\n")) {
+    utf16.append(static_cast<char>(c.unicode() & 0xff));
+    utf16.append(static_cast<char>(c.unicode() >> 8));
+  }
+  QByteArray utf32{"\x00\x00\xfe\xff", 4};
+  for (auto c : lines.join("\n").toUcs4()) {
+    for (auto shift : {24, 16, 8, 0}) {
+      utf32.append(static_cast<char>((c >> shift) & 0xff));
+    }
+  }
+  int fileIdx{};
+  for (const auto& content : {utf8, utf16, utf32}) {
+    auto docsPath = tmpDir.filePath(QString("docs_%0.txt").arg(fileIdx++));
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(content);
+    docsFile.close();
+    // the documents are the lines read by QTextStream
+    docsFile.open(QIODevice::ReadOnly);
+    QTextStream stream(&docsFile);
+    stream.setCodec("UTF-8");
+    QStringList expected{};
+    while (!stream.atEnd()) {
+      expected << stream.readLine();
+    }
+    QCOMPARE(expected.size(), lines.size());
+    QCOMPARE(expected[2], lines[2]);
+
+    TxtDocsReader reader{docsPath};
+    QStringList docs{};
+    qint64 secondDocEnd{};
+    while (reader.readNext()) {
+      docs << reader.getCurrentRecord()->content;
+      if (docs.size() == 2) {
+        secondDocEnd = reader.position();
+      }
+    }
+    QVERIFY(!reader.hasError());
+    QCOMPARE(docs, expected);
+
+    TxtDocsReader resumedReader{docsPath};
+    QVERIFY(resumedReader.seek(secondDocEnd));
+    QVERIFY(resumedReader.readNext());
+    QCOMPARE(resumedReader.getCurrentRecord()->content, expected[2]);
+  }
+}
+
+void TestDatabase::testMappedJsonLinesReader() {
+  QTemporaryDir tmpDir{};
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    // windows line endings and no newline at the end of the file
+    docsFile.write("{\"text\": \"doc 0\"}\r\n{\"text\": \"doc 1\"}\r\n"
+                   "{\"text\": \"doc 2\"}");
+  }
+  JsonLinesDocsReader reader{docsPath};
+  QVERIFY(reader.isMapped());
+  QCOMPARE(reader.getLineIndex()->nLines(), qint64(3));
+  QByteArray rawDoc{};
+  QVERIFY(reader.readRaw(rawDoc));
+  QCOMPARE(rawDoc, QByteArray("{\"text\": \"doc 0\"}\r\n"));
+  QCOMPARE(reader.position(), qint64(19));
+  QVERIFY(reader.readRaw(rawDoc));
+  QCOMPARE(reader.parseRaw(rawDoc)->content, QString("doc 1"));
+  QVERIFY(reader.readRaw(rawDoc));
+  QCOMPARE(reader.parseRaw(rawDoc)->content, QString("doc 2"));
+  QVERIFY(!reader.readRaw(rawDoc));
+  QCOMPARE(reader.currentProgress(), reader.progressMax());
+
+  // positions must be at the start of a line
+  QVERIFY(!reader.seek(5));
+  QVERIFY(reader.seek(19));
+  QVERIFY(reader.readNext());
+  QCOMPARE(reader.getCurrentRecord()->content, QString("doc 1"));
+
+  if (isCompressionSupported(Compression::Gzip)) {
+    // compressed files are read line by line
+    auto compressedPath = tmpDir.filePath("docs.jsonl.gz");
+    {
+      CompressedFile compressedFile{compressedPath, Compression::Gzip};
+      compressedFile.open(QIODevice::WriteOnly);
+      compressedFile.write("{\"text\": \"doc 0\"}\n");
+    }
+    JsonLinesDocsReader compressedReader{compressedPath};
+    QVERIFY(!compressedReader.isMapped());
+    QVERIFY(compressedReader.getLineIndex() == nullptr);
+    QVERIFY(compressedReader.readNext());
+    QCOMPARE(compressedReader.getCurrentRecord()->content, QString("doc 0"));
+  }
+
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  auto res = catalog.importDocuments(docsPath);
+  QCOMPARE(res.nDocs, 3);
+}
+
+void TestDatabase::testFastDocRecordParser() {
+  QList<QByteArray> recognized{
+      R"({"text": "abc"})",
+      R"( {"text":"line\nbreak \"quoted\" é😀 \/"} )",
+      "{\"text\": \"\xc3\xa9\xf0\x9f\x98\x80 \xef\xbb\xbf\"}",
+      "{\"text\": \"\xef\xbb\xbfstarts with a BOM\"}",
+      R"({"text": "unpaired \udc00 \ud83d\ude00"})",
+      R"({"utf8_text_md5_checksum": "872edcd008dee45d894d5d3c9143f96b",
+          "annotations": [{"start_byte": 0, "end_byte": 3,
+                           "label_name": "L"}]})",
+      R"({"text": "abc def", "metadata": {"b": [1, 2.5, null, true],
+          "a": {"c": "d"}}, "display_title": "T", "list_title": "",
+          "annotations": [{"start_char": 0, "end_char": -1,
+                           "label_name": "L1", "extra_data": "x",
+                           "other": {"ignored": [false]}}, {}],
+          "unknown": [[], {}]})",
+      R"({"text": "a", "metadata": {"title": "caf\u00e9 \u4e2d\u6587",
+          "n": 1, "e": {}}})",
+      "{}"};
+  QList<QByteArray> notRecognized{
+      R"({"text": ""})",
+      R"({"text": 3})",
+      R"({"text": "a", "text": "b"})",
+      R"({"te\u0078t": "abc"})",
+      R"({"text": "abc", "metadata": []})",
+      R"({"text": "abc", "metadata": {"a": 1e3}})",
+      R"({"annotations": [{"start_char": 1.0}]})",
+      R"({"annotations": [{"start_char": 12345678901}]})",
+      R"({"annotations": [{"label_name": null}]})",
+      "{\"text\": \"a\tb\"}",
+      "[]"};
+  QList<QByteArray> invalid{
+      R"({"text": "abc")",
+      R"({"text": "abc"} x)",
+      R"({"text": "abc",})",
+      R"({"text": "a\qb"})",
+      R"({"text": "a\u12"})",
+      "{\"text\": \"\xc3\"}",
+      "{\"text\": \"\xed\xa0\x80\"}",
+      "{\"text\": \"\xc0\xaf\"}",
+      R"({"text": "a", "metadata": {"a": 01}})",
+      R"({"text": "a", "metadata": {"a": tru}})",
+      R"({"annotations": [{"start_char": -}]})"};
+
+  for (const auto& json : recognized) {
+    DocRecord fast{};
+    QVERIFY2(parseDocRecordFast(json.constData(), json.size(), fast),
+             json.constData());
+    auto expected = jsonToDocRecord(QJsonDocument::fromJson(json));
+    QCOMPARE(fast.validContent, expected->validContent);
+    QCOMPARE(fast.content, expected->content);
+    // the UTF-8 is given unless the text has no UTF-8 encoding
+    QCOMPARE(fast.contentUtf8.isEmpty(),
+             !fast.validContent || json.contains("unpaired"));
+    if (!fast.contentUtf8.isEmpty()) {
+      QCOMPARE(fast.contentUtf8, fast.content.toUtf8());
+    }
+    QCOMPARE(fast.declaredMd5, expected->declaredMd5);
+    QCOMPARE(fast.displayTitle, expected->displayTitle);
+    QCOMPARE(fast.listTitle, expected->listTitle);
+    QCOMPARE(fast.metadata, expected->metadata);
+    QCOMPARE(fast.annotations.size(), expected->annotations.size());
+    for (int i = 0; i < fast.annotations.size(); ++i) {
+      const auto& annotation = fast.annotations[i];
+      const auto& expectedAnnotation = expected->annotations[i];
+      QCOMPARE(annotation.startChar, expectedAnnotation.startChar);
+      QCOMPARE(annotation.endChar, expectedAnnotation.endChar);
+      QCOMPARE(annotation.labelName, expectedAnnotation.labelName);
+      QCOMPARE(annotation.extraData, expectedAnnotation.extraData);
+      QCOMPARE(annotation.startByte, expectedAnnotation.startByte);
+      QCOMPARE(annotation.endByte, expectedAnnotation.endByte);
+    }
+  }
+  DocRecord withMetadata{};
+  auto json = recognized[6];
+  parseDocRecordFast(json.constData(), json.size(), withMetadata);
+  // compact, with sorted keys, whatever the formatting of the input
+  QCOMPARE(withMetadata.metadata,
+           QByteArray(R"({"a":{"c":"d"},"b":[1,2.5,null,true]})"));
+  DocRecord escapedMetadata{};
+  json = recognized[7];
+  parseDocRecordFast(json.constData(), json.size(), escapedMetadata);
+  QCOMPARE(escapedMetadata.metadata,
+           QString(R"({"e":{},"n":1,"title":"café 中文"})").toUtf8());
+
+  for (const auto& json : notRecognized) {
+    DocRecord record{};
+    QVERIFY2(!parseDocRecordFast(json.constData(), json.size(), record),
+             json.constData());
+  }
+  QCOMPARE(parseJsonDocRecord(notRecognized[0])->content, QString(""));
+  QCOMPARE(parseJsonDocRecord(notRecognized[3])->content, QString("abc"));
+
+  for (const auto& json : invalid) {
+    DocRecord record{};
+    QVERIFY2(!parseDocRecordFast(json.constData(), json.size(), record),
+             json.constData());
+    QVERIFY(parseJsonDocRecord(json) == nullptr);
+  }
+}
+
+void TestDatabase::testEscapedMetadata() {
+  QTemporaryDir tmpDir{};
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(tmpDir.filePath("db.sqlite"));
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(R"({"text": "doc", "metadata": { "title": )"
+                   R"("caf\u00e9 \u4e2d\u6587",  "id": 1 }})"
+                   "\n");
+  }
+  QCOMPARE(catalog.importDocuments(docsPath).nDocs, 1);
+  // stored unescaped and compact, as by QJsonDocument
+  auto expected = QString(R"({"id":1,"title":"café 中文"})").toUtf8();
+  QSqlQuery query(QSqlDatabase::database(catalog.getCurrentDatabase()));
+  query.exec("select metadata from document;");
+  query.next();
+  QCOMPARE(query.value(0).toByteArray(), expected);
+  query.finish();
+
+  auto exportPath = tmpDir.filePath("export.jsonl");
+  catalog.exportDocuments(exportPath, false, true, true);
+  QFile exportFile{exportPath};
+  exportFile.open(QIODevice::ReadOnly);
+  auto exported = exportFile.readAll();
+  QVERIFY(exported.contains(R"("metadata":)" + expected));
+  QCOMPARE(QJsonDocument::fromJson(exported)
+               .object()["metadata"]
+               .toObject()["title"]
+               .toString(),
+           QString("café 中文"));
+}
+
 void TestDatabase::testImportExportLabels() {
   QTemporaryDir tmpDir{};
   DatabaseCatalog catalog{};
@@ -26,6 +26,29 @@ private slots:
   void testImportErrors();
   void testBadAnnotations();
   void testImportAnnotations();
+  void testBulkInsertAnnotations();
+  void testBulkLoad();
+  void testImportRejects();
+  void testDryRunImport();
+  void testUtf8ContentImport_data();
+  void testUtf8ContentImport();
+  void testStoredUtf8Index();
+  void testProgressReporter();
+  void testReaderProgress();
+  void testStreamingExport();
+  void testParallelExport();
+  void testShardedExport();
+  void testIncrementalExport();
+  void testResumeImport_data();
+  void testResumeImport();
+  void testParallelImport();
+  void testImportDocumentFiles();
+  void testStreamingJsonImport();
+  void testCompressedImportExport();
+  void testMappedJsonLinesReader();
+  void testTxtDocsReader();
+  void testFastDocRecordParser();
+  void testEscapedMetadata();
   void cleanup();
 
 private:
@@ -1,7 +1,9 @@
+#include <QFile>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QTemporaryDir>
 
+#include "database.h"
 #include "doc_list_model.h"
 #include "test_doc_list_model.h"
 #include "testing_utils.h"
@@ -71,6 +73,33 @@ void TestDocListModel::testFilters() {
   QCOMPARE(model.data(model.index(3, 0), Roles::RowIdRole).toInt(), 4);
 }
 
+void TestDocListModel::testSearchEscapedMetadata() {
+  QTemporaryDir tmpDir{};
+  auto dbName = tmpDir.filePath("db.sqlite");
+  DatabaseCatalog catalog{};
+  catalog.openDatabase(dbName);
+  auto docsPath = tmpDir.filePath("docs.jsonl");
+  {
+    QFile docsFile{docsPath};
+    docsFile.open(QIODevice::WriteOnly);
+    docsFile.write(R"({"text": "doc 0", "metadata": {"title": "caf\u00e9"}})"
+                   "\n"
+                   R"({"text": "doc 1", "metadata": {"title": "cafe"}})"
+                   "\n");
+  }
+  catalog.importDocuments(docsPath);
+  DocListModel model{};
+  model.setDatabase(dbName);
+  QCOMPARE(model.rowCount(), 2);
+  // metadata escaped in the imported file is searched unescaped
+  model.adjustQuery(DocListModel::DocFilter::all, -1, "café");
+  QCOMPARE(model.rowCount(), 1);
+  model.adjustQuery(DocListModel::DocFilter::all, -1, R"("café")");
+  QCOMPARE(model.rowCount(), 1);
+  model.adjustQuery(DocListModel::DocFilter::all, -1, "u00e9");
+  QCOMPARE(model.rowCount(), 0);
+}
+
 void TestDocListModel::testUpdatingResults() {
   QTemporaryDir tmpDir{};
   auto dbName = prepareDb(tmpDir);
@@ -9,6 +9,7 @@ class TestDocListModel : public QObject {
 private slots:
   void testDeleteDocs();
   void testFilters();
+  void testSearchEscapedMetadata();
   void testUpdatingResults();
 };
 } // namespace labelbuddy
@@ -0,0 +1,225 @@
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "database_impl.h"
+#include "json_writer.h"
+#include "test_json_writer.h"
+
+namespace labelbuddy {
+
+namespace {
+
+/// How documents were serialized before `JsonWriter`, through a QJsonObject
+QByteArray serializeWithQJson(const QString& md5, const QByteArray& contentUtf8,
+                              const QByteArray& metadata,
+                              const QList<Annotation>& annotations,
+                              const QString& displayTitle,
+                              const QString& listTitle) {
+  QJsonObject docJson{};
+  docJson.insert("utf8_text_md5_checksum", md5);
+  docJson.insert("metadata", QJsonDocument::fromJson(metadata).object());
+  if (displayTitle != QString()) {
+    docJson.insert("display_title", displayTitle);
+  }
+  if (listTitle != QString()) {
+    docJson.insert("list_title", listTitle);
+  }
+  docJson.insert("text", QString::fromUtf8(contentUtf8));
+  QJsonArray allAnnotationsJson{};
+  for (const auto& annotation : annotations) {
+    QJsonObject annotationJson{};
+    annotationJson.insert("start_char", annotation.startChar);
+    annotationJson.insert("end_char", annotation.endChar);
+    annotationJson.insert("start_byte", annotation.startByte);
+    annotationJson.insert("end_byte", annotation.endByte);
+    annotationJson.insert("label_name", annotation.labelName);
+    if (annotation.extraData != "") {
+      annotationJson.insert("extra_data", annotation.extraData);
+    }
+    allAnnotationsJson.append(annotationJson);
+  }
+  docJson.insert("annotations", allAnnotationsJson);
+  return QJsonDocument(docJson).toJson(QJsonDocument::Compact);
+}
+
+QByteArray writeString(const char* utf8, int size) {
+  QByteArray output{};
+  JsonWriter json(output);
+  json.beginArray();
+  json.stringValue(utf8, size);
+  json.endArray();
+  return output;
+}
+
+QByteArray writeString(const QByteArray& utf8) {
+  return writeString(utf8.constData(), utf8.size());
+}
+
+QByteArray writeQString(const QString& value) {
+  QByteArray output{};
+  JsonWriter json(output);
+  json.beginArray();
+  json.stringValue(value);
+  json.endArray();
+  return output;
+}
+
+QByteArray qJsonString(const QByteArray& utf8) {
+  return QJsonDocument(
+             QJsonArray{QString::fromUtf8(utf8.constData(), utf8.size())})
+      .toJson(QJsonDocument::Compact);
+}
+
+} // namespace
+
+void TestJsonWriter::testStructure() {
+  QByteArray output{"prefix"};
+  JsonWriter json(output);
+  json.beginObject();
+  json.key("a");
+  json.beginArray();
+  json.intValue(1);
+  json.intValue(-2);
+  json.beginObject();
+  json.endObject();
+  json.beginArray();
+  json.endArray();
+  json.stringValue(QString("x"));
+  json.endArray();
+  json.key("b");
+  json.rawValue("{\"c\": null}");
+  json.key("d");
+  json.intValue(Q_INT64_C(12345678901));
+  json.endObject();
+  QCOMPARE(output,
+           QByteArray("prefix{\"a\":[1,-2,{},[],\"x\"],\"b\":{\"c\": null},"
+                      "\"d\":12345678901}"));
+}
+
+void TestJsonWriter::testEscapes() {
+  QByteArray allBytes{};
+  for (int i = 0; i != 0x80; ++i) {
+    allBytes.append(static_cast<char>(i));
+  }
+  allBytes.append("\xc3\xa9\xf0\x9d\x84\x9e");
+  QCOMPARE(writeString(allBytes), qJsonString(allBytes));
+
+  // special characters at every position of a block scanned at once
+  for (const char special : {'"', '\\', '\n', '\x01', '\x1f'}) {
+    for (int i = 0; i != 40; ++i) {
+      QByteArray text(40, 'a');
+      text[i] = special;
+      text.append("\xc3\xa9 \xe2\x82\xac");
+      QCOMPARE(writeString(text), qJsonString(text));
+    }
+  }
+  QCOMPARE(writeString(""), QByteArray("[\"\"]"));
+  QCOMPARE(writeString("\x7f"), QByteArray("[\"\x7f\"]"));
+}
+
+void TestJsonWriter::testUnpairedSurrogates() {
+  const QChar high(0xd83d);
+  const QChar low(0xde00);
+  // escaped like QJsonDocument does, rather than replaced with '?'
+  QCOMPARE(writeQString(QString("a") + high + "b"),
+           QByteArray(R"(["a\ud83db"])"));
+  const QList<QString> texts{QString(high),
+                             QString(low) + "é\n",
+                             QString("😀") + low + high + "😀" + high,
+                             QString(high) + high + low + low,
+                             QString(20, 'a') + low + "\"" + QString(20, 'b')};
+  for (const auto& text : texts) {
+    QCOMPARE(writeQString(text),
+             QJsonDocument(QJsonArray{text}).toJson(QJsonDocument::Compact));
+  }
+  // valid text is written as its UTF-8
+  QCOMPARE(writeQString("é😀"), writeString("é😀"));
+}
+
+void TestJsonWriter::testBlockBoundaries() {
+  // bytes that must be escaped, the bytes on either side of the ranges that
+  // must be, and multi-byte characters, which may straddle two blocks
+  const QList<QByteArray> insertions{
+      "\"", "\\", "\x01", "\x1f", "\t", " ", "\x7f", "\"\\", "\n\"",
+      "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9d\x84\x9e"};
+  for (int size : {1, 15, 16, 17, 31, 32, 33, 47, 48, 49}) {
+    for (const auto& insertion : insertions) {
+      for (int i = 0; i + insertion.size() <= size; ++i) {
+        QByteArray text(size, 'a');
+        text.replace(i, insertion.size(), insertion);
+        QCOMPARE(writeString(text), qJsonString(text));
+      }
+    }
+  }
+
+  // the blocks are loaded from addresses that are not aligned
+  QByteArray text(48, 'a');
+  for (int i : {0, 15, 16, 31, 32, 47}) {
+    text[i] = '"';
+  }
+  for (int offset = 0; offset != 16; ++offset) {
+    auto padded = QByteArray(offset, 'x') + text;
+    QCOMPARE(writeString(padded.constData() + offset, text.size()),
+             qJsonString(text));
+  }
+}
+
+void TestJsonWriter::testSerializeDocument() {
+  QTemporaryDir tmpDir{};
+  JsonLinesDocsWriter writer(tmpDir.filePath("docs.jsonl"), true, true);
+  QByteArray content("a\t\"b\" \xc3\xa9\n\\c \xf0\x9d\x84\x9e d");
+  QList<Annotation> annotations{{0, 1, "label \"1\"", "extra\n", 0, 1},
+                                {3, 5, "label 2", "", 3, 5}};
+  QByteArray metadata("{\"key\":\"value\",\"n\":[1,2.5]}");
+  QByteArray output{};
+  writer.serializeDocument("abc", content, metadata, annotations, "display",
+                           "", output);
+  QCOMPARE(output, serializeWithQJson("abc", content, metadata, annotations,
+                                      "display", ""));
+
+  output.clear();
+  writer.serializeDocument("abc", content, metadata, {}, "", "list title",
+                           output);
+  QCOMPARE(output,
+           serializeWithQJson("abc", content, metadata, {}, "", "list title"));
+
+  output.clear();
+  JsonLinesDocsWriter noTextWriter(tmpDir.filePath("no_text.jsonl"), false,
+                                   false);
+  noTextWriter.serializeDocument("abc", content, metadata, annotations,
+                                 "display", "list", output);
+  QCOMPARE(output,
+           QByteArray("{\"metadata\":") + metadata +
+               ",\"utf8_text_md5_checksum\":\"abc\"}");
+}
+
+void TestJsonWriter::testMetadata() {
+  QTemporaryDir tmpDir{};
+  JsonLinesDocsWriter writer(tmpDir.filePath("docs.jsonl"), false, false);
+  auto serializedMetadata = [&writer](const QByteArray& metadata)
+      -> QJsonValue {
+    QByteArray output{};
+    writer.serializeDocument("abc", "", metadata, {}, "", "", output);
+    return QJsonDocument::fromJson(output).object()["metadata"];
+  };
+  // stored metadata is spliced unchanged
+  QByteArray output{};
+  writer.serializeDocument("abc", "", "{\"b\": 1,  \"a\": 2}", {}, "", "",
+                           output);
+  QCOMPARE(output, QByteArray("{\"metadata\":{\"b\": 1,  \"a\": 2},"
+                              "\"utf8_text_md5_checksum\":\"abc\"}"));
+  // unless it would not be valid in a JSON lines file
+  QCOMPARE(serializedMetadata(""), QJsonValue(QJsonObject{}));
+  QCOMPARE(serializedMetadata("[1, 2]"), QJsonValue(QJsonObject{}));
+  QCOMPARE(serializedMetadata("{\n\"a\": 1\n}"),
+           QJsonValue(QJsonObject{{"a", 1}}));
+  output.clear();
+  writer.serializeDocument("abc", "", "{\r\n\"a\": 1}", {}, "", "", output);
+  QVERIFY(!output.contains('\n'));
+  QVERIFY(!output.contains('\r'));
+}
+
+} // namespace labelbuddy
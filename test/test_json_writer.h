@@ -0,0 +1,23 @@
+#ifndef LABELBUDDY_TEST_JSON_WRITER_H
+#define LABELBUDDY_TEST_JSON_WRITER_H
+
+#include <QObject>
+
+namespace labelbuddy {
+
+class TestJsonWriter : public QObject {
+
+  Q_OBJECT
+
+private slots:
+
+  void testStructure();
+  void testEscapes();
+  void testUnpairedSurrogates();
+  void testBlockBoundaries();
+  void testSerializeDocument();
+  void testMetadata();
+};
+
+} // namespace labelbuddy
+#endif
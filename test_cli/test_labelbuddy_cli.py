@@ -1,7 +1,9 @@
 import math
 import random
+import re
 from pathlib import Path
 import hashlib
+import gzip
 import os
 import subprocess
 import shutil
@@ -306,6 +308,319 @@ def test_import_docs(formats, labelbuddy, tmp_path, ng):
     check_imported_docs(db, input_docs, same_order=False, n_docs=15)
 
 
+@pytest.mark.parametrize("doc_format", ["json", "jsonl", "txt"])
+def test_import_docs_threads(doc_format, labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    res = labelbuddy(
+        db, "--import-docs", ng[f"docs_0-300.{doc_format}"], "--threads", 4
+    )
+    assert res.returncode == 0
+    with open(ng[f"{doc_format}_data_docs_0-300.pkl"], "rb") as f:
+        input_docs = pickle.load(f)
+    check_imported_docs(db, input_docs, same_order=True, n_docs=300)
+    res = labelbuddy(db, "--import-docs", ng["docs_0-15.json"], "--threads", 0)
+    assert res.returncode == 1
+
+
+def test_import_docs_bulk_load(labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    res = labelbuddy(db, "--import-docs", ng["docs_0-300.jsonl"], "--bulk-load")
+    assert res.returncode == 0
+    with open(ng["jsonl_data_docs_0-300.pkl"], "rb") as f:
+        input_docs = pickle.load(f)
+    check_imported_docs(db, input_docs, same_order=True, n_docs=300)
+    with sqlite3.connect(db) as con:
+        indexes = {
+            row[0]
+            for row in con.execute(
+                "select name from sqlite_master where type = 'index'"
+            )
+        }
+        journal_mode = con.execute("pragma journal_mode").fetchone()[0]
+    assert {
+        "document_id_idx",
+        "annotation_doc_id_idx",
+        "annotation_label_id_idx",
+    } <= indexes
+    assert journal_mode == "delete"
+
+
+def test_import_docs_dry_run(labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    res = labelbuddy(
+        db,
+        "--import-docs",
+        ng["docs_0-300.jsonl"],
+        "--import-labels",
+        ng["labels.json"],
+        "--dry-run",
+    )
+    assert res.returncode == 0
+    assert b"Documents read: 300" in res.stdout
+    assert b"  new: 300" in res.stdout
+    with sqlite3.connect(db) as con:
+        assert con.execute("select count(*) from document").fetchone()[0] == 0
+        assert con.execute("select count(*) from label").fetchone()[0] == 0
+
+
+def test_dry_run_annotations_in_database(labelbuddy, tmp_path):
+    db = tmp_path / "db.labelbuddy"
+    first = tmp_path / "first.jsonl"
+    first.write_text(
+        json.dumps(
+            {
+                "text": "some text",
+                "annotations": [
+                    {"label_name": "a", "start_char": 0, "end_char": 4}
+                ],
+            }
+        )
+        + "\n",
+        encoding="utf-8",
+    )
+    # annotates the document of the first file, once with a duplicate
+    second = tmp_path / "second.jsonl"
+    annotation = {"label_name": "b", "start_char": 5, "end_char": 9}
+    second.write_text(
+        json.dumps(
+            {
+                "utf8_text_md5_checksum": hashlib.md5(b"some text").hexdigest(),
+                "annotations": [annotation, annotation],
+            }
+        )
+        + "\n",
+        encoding="utf-8",
+    )
+    res = labelbuddy(
+        db, "--import-docs", first, "--import-docs", second, "--dry-run"
+    )
+    assert res.returncode == 0
+    assert res.stdout.count(b"Annotations to import: 1\n") == 2
+    assert b"  duplicates of an earlier annotation: 1\n" in res.stdout
+    with sqlite3.connect(db) as con:
+        assert con.execute("select count(*) from annotation").fetchone()[0] == 0
+    res = labelbuddy(db, "--import-docs", first)
+    assert res.returncode == 0
+    res = labelbuddy(db, "--import-docs", first, "--dry-run")
+    assert res.returncode == 0
+    assert b"Annotations to import: 0\n" in res.stdout
+    assert (
+        b"Annotations dropped:\n  already in the database: 1\n" in res.stdout
+    )
+
+
+def test_progress_json_lines(labelbuddy, tmp_path, ng):
+    # stdout is a pipe so the progress is reported as JSON lines
+    db = tmp_path / "db.labelbuddy"
+    res = labelbuddy(db, "--import-docs", ng["docs_0-300.jsonl"])
+    assert res.returncode == 0
+    reports = [
+        json.loads(line)
+        for line in res.stdout.splitlines()
+        if line.startswith(b'{"')
+    ]
+    assert reports[-1]["operation"] == "import"
+    assert reports[-1]["docs"] == 300
+    assert reports[-1]["done"]
+    assert b"\r" not in res.stdout
+    res = labelbuddy(db, "--export-docs", "-", "--format", "jsonl")
+    assert res.returncode == 0
+    assert len(res.stdout.splitlines()) == 300
+    report = json.loads(res.stderr.splitlines()[-1])
+    assert report["operation"] == "export"
+    assert report["docs"] == 300
+
+
+@pytest.mark.parametrize("doc_format", ["json", "jsonl", "txt"])
+def test_import_export_standard_streams(doc_format, labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    docs = Path(ng[f"docs_0-300.{doc_format}"]).read_bytes()
+    res = labelbuddy(
+        db,
+        "--import-docs",
+        "-",
+        "--export-docs",
+        "-",
+        "--format",
+        doc_format,
+        input=docs,
+    )
+    assert res.returncode == (1 if doc_format == "txt" else 0)
+    with open(ng[f"{doc_format}_data_docs_0-300.pkl"], "rb") as f:
+        input_docs = pickle.load(f)
+    check_imported_docs(db, input_docs, same_order=True, n_docs=300)
+    if doc_format == "json":
+        exported = json.loads(res.stdout)
+    else:
+        exported = [json.loads(line) for line in res.stdout.splitlines()]
+    assert len(exported) == (0 if doc_format == "txt" else 300)
+    res = labelbuddy(db, "--import-docs", "-", input=docs)
+    assert res.returncode == 1
+    assert b"--format" in res.stderr
+
+
+def test_standard_input_not_resumed(labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    # the import stops at the invalid last line, after 3 complete batches
+    docs = Path(ng["docs_0-300.jsonl"]).read_bytes().rstrip(b"\n")
+    docs += b"\n{invalid}\n"
+    labelbuddy(
+        db,
+        "--import-docs",
+        "-",
+        "--format",
+        "jsonl",
+        "--batch-size",
+        "100",
+        input=docs,
+    )
+    with sqlite3.connect(db) as con:
+        assert con.execute("select count(*) from document").fetchone()[0] == 300
+        # another stream could be given to a resumed import
+        assert (
+            con.execute(
+                "select count(*) from app_state_extra where key = "
+                "'import_checkpoint' and value is not null"
+            ).fetchone()[0]
+            == 0
+        )
+    res = labelbuddy(
+        db, "--import-docs", "-", "--format", "jsonl", "--resume", input=docs
+    )
+    assert res.returncode == 1
+    assert b"--resume" in res.stderr
+
+
+def test_import_export_gzip(labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    compressed_docs = tmp_path / "docs_0-300.jsonl.gz"
+    with open(ng["docs_0-300.jsonl"], "rb") as f_in:
+        with gzip.open(compressed_docs, "wb") as f_out:
+            shutil.copyfileobj(f_in, f_out)
+    exported = tmp_path / "exported.json.gz"
+    res = labelbuddy(
+        db, "--import-docs", compressed_docs, "--export-docs", exported
+    )
+    assert res.returncode == 0
+    with open(ng["jsonl_data_docs_0-300.pkl"], "rb") as f:
+        input_docs = pickle.load(f)
+    check_imported_docs(db, input_docs, same_order=True, n_docs=300)
+    with gzip.open(exported, "rt", encoding="utf-8") as f:
+        assert len(json.load(f)) == 300
+
+
+def test_export_shards(labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    exported = tmp_path / "exported.jsonl.gz"
+    res = labelbuddy(
+        db,
+        "--import-docs",
+        ng["docs_0-300.jsonl"],
+        "--export-docs",
+        exported,
+        "--export-shard-size",
+        "120",
+    )
+    assert res.returncode == 0
+    assert not exported.exists()
+    manifest = json.loads((tmp_path / "exported.manifest.json").read_text())
+    assert manifest["complete"]
+    assert manifest["n_docs"] == 300
+    assert [shard["n_docs"] for shard in manifest["shards"]] == [120, 120, 60]
+    docs = []
+    for i, shard in enumerate(manifest["shards"]):
+        assert shard["file"] == f"exported-{i + 1:05}.jsonl.gz"
+        assert shard["first_doc"] == len(docs)
+        with gzip.open(tmp_path / shard["file"], "rb") as f:
+            content = f.read()
+        assert len(content) == shard["end_byte"] - shard["start_byte"]
+        docs.extend(json.loads(line) for line in content.splitlines())
+    input_lines = Path(ng["docs_0-300.jsonl"]).read_text("utf-8").splitlines()
+    input_docs = [json.loads(line) for line in input_lines]
+    assert [doc["text"] for doc in docs] == [doc["text"] for doc in input_docs]
+    res = labelbuddy(db, "--export-docs", exported, "--export-shard-size", "0")
+    assert res.returncode == 1
+    res = labelbuddy(
+        db,
+        "--export-docs",
+        "-",
+        "--format",
+        "jsonl",
+        "--export-shard-size",
+        "1MB",
+    )
+    assert res.returncode == 1
+    assert b"--export-shard-size" in res.stderr
+
+
+def test_export_since(labelbuddy, tmp_path, ng):
+    db = tmp_path / "db.labelbuddy"
+    exported = tmp_path / "exported.jsonl"
+    res = labelbuddy(
+        db,
+        "--import-labels",
+        ng["labels.json"],
+        "--import-docs",
+        ng["docs_0-15.json"],
+        "--export-docs",
+        exported,
+    )
+    assert res.returncode == 0
+    watermark = int(
+        re.search(rb"Export watermark: (\d+)", res.stdout).group(1)
+    )
+    add_random_annotations(db)
+    with sqlite3.connect(db) as con:
+        changed = {
+            row[0]
+            for row in con.execute(
+                "select lower(hex(content_md5)) from document where id in "
+                "(select doc_id from annotation)"
+            )
+        }
+    assert changed
+    res = labelbuddy(
+        db,
+        "--export-docs",
+        exported,
+        "--export-since",
+        str(watermark),
+        "--labelled-only",
+    )
+    assert res.returncode == 0
+    docs = [json.loads(line) for line in exported.read_text().splitlines()]
+    assert {doc["utf8_text_md5_checksum"] for doc in docs} == changed
+    new_watermark = int(
+        re.search(rb"Export watermark: (\d+)", res.stdout).group(1)
+    )
+    assert new_watermark > watermark
+    res = labelbuddy(
+        db, "--export-docs", exported, "--export-since", str(new_watermark)
+    )
+    assert res.returncode == 0
+    assert exported.read_text() == ""
+    deleted = sorted(changed)[0]
+    with sqlite3.connect(db) as con:
+        con.execute("pragma foreign_keys = on")
+        con.execute(
+            "delete from document where lower(hex(content_md5)) = ?",
+            (deleted,),
+        )
+    res = labelbuddy(
+        db,
+        "--export-docs",
+        exported,
+        "--export-since",
+        str(new_watermark),
+        "--labelled-only",
+    )
+    assert res.returncode == 0
+    docs = [json.loads(line) for line in exported.read_text().splitlines()]
+    assert docs == [{"deleted": True, "utf8_text_md5_checksum": deleted}]
+    res = labelbuddy(db, "--export-docs", exported, "--export-since", "-1")
+    assert res.returncode == 1
+
+
 @pytest.mark.parametrize(
     "formats",
     [